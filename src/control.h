@@ -0,0 +1,77 @@
+// Header file for the control protocol spoken between the
+// [`going.c`](going.c.html) and [`goingctl.c`](goingctl.c.html) source
+// files.
+
+// Constants
+// ---------
+
+// The default path of the control socket, and the command line flag used
+// to change it.
+#define CONTROL_PATH "/run/going.sock"
+#define CMD_FLAG_CONTROL "-s"
+
+// Requests and replies are sent as frames over a stream socket. A frame
+// starts with a 32 bit length in network byte order of the bytes that
+// follow it, and a frame including its length is never larger than
+// `CONTROL_FRAME_SIZE` bytes. The first byte after the length tells what
+// kind of frame it is.
+#define CONTROL_FRAME_SIZE 512
+#define CONTROL_LENGTH_SIZE 4
+
+// Children are named after their configuration file of at most
+// `CHILD_NAME_SIZE` characters. An instance of a child has a suffix of at
+// most `INSTANCE_SUFFIX_SIZE` more characters added to its name, which
+// makes for the longest name in a frame.
+#define CHILD_NAME_SIZE 32
+#define INSTANCE_SUFFIX_SIZE 5
+#define INSTANCE_NAME_SIZE (CHILD_NAME_SIZE + INSTANCE_SUFFIX_SIZE)
+
+// A request frame holds one of these requests, followed by the name of
+// the child it concerns. The name is left out to ask for the status of
+// all children, and for a reload.
+#define CONTROL_STATUS 1
+#define CONTROL_START 2
+#define CONTROL_STOP 3
+#define CONTROL_RESTART 4
+#define CONTROL_RELOAD 5
+
+// A request is answered with zero or more child frames, exit frames, and
+// output frames followed by a done frame, or with an error frame holding
+// a message.
+#define CONTROL_REPLY_CHILD 1
+#define CONTROL_REPLY_OUTPUT 2
+#define CONTROL_REPLY_DONE 3
+#define CONTROL_REPLY_ERROR 4
+#define CONTROL_REPLY_EXIT 5
+
+// A child frame holds the process id of the child, its state, the
+// number of seconds it has been up or has left of its quarantine, and
+// its number of consecutive quarantines, followed by its name. The
+// numbers are 32 bit in network byte order and the state is a byte. These
+// are the offsets of the fields from the kind of the frame.
+#define CONTROL_CHILD_PID 1
+#define CONTROL_CHILD_STATE 5
+#define CONTROL_CHILD_SECONDS 6
+#define CONTROL_CHILD_QUARANTINES 10
+#define CONTROL_CHILD_NAME 14
+
+// An exit frame describes a terminated process of a child: how many
+// seconds ago it terminated, how many seconds it was up, its status as
+// returned by `waitpid(3)`, its maximum resident set size in kilobytes,
+// and the milliseconds of processor time it spent in user and system
+// mode. The numbers are 32 bit in network byte order.
+#define CONTROL_EXIT_AGO 1
+#define CONTROL_EXIT_UPTIME 5
+#define CONTROL_EXIT_STATUS 9
+#define CONTROL_EXIT_MAXRSS 13
+#define CONTROL_EXIT_USER 17
+#define CONTROL_EXIT_SYS 21
+#define CONTROL_EXIT_SIZE 25
+
+// The states a child can be in.
+#define CONTROL_STATE_RUNNING 1
+#define CONTROL_STATE_QUARANTINED 2
+#define CONTROL_STATE_STOPPED 3
+#define CONTROL_STATE_RESTARTING 4
+#define CONTROL_STATE_STOPPING 5
+#define CONTROL_STATE_WAITING 6
@@ -13,7 +13,10 @@
 // needed nor desirable.
 //
 // If a child terminates too fast (within a window of 5 seconds) it will be
-// quarantined for 30 seconds before it will be respawned.
+// quarantined for 30 seconds before it will be respawned. Each consecutive
+// quarantine lasts twice as long, up to 10 minutes, with a little random
+// jitter so that children which terminated together don't come back
+// together.
 //
 // All abnormal events will be logged to the daemon facility of the
 // system log (typically found in `/var/log/daemon.log`).
@@ -24,20 +27,29 @@
 // Usage
 // -----
 //
-// See [`going(8)`](going.8.html) and [`going(5)`](going.5.html).
+// See [`going(8)`](going.8.html) and [`going(5)`](going.5.html). A running
+// `going` is controlled with [`goingctl(8)`](goingctl.8.html).
 //
 // Portability
 // -----------
 //
 // `going` is written in C99 specially for GNU/Linux systems. No special care
 // has been taken to make this program protable to other UNIX plattforms.
-// While no Linux-only system calls is currently in use future versions of
-// `going` will likely take advantage of `epoll(7)`, `inotify(7)`, and
-// `signalfd(2)`.
+// The main loop is built on `epoll(7)`, `signalfd(2)`, and
+// `timerfd_create(2)` with the flags added to them in Linux 2.6.27, which
+// is therefore the oldest kernel `going` will run on. On Linux 5.4 and
+// later children are tracked through process file descriptors from
+// `pidfd_open(2)`. Older kernels fall back to reaping children with
+// `waitpid(3)` when `SIGCHLD` is delivered. Processes orphaned by children
+// are reparented to `going` on Linux 3.4 and later.
 
 // Dependencies
 // ------------
 
+// We ask the C library for GNU extensions like `POSIX_SPAWN_SETSID` and
+// `posix_spawn_file_actions_addchdir_np(3)`.
+#define _GNU_SOURCE
+
 // Include memory allocation and process control functions and macros like
 // `exit(3)`, `atexit(3)`, `calloc(3)`, and `EXIT_SUCCESS`.
 #include <stdlib.h>
@@ -46,9 +58,18 @@
 // `fork(3)`, `setsid(3)`, `execvp(3)`, and `sleep(3)`.
 #include <unistd.h>
 
+// Include `posix_spawn(3)` and its attribute and file action functions.
+#include <spawn.h>
+
 // Include macros giving us access to the boolean types `true` and `false`.
 #include <stdbool.h>
 
+// Include exact width integer types like `uint32_t`.
+#include <stdint.h>
+
+// Include `offsetof()` for the length of socket addresses.
+#include <stddef.h>
+
 // Include string operation functions like
 // `strncmp(3)`, `strsep(3)`, `strcpy(3)`, and `strnlen(3)`.
 #include <string.h>
@@ -77,11 +98,52 @@
 // `va_start(3)`, `va_end(3)` and `va_list`.
 #include <stdarg.h>
 
-// Include functions and constants for logging to the system log like
-// `openlog(3)`, `closelog(3)`, `vsyslog(3)`, `LOG_DAEMON`, `LOG_PID`,
+// Include constants for logging to the system log like `LOG_DAEMON`,
 // `LOG_EMERG`, and `LOG_WARNING`.
 #include <sys/syslog.h>
 
+// Include `socket(2)`, `connect(2)`, and `send(2)` for talking to the
+// system logger, `bind(2)` and `listen(2)` for sockets listening on
+// behalf of children, and `struct sockaddr_un` for unix socket addresses.
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Include `getaddrinfo(3)` for the addresses children listen on.
+#include <netdb.h>
+
+// Include the `epoll(7)` interface like `epoll_create1(2)`, `epoll_ctl(2)`,
+// `epoll_wait(2)`, and `struct epoll_event`.
+#include <sys/epoll.h>
+
+// Include `signalfd(2)` for accepting signals through a file descriptor
+// and `struct signalfd_siginfo`.
+#include <sys/signalfd.h>
+
+// Include `timerfd_create(2)` and `timerfd_settime(2)` for timers we can
+// wait for through a file descriptor.
+#include <sys/timerfd.h>
+
+// Include `syscall(2)` and the `SYS_pidfd_open`, `SYS_pidfd_send_signal`,
+// and `SYS_waitid` system call numbers for system calls we invoke directly.
+#include <sys/syscall.h>
+
+// Include the `inotify(7)` interface like `inotify_init1(2)`,
+// `inotify_add_watch(2)`, and `struct inotify_event`.
+#include <sys/inotify.h>
+
+// Include implementation limits like `PATH_MAX` and `NAME_MAX`.
+#include <limits.h>
+
+// Include `stat(2)` and `struct stat`.
+#include <sys/stat.h>
+
+// Include `open(2)`, `fcntl(2)`, `splice(2)`, and `tee(2)` with flags like
+// `O_CLOEXEC`, `O_NONBLOCK`, and `SPLICE_F_NONBLOCK`.
+#include <fcntl.h>
+
+// Include `readv(2)` and `struct iovec` for reading into a ring buffer.
+#include <sys/uio.h>
+
 // Include functions and symbolic constants for waiting for children like
 // `waitpid(3)`, and `WNOHANG`.
 // This header implicitly includes `signal.h` which gives us signal
@@ -89,6 +151,25 @@
 // `sigprocmask(3)`, `sigaddset(3)`, `SIGCHLD`, `SIGHUP` and `sigset_t`.
 #include <sys/wait.h>
 
+// Include `wait4(2)` and `struct rusage` for the resources used by
+// terminated children, and `setpriority(2)` and `setrlimit(2)` for how
+// children are scheduled and limited and how many files we can open.
+#include <sys/resource.h>
+
+// Include `sched_setaffinity(2)` and `cpu_set_t` for pinning instances of
+// children to processors.
+#include <sched.h>
+
+// Include `prctl(2)` for becoming the subreaper of our children.
+#include <sys/prctl.h>
+
+// Include `htonl(3)` and `ntohl(3)` for numbers in our control protocol.
+#include <arpa/inet.h>
+
+// Include the constants of our control protocol from the
+// [`control.h` header file](control.h.html).
+#include "control.h"
+
 // Include constants, type definitions, and function prototypes from
 // the [`going.h` header file](going.h.html).
 #include "going.h"
@@ -99,6 +180,156 @@
 // the `child_t` type.
 static child_t *head_ch = NULL;
 
+// We also keep a pointer to the tail of the linked list so that new
+// children can be appended without walking the list.
+static child_t *tail_ch = NULL;
+
+// Children whose configuration file is gone are kept in a list of their
+// own until their process has terminated and been reaped.
+static child_t *removed_ch = NULL;
+
+// Configuration files are matched with children by name. A hash table
+// index from names to children lets a reload look up each configuration
+// file in constant time.
+static index_t name_index = { NULL, sizeof(child_t *), 0, 0,
+                               NAME_INDEX_MIN_SIZE, name_entry_slot,
+                               name_entry_used };
+
+// Every scan of the configuration directory gets a new generation number.
+// Children seen in a scan are stamped with its generation so that those
+// whose configuration files are gone can be found in a single pass over
+// the linked list afterwards.
+static unsigned long confdir_generation = 0;
+
+// The configuration directory is read again whenever we're asked to
+// reload our configuration.
+static const char *confdir = CONFIG_DIR;
+
+// We can be asked about our children and told what to do with them
+// through a control socket. Its connections are served from a fixed
+// number of slots.
+static const char *control_path = CONTROL_PATH;
+static event_t control_ev = { -1, handle_control, NULL };
+static control_conn_t control_conns[CONTROL_CONNECTIONS_MAX];
+
+// Metrics of our children are written to a file every so often when we've
+// been given one.
+static const char *metrics_path = NULL;
+static timeout_t metrics_to = { { 0, 0 }, handle_metrics_timeout, NULL, 0 };
+
+// Children using too much of their resources are found by a watchdog
+// sampling them every so often while any of them is watched.
+static timeout_t watchdog_to = { { 0, 0 }, handle_watchdog, NULL, 0 };
+
+// Children tell us when they're ready through a datagram socket whose
+// name is passed to them in their environment.
+static event_t notify_ev = { -1, handle_notify, NULL };
+static char notify_path[NOTIFY_PATH_SIZE] = "";
+
+// Our main loop waits for readiness of file descriptors registered with a
+// single `epoll(7)` instance. Signals and timers are delivered through
+// file descriptors of their own which are registered as event sources
+// like any other.
+static int epoll_fd = -1;
+static event_t signal_ev = { -1, handle_signals, NULL };
+static event_t timer_ev = { -1, handle_timer, NULL };
+
+// Everything we have to do at a later point in time, like spawning a
+// quarantined child, is a timeout kept in a binary min-heap ordered by
+// deadline. Our single timer is always armed for the earliest deadline.
+// The heap is stored from index one so that the heap index of a timeout
+// can be zero when it isn't scheduled.
+static timeout_t **timeouts = NULL;
+static size_t timeouts_size = 0;
+static size_t timeouts_count = 0;
+static struct timespec timer_armed_at = { 0, 0 };
+
+// The events returned by the last `epoll_wait(2)` call are kept globally
+// so that an event source removed by a handler can be dropped from the
+// events not yet dispatched.
+static struct epoll_event ready_events[EVENT_BATCH_SIZE];
+static int ready_count = 0;
+
+// When the kernel supports process file descriptors every child process
+// gets one which becomes readable when the process terminates. We're then
+// told exactly which child terminated in stead of having to sweep for
+// terminated children with `waitpid(3)` on `SIGCHLD`.
+static bool pidfd_mode = false;
+
+// As a subreaper we're the parent of processes orphaned by our children,
+// which we sweep for on `SIGCHLD` even in process file descriptor mode.
+static bool subreaper = false;
+
+// When we're given a control group directory every child is placed in a
+// control group of its own below it. A child whose process left others
+// behind is draining until they're all gone, which holds up a shutdown
+// just like a running process does.
+static const char *cgroup_root = NULL;
+static int cgroup_root_fd = -1;
+static size_t draining_count = 0;
+
+// Our limit on open file descriptors, and the number of them our children
+// needed when we last warned that they might not fit.
+static rlim_t fd_limit = RLIM_INFINITY;
+static size_t fd_warned = 0;
+
+// Children are started after those they depend on, with at most
+// `starts_max` of them starting at once unless it's zero. Dependencies are
+// resolved again whenever a configuration file was loaded. Children which
+// are waiting to be started are looked at again from our main loop
+// whenever a child has started.
+static long starts_max = 0;
+static long starting_count = 0;
+static bool dependencies_changed = false;
+static timeout_t starts_to = { { 0, 0 }, handle_starts, NULL, 0 };
+
+// Once we're asked to terminate we shut down all our children at once and
+// exit when every one of them has been reaped. We note when the shutdown
+// started so that we can tell how long it took.
+static bool shutting_down = false;
+static struct timespec shutdown_at = { 0, 0 };
+
+// Changes to the configuration directory are reported to us through
+// `inotify(7)`. The names of changed configuration files are collected
+// for a short while before we act on them so that a burst of events for
+// the same file is handled once. If too many files change at once we
+// rather read the whole configuration directory again.
+static event_t inotify_ev = { -1, handle_inotify, NULL };
+static timeout_t debounce_to = { { 0, 0 }, handle_debounce, NULL, 0 };
+static char pending_configs[PENDING_CONFIGS_MAX][NAME_MAX + 1];
+static int pending_configs_count = 0;
+static bool pending_confdir = false;
+
+// Terminated children are reported to us by process id. To avoid walking
+// the entire linked list for each of them we keep a hash table index from
+// process ids of running children to their child structures alongside
+// the list.
+static index_t pid_index = { NULL, sizeof(pid_entry_t), 0, 0,
+                              PID_INDEX_MIN_SIZE, pid_entry_slot,
+                              pid_entry_used };
+
+// Output of children is copied into their tails through a pipe of our own
+// with `tee(2)`. Output we have no log file for is moved to `/dev/null`.
+static int output_tee[2] = { -1, -1 };
+static int devnull_fd = -1;
+
+// We keep a single connection to the system logger open for as long as we
+// run. Log messages are queued in a ring buffer and sent from our main
+// loop so that a busy system logger never blocks supervision. When the
+// ring buffer is full further messages are counted and dropped.
+static event_t log_ev = { -1, handle_log, NULL };
+static bool log_watched = false;
+static log_entry_t log_ring[LOG_RING_SIZE];
+static size_t log_head = 0;
+static size_t log_count = 0;
+static unsigned long log_dropped = 0;
+static timeout_t log_reconnect_to = { { 0, 0 }, handle_log_reconnect, NULL, 0 };
+
+// Children failing over and over would flood the system log with the
+// same messages. Recent messages are remembered for a while and their
+// repeats are only counted until they're forgotten.
+static log_repeat_t log_repeats[LOG_REPEATS_MAX];
+
 
 // Entrypoint
 // ----------
@@ -107,10 +338,26 @@ int main(int argc, char **argv) {
   sigset_t block_mask;
 
   // First we parse the command line arguments to check for a non-standard
-  // configuration directory. If no such argument was given we get the
-  // default `/etc/going.d`. If an invalid command line flag was given
-  // the parse function will exit this process abnormally.
-  const char *confdir = parse_args(argc, argv);
+  // configuration directory or control socket, a file to write metrics
+  // to, a limit on children starting at once, or a control group directory.
+  // If no such arguments were given we keep the default `/etc/going.d` and
+  // `/run/going.sock`, keep our metrics to ourselves, start as many
+  // children at once as are ready to, and leave children in our own
+  // control group. If an invalid command line flag was given the parse
+  // function will exit this process abnormally.
+  parse_args(argc, argv);
+
+  // We connect to the system logger up front and make sure messages still
+  // queued are sent when we exit. As exit handlers are called in reverse
+  // order this one is registered first so it runs last.
+  open_log();
+  atexit(close_log);
+
+  // We'll need a lot of file descriptors for our children.
+  setup_fd_limit();
+
+  // The random jitter added to quarantines should differ between runs.
+  srandom(time(NULL) ^ getpid());
 
   // We setup our cleanup function as an exit handler which will be
   // called at normal process termination.
@@ -119,16 +366,45 @@ int main(int argc, char **argv) {
   // The signals we're going to handle in our main loop is blocked.
   block_signals(&block_mask);
 
+  // We check whether the kernel can give us process file descriptors for
+  // our children before we prepare our event loop for accepting those
+  // signals and for waking us up when quarantined children can be spawned.
+  // Output of our children is captured through the event loop as well.
+  pidfd_mode = pidfd_supported();
+  setup_event_loop(&block_mask);
+  setup_output();
+
+  // Children get control groups of their own if we were given a directory
+  // for them, and whatever they leave behind is reparented to us.
+  setup_cgroups();
+  setup_subreaper();
+
+  // We start listening on our control socket, which is removed again when
+  // we exit.
+  setup_control(control_path);
+  atexit(close_control);
+
+  // Children can tell us when they're ready from the start.
+  setup_notify();
+
+  // We start watching the configuration directory for changes before we
+  // read it so that we don't miss a change made in between.
+  watch_confdir(confdir);
+
   // We parse configuration files in the configuration directory
   // into our global linked list of child structures.
   parse_confdir(confdir);
 
-  // All children is spawned for the first time.
+  // All children are spawned for the first time, each after those it
+  // depends on.
   spawn_ready_children();
 
-  // We launch our main loop which waits for signals and handles them
+  // Metrics are written from now on if we were asked to.
+  setup_metrics();
+
+  // We launch our main loop which waits for events and handles them
   // until it receives a terminating signal and promptly exits this process.
-  wait_forever(&block_mask, confdir);
+  wait_forever();
 
   // This return will never be reached, but it can't hurt.
   return EXIT_SUCCESS;
@@ -138,28 +414,92 @@ int main(int argc, char **argv) {
 // Argument parsing
 // ----------------
 
-// Returns the default configuration directory or a non-standard location
-// if the configuration directory command line flag is found.
-char *parse_args(int argc, char **argv) {
+// Sets a non-standard configuration directory or control socket, a
+// metrics file, a limit on children starting at once, or a control group
+// directory, if their command line flags are found. Each flag must be
+// followed by a non-empty value.
+void parse_args(int argc, char **argv) {
+
+  for (int i = 1; i < argc; i += 2) {
+    if (i + 1 < argc && str_not_empty(argv[i + 1])) {
+      if (strcmp(CMD_FLAG_CONFDIR, argv[i]) == 0) {
+        confdir = argv[i + 1];
+        continue;
+      }
+      if (strcmp(CMD_FLAG_CONTROL, argv[i]) == 0) {
+        control_path = argv[i + 1];
+        continue;
+      }
+      if (strcmp(CMD_FLAG_METRICS, argv[i]) == 0) {
+        metrics_path = argv[i + 1];
+        continue;
+      }
+      if (strcmp(CMD_FLAG_CGROUP, argv[i]) == 0) {
+        cgroup_root = argv[i + 1];
+        continue;
+      }
+      if (strcmp(CMD_FLAG_STARTS, argv[i]) == 0) {
+        char *end;
+
+        starts_max = strtol(argv[i + 1], &end, 10);
+        if (*end == '\0' && starts_max >= 0) {
+          continue;
+        }
+      }
+    }
+
+    // The user has given and illegal number or type of arguments. The
+    // program usage is printed to the standard error stream and we exit
+    // abnormally.
+    fprintf(stderr, USAGE);
+    exit(EX_USAGE);
+  }
+}
+
+
+// File descriptor limit
+// ---------------------
+
+// ### Setup file descriptor limit
+// Raises our soft limit on open file descriptors to the hard limit, as we
+// hold a handful of them for every child we supervise and the default
+// soft limit would only let us supervise a few hundred. We can get by
+// with the limit we have, so failure here is only logged.
+void setup_fd_limit(void) {
+  struct rlimit rl;
+
+  if (getrlimit(RLIMIT_NOFILE, &rl) < 0) {
+    return;
+  }
+  if (rl.rlim_cur < rl.rlim_max) {
+    rlim_t cur = rl.rlim_cur;
 
-  // If we only have on argument, the name of the binary for this source,
-  // we simply return the default configuration directory.
-  if (argc == 1) {
-    return CONFIG_DIR;
+    rl.rlim_cur = rl.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &rl) < 0) {
+      slog(LOG_WARNING, "Can't raise file descriptor limit: %m");
+      rl.rlim_cur = cur;
+    }
   }
+  fd_limit = rl.rlim_cur;
+}
 
-  // If we have two extra arguments, the first matching our  configuration
-  // directory flag and the second beeing non-empty, we return the second
-  // value as the configuration directory.
-  if (argc == 3 && strcmp(CMD_FLAG_CONFDIR, argv[1]) == 0
-      && str_not_empty(argv[2])) {
-    return argv[2];
+// ### Check file descriptor limit
+// Logs a warning when our children might need more file descriptors than
+// our limit lets us open, but only when they need more than they did the
+// last time we warned about it.
+void check_fd_limit(void) {
+  size_t fds = GOING_FDS;
+
+  for (child_t *ch = head_ch; ch != NULL; ch = ch->next) {
+    fds += CHILD_FDS + ch->conf.listen_count;
   }
 
-  // The user has given and illegal number or type of arguments. The program
-  // usage is printed to the standard error stream and we exit abnormally.
-  fprintf(stderr, USAGE);
-  exit(EX_USAGE);
+  if (fd_limit == RLIM_INFINITY || fds <= fd_limit || fds <= fd_warned) {
+    return;
+  }
+  slog(LOG_WARNING, "Children might need %zu file descriptors but we " \
+       "can only open %lu", fds, (unsigned long) fd_limit);
+  fd_warned = fds;
 }
 
 
@@ -183,13 +523,16 @@ void parse_confdir(const char *dir) {
     exit(EX_OSFILE);
   }
 
+  // This scan of the configuration directory gets its own generation.
+  confdir_generation++;
+
   // Add children for the configuration files in the directory listing to the
   // global linked list if they are not present.
   add_new_children(dir, dlist, dn);
   //
   // Remove children from the global linked list and terminate them if they
   // do not have a configuration file in the directory listing anymore.
-  remove_old_children(dlist, dn);
+  remove_old_children();
 
   // We have to free the heap allocated memory for the directory list
   // initialized by `scandir(3)`.
@@ -199,103 +542,256 @@ void parse_confdir(const char *dir) {
   free(dlist);
 }
 
+// ### Reload configuration directory
+// Reads our whole configuration directory again when we're asked to
+// reload our configuration of child processes to supervise.
+void reload_confdir(void) {
+  // Since we read the whole configuration directory we can forget about
+  // changes to it we haven't handled yet.
+  pending_configs_count = 0;
+  pending_confdir = false;
+  cancel_timeout(&debounce_to);
+  parse_confdir(confdir);
+  // If we've received new children to supervise those are spawned for
+  // their first time.
+  spawn_ready_children();
+}
+
 // ### Add unseen children
-// Iterates over its given list of configuration files and adds any unseen
-// children to our global linked list.
+// Iterates over its given list of configuration files and adds the
+// instances of any unseen children to our global linked list. Children we
+// already have are brought in line with their configuration file if it
+// has changed. All children with a configuration file in the list are
+// stamped with the current generation.
 void add_new_children(const char *dir, struct dirent **dlist, int dn) {
-  child_t *tail_ch = get_tail_child();
   char path[PATH_MAX + 1];
-  FILE *fp;
+  struct stat st;
+  child_t *ch;
 
   for (int i = dn - 1; i >= 0; i--) {
 
-    // We skip this configuration file if we already have a child with the
-    // same name.
-    if (has_child(dlist[i]->d_name)) {
+    // If we already have a child for the same file we note that its
+    // configuration file is still present and check whether it changed.
+    // A file which disappeared since we listed the directory is left for
+    // `remove_old_children()` to handle.
+    if ((ch = find_config_child(dlist[i]->d_name)) != NULL) {
+      snprintf(path, PATH_MAX + 1, "%s/%s", dir, dlist[i]->d_name);
+      if (stat(path, &st) == 0) {
+        stamp_instances(ch);
+        refresh_child(ch, dir, &st);
+      }
       continue;
     }
 
-    // Create a full path to this configuration file.
-    snprintf(path, PATH_MAX + 1, "%s/%s", dir, dlist[i]->d_name);
+    // If we successfully loaded this configuration file we have to add
+    // its instances to our linked list of children. They are spawned
+    // along with all other new children.
+    if ((ch = load_config(dir, dlist[i]->d_name)) != NULL) {
+      add_instances(ch);
+    }
+  }
+}
+
+// ### Load a configuration file
+// Reads the configuration file with the given name in the given directory
+// into a newly allocated child structure. Returns null if the file could
+// not be read or was invalid.
+child_t *load_config(const char *dir, const char *name) {
+  char path[PATH_MAX + 1];
+  FILE *fp;
 
-    // Try to open the configuration file for reading. If we're unable to
-    // open it we skip this configuration and log the error.
-    if ((fp = fopen(path, "r")) == NULL) {
-      slog(LOG_ERR, "Can't read %s: %m", path);
-      continue;
+  // Create a full path to this configuration file.
+  snprintf(path, PATH_MAX + 1, "%s/%s", dir, name);
+
+  // Try to open the configuration file for reading. If we're unable to
+  // open it we skip this configuration and log the error.
+  if ((fp = fopen(path, "r")) == NULL) {
+    slog(LOG_ERR, "Can't read %s: %m", path);
+    return NULL;
+  }
+
+  // Allocate memory to hold a child structure for this configuration.
+  child_t *ch = safe_alloc(sizeof(child_t));
+
+  // Try to parse this configuration file into the child structure we
+  // recently allocated.
+  if (!parse_config(ch, fp, name)) {
+
+    // If we were unable to parse the configuration we free the
+    // allocated memory for the child strucure since we don't longer
+    // need it and have no references to it after this function exits.
+    cleanup_child(ch);
+    ch = NULL;
+  } else {
+    struct stat st;
+
+    // We note the identity of the configuration file we parsed so that we
+    // can tell whether it has changed without reading it again.
+    if (fstat(fileno(fp), &st) == 0) {
+      note_config_file(ch, &st);
     }
 
-    // Allocate memory to hold a child structure for this configuration.
-    child_t *ch = safe_alloc(sizeof(child_t));
+    // Its dependencies might be new.
+    dependencies_changed = true;
+  }
+
+  // Flush the stream and close the underlying file descriptor for the
+  // opened configuration file.
+  fclose(fp);
+  return ch;
+}
 
-    // Try to parse this configuration file into the child structure we
-    // recently allocated.
-    if (!parse_config(ch, fp, dlist[i]->d_name)) {
+// ### Reload a configuration file
+// Brings the child for the configuration file with the given name in the
+// given directory in line with the file. The instances of a child are
+// added if the file is new, removed if the file is gone, and restarted if
+// the file changed their configuration. New instances are left for
+// `spawn_ready_children()`.
+void reload_config(const char *dir, const char *name) {
+  char path[PATH_MAX + 1];
+  struct stat st;
+  child_t *ch = find_config_child(name);
 
-      // If we were unable to parse the configuration we free the
-      // allocated memory for the child strucure since we don't longer
-      // need it and have no references to it after this function exits.
-      cleanup_child(ch);
-    } else {
+  snprintf(path, PATH_MAX + 1, "%s/%s", dir, name);
 
-      // If we successfully parsed this configuration file we have to add
-      // the resulting child structure to our linked list of children.
-      if (tail_ch) {
-        // If we have a non-null tail child we add this child after it.
-        tail_ch->next = ch;
-      } else {
-        // If we don't have a tail child, this child is shall be the
-        // head of the global linked list.
-        head_ch = ch;
-      }
-      // This child is now the new tail of the global linked list of
-      // children.
-      tail_ch = ch;
+  if (stat(path, &st) < 0) {
+    // The configuration file is gone so the child has to go as well.
+    if (errno == ENOENT && ch != NULL) {
+      remove_instances(ch);
     }
+    return;
+  }
 
-    // Flush the stream and close the underlying file descriptor for the
-    // opened configuration file.
-    fclose(fp);
+  // A configuration file we don't know is loaded into a new child whose
+  // instances are spawned once those they depend on have started.
+  if (ch == NULL) {
+    if ((ch = load_config(dir, name)) != NULL) {
+      add_instances(ch);
+    }
+    return;
   }
+
+  refresh_child(ch, dir, &st);
 }
 
-// ### Remove obselete children
-// Iterates over the global linked list of children and checks that
-// each is still present in the given list of configuration files. Those
-// without a corresponding configuration file is removed form the linked
-// list and the child process is terminated.
-void remove_old_children(struct dirent **dlist, int dn) {
-  child_t *prev_ch = NULL;
-
-  // Iterate over all children, point `prev_ch` to the active child
-  // right before the next iteration.
-  for (child_t *ch = head_ch; ch != NULL; prev_ch = ch, ch = ch->next) {
-
-    // If we have a configuration file for this child we leave it alone.
-    if (child_active(ch->name, dlist, dn)) {
+// ### Refresh a child
+// Brings the instances of the given child, which is the first of them, in
+// line with its configuration file in the given directory, which
+// `stat(2)` gave us the given information about. If the file is unchanged
+// since we last read it we're done without opening it. Otherwise it is
+// parsed again. Instances are added or removed if their number changed,
+// and those we keep are restarted if their configuration actually
+// differs.
+void refresh_child(child_t *ch, const char *dir, struct stat *st) {
+  char file[CHILD_NAME_SIZE + 1];
+  long instances = ch->conf.instances;
+
+  if (!config_file_changed(ch, st)) {
+    return;
+  }
+
+  strcpy(file, ch->file);
+  child_t *new_ch = load_config(dir, file);
+
+  // We won't read the file again before it changes once more, whether its
+  // new configuration was valid or not.
+  note_instances(ch, st);
+
+  // An invalid configuration is logged by `load_config()`, and we rather
+  // keep running with the configuration we have than stop the child.
+  if (new_ch == NULL) {
+    slog(LOG_WARNING, "Keeping previous configuration of %s", file);
+    return;
+  }
+
+  // Instances which are kept are renamed if their number changed from or
+  // to one, and those beyond the new number of instances are removed. Each
+  // is looked up by its current name before any of them is renamed.
+  for (int i = 0; i < instances; i++) {
+    child_t *inst = find_instance(file, i, instances);
+
+    if (i >= new_ch->conf.instances) {
+      remove_child(inst);
       continue;
     }
+    rename_instance(inst, new_ch->conf.instances);
+    refresh_instance(inst, &new_ch->conf);
+  }
+
+  // Instances beyond the previous number of instances are new, and are
+  // spawned along with other new children.
+  for (int i = instances; i < new_ch->conf.instances; i++) {
+    append_child(new_instance(new_ch, i));
+  }
+
+  cleanup_child(new_ch);
+}
+
+// ### Note a configuration file
+// Stores the identity of the given child's configuration file as given by
+// `stat(2)`: its inode number, modification time, and size.
+void note_config_file(child_t *ch, struct stat *st) {
+  ch->conf_ino = st->st_ino;
+  ch->conf_mtime = st->st_mtim;
+  ch->conf_size = st->st_size;
+}
+
+// ### Configuration file changed
+// Check whether the configuration file of the given child, as described
+// by the given `stat(2)` information, changed since we last read it.
+// Editors commonly replace a file by renaming a new one over it which
+// changes its inode number even if its modification time and size do not.
+bool config_file_changed(child_t *ch, struct stat *st) {
+  return ch->conf_ino != st->st_ino
+    || ch->conf_mtime.tv_sec != st->st_mtim.tv_sec
+    || ch->conf_mtime.tv_nsec != st->st_mtim.tv_nsec
+    || ch->conf_size != st->st_size;
+}
+
+// ### Configuration differs
+// Check whether two parsed configurations differ in any way which would
+// affect how a child is spawned. The quarantine policy doesn't, while the
+// addresses it listens on, where it's pinned, and how it's scheduled and
+// limited do. So does whether it tells us when it's ready, which it's
+// only told at spawn, and the pidfile of the daemon it's followed to.
+bool config_differs(conf_t *a, conf_t *b) {
+  if (strcmp(a->cmd, b->cmd) != 0 || strcmp(a->cwd, b->cwd) != 0
+      || a->notify != b->notify || strcmp(a->pidfile, b->pidfile) != 0
+      || a->listen_count != b->listen_count || a->pin != b->pin
+      || !CPU_EQUAL(&a->cpus, &b->cpus) || a->nice != b->nice
+      || a->ioprio != b->ioprio || a->oom_score_adj != b->oom_score_adj
+      || a->limit_nofile != b->limit_nofile
+      || a->limit_memlock != b->limit_memlock
+      || a->limit_core != b->limit_core || a->limit_as != b->limit_as) {
+    return true;
+  }
+
+  for (int i = 0; i < a->listen_count; i++) {
+    if (strcmp(a->listen[i], b->listen[i]) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// ### Remove obselete children
+// Iterates over the global linked list of children and removes those which
+// were not stamped with the current generation when the configuration
+// directory was scanned. Their configuration file is gone so the child
+// process is terminated as well.
+void remove_old_children(void) {
+  child_t *next_ch;
+
+  // Iterate over all children and remember the next child before we
+  // possibly free the current one.
+  for (child_t *ch = head_ch; ch != NULL; ch = next_ch) {
+    next_ch = ch->next;
 
     // If we have no configuration file for this child we have to
     // remove it.
-    if (prev_ch) {
-      // If we have a child before this child in the global linked list
-      // we point that to the child after this one. If this is the
-      // last child the child before this will be the new last child.
-      prev_ch->next = ch->next;
-    } else {
-      // If this child is the first in the global linked list we point
-      // our global head pointer to the child after this one. If this is
-      // the first and last child, the head pointer will be null.
-      head_ch = ch->next;
+    if (ch->generation != confdir_generation) {
+      remove_child(ch);
     }
-
-    // We terminate the child process when it no longer has a
-    // configuration file.
-    kill_child(ch);
-    // After terminating the child process we make sure to free the
-    // memory its scructure took up on the heap.
-    cleanup_child(ch);
   }
 }
 
@@ -303,14 +799,109 @@ void remove_old_children(struct dirent **dlist, int dn) {
 // Parses the given configuration file into the given child structure.
 // Returns true if the format of the configuration file was valid and
 // false otherwise.
-bool parse_config(child_t *ch, FILE *fp, char *name) {
+bool parse_config(child_t *ch, FILE *fp, const char *name) {
   char buf[CONFIG_LINE_BUFFER_SIZE], *line, *key, *value;
 
-  // Set the default working directory to the root of the filesystem.
-  strcpy(ch->cwd, "/");
+  // Set the default working directory to the root of the filesystem and
+  // the default quarantine policy. The default maximum quarantine depends
+  // on the first quarantine and is set once we know it.
+  strcpy(ch->conf.cwd, "/");
+  ch->conf.quarantine = QUARANTINE_PERIOD;
+  ch->conf.quarantine_max = 0;
+  ch->conf.quarantine_jitter = QUARANTINE_JITTER;
+  ch->conf.quarantine_reset = QUARANTINE_RESET;
+  ch->conf.log[0] = '\0';
+  ch->conf.log_size = OUTPUT_LOG_SIZE;
+  ch->conf.log_files = OUTPUT_LOG_FILES;
+  ch->conf.restart = RESTART_ALWAYS;
+  ch->conf.stop_timeout = STOP_TIMEOUT;
+  ch->conf.notify = false;
+  ch->conf.rolling = false;
+  ch->conf.ready_timeout = READY_TIMEOUT;
+  ch->conf.listen_count = 0;
+  ch->conf.instances = 1;
+  ch->conf.pin = PIN_NONE;
+  ch->conf.after_count = 0;
+  ch->conf.memory_max[0] = '\0';
+  ch->conf.cpu_max[0] = '\0';
+  ch->conf.io_weight = 0;
+  CPU_ZERO(&ch->conf.cpus);
+  ch->conf.nice = INHERIT;
+  ch->conf.ioprio = INHERIT;
+  ch->conf.limit_nofile = INHERIT;
+  ch->conf.limit_memlock = INHERIT;
+  ch->conf.limit_core = INHERIT;
+  ch->conf.limit_as = INHERIT;
+  ch->conf.oom_score_adj = INHERIT;
+  ch->conf.restart_rss = 0;
+  ch->conf.restart_cpu = 0;
+  ch->conf.restart_fds = 0;
+  ch->conf.check = CHECK_NONE;
+  ch->conf.check_spec[0] = '\0';
+  ch->conf.check_interval = CHECK_INTERVAL_DEFAULT;
+  ch->conf.check_timeout = CHECK_TIMEOUT_DEFAULT;
+  ch->conf.check_failures = CHECK_FAILURES_DEFAULT;
+  ch->conf.pidfile[0] = '\0';
+  ch->instance = 0;
+  ch->quarantines = 0;
   ch->pid = 0;
-  ch->up_at = 0;
-  ch->next = NULL;
+  ch->pidfd_ev.fd = -1;
+  ch->pidfd_ev.handler = handle_pidfd;
+  ch->pidfd_ev.data = ch;
+  ch->up_at.tv_sec = ch->up_at.tv_nsec = 0;
+  ch->quarantine_to.handler = handle_quarantine_timeout;
+  ch->quarantine_to.data = ch;
+  ch->quarantine_to.heap_index = 0;
+  ch->kill_to.handler = handle_kill_timeout;
+  ch->kill_to.data = ch;
+  ch->kill_to.heap_index = 0;
+  ch->ready = false;
+  ch->ready_to.handler = handle_ready_timeout;
+  ch->ready_to.data = ch;
+  ch->ready_to.heap_index = 0;
+  ch->rolling = NULL;
+  ch->starting = false;
+  ch->started = false;
+  ch->start_to.handler = handle_start_timeout;
+  ch->start_to.data = ch;
+  ch->start_to.heap_index = 0;
+  ch->deps_mark = DEPS_UNVISITED;
+  ch->restarting = false;
+  ch->stopped = false;
+  ch->removed = false;
+  ch->replaced = false;
+  ch->output_ev.fd = -1;
+  ch->output_ev.handler = handle_output;
+  ch->output_ev.data = ch;
+  ch->output_wfd = -1;
+  ch->log_fd = -1;
+  ch->log_written = 0;
+  ch->log_retry_at.tv_sec = ch->log_retry_at.tv_nsec = 0;
+  ch->tail_start = ch->tail_len = 0;
+  ch->history_start = ch->history_len = 0;
+  for (int i = 0; i < CHILD_LISTEN_MAX; i++) {
+    ch->listen_fds[i] = -1;
+  }
+  ch->cgroup_fd = -1;
+  ch->cgroup_ev.fd = -1;
+  ch->cgroup_ev.handler = handle_cgroup_events;
+  ch->cgroup_ev.data = ch;
+  ch->draining = false;
+  ch->statm_fd = ch->stat_fd = ch->fds_fd = -1;
+  ch->check_to.handler = handle_check_timeout;
+  ch->check_to.data = ch;
+  ch->check_to.heap_index = 0;
+  ch->check_ev.fd = -1;
+  ch->check_ev.handler = handle_check_connect;
+  ch->check_ev.data = ch;
+  ch->check_pid = 0;
+  ch->checking = false;
+  ch->failed_checks = 0;
+  ch->session = 0;
+  ch->pidfile_to.handler = handle_pidfile_timeout;
+  ch->pidfile_to.data = ch;
+  ch->pidfile_to.heap_index = 0;
+  ch->prev = ch->next = NULL;
 
   // We set the child as quarantined so that we can use the
   // `spawn_ready_children()` function to bring it up.
@@ -319,11 +910,20 @@ bool parse_config(child_t *ch, FILE *fp, char *name) {
   // Since the name member of our child structure has a constant size we have
   // to ensure that the name given from the configuration's filename fits.
   // If the name was too large we return immediately with an invalid status.
-  if (!safe_strcpy(ch->name, name, sizeof(ch->name))) {
+  if (!safe_strcpy(ch->file, name, sizeof(ch->file))) {
     slog(LOG_ERR, "Configuration file name %s is too long (max: %d)",
          name, CHILD_NAME_SIZE);
     return false;
   }
+  strcpy(ch->name, ch->file);
+
+  // The names of instances are told apart from those of configuration
+  // files by the separator, which is why files can't have it.
+  if (strchr(name, INSTANCE_SEPARATOR) != NULL) {
+    slog(LOG_ERR, "Configuration file name %s can't contain %c",
+         name, INSTANCE_SEPARATOR);
+    return false;
+  }
 
   // We iterate over the lines in the configuration file until we reach EOF.
   // For safety we use `fgets(3)` which reads at most one less than the given
@@ -353,9 +953,9 @@ bool parse_config(child_t *ch, FILE *fp, char *name) {
       // If we're unable to copy the command value read from the
       // configuration file into the constant sized `cmd` member of our
       // child structure we return immediately with an invalid status.
-      if (!safe_strcpy(ch->cmd, value, sizeof(ch->cmd))) {
+      if (!safe_strcpy(ch->conf.cmd, value, sizeof(ch->conf.cmd))) {
         slog(LOG_ERR, "Value of %s= in %s is too long (max: %d)",
-             CONFIG_CMD_KEY, name, sizeof(ch->cmd)-1);
+             CONFIG_CMD_KEY, name, sizeof(ch->conf.cmd)-1);
         return false;
       }
 
@@ -367,412 +967,6369 @@ bool parse_config(child_t *ch, FILE *fp, char *name) {
       // We try to copy the working directory value info the constant
       // sized `cwd` member of our child structure. We return
       // immediately with an invalid status if it did not fit.
-      if (!safe_strcpy(ch->cwd, value, sizeof(ch->cwd))) {
+      if (!safe_strcpy(ch->conf.cwd, value, sizeof(ch->conf.cwd))) {
         slog(LOG_ERR, "Value of %s= in %s is too long (max: %d)",
-             CONFIG_CWD_KEY, name, sizeof(ch->cwd)-1);
+             CONFIG_CWD_KEY, name, sizeof(ch->conf.cwd)-1);
         return false;
       }
-    }
-  }
 
-  // If we were able to populate our child structure with a command
-  // we deem this configuration valid.
-  return str_not_empty(ch->cmd);
-}
+    // The quarantine policy keys all take a number within the given
+    // bounds, and an invalid number makes the configuration invalid.
+    } else if (strcmp(CONFIG_QUARANTINE_KEY, key) == 0) {
+      if (!parse_number(name, key, value, 1, QUARANTINE_LIMIT,
+                        &ch->conf.quarantine)) {
+        return false;
+      }
+    } else if (strcmp(CONFIG_QUARANTINE_MAX_KEY, key) == 0) {
+      if (!parse_number(name, key, value, 1, QUARANTINE_LIMIT,
+                        &ch->conf.quarantine_max)) {
+        return false;
+      }
+    } else if (strcmp(CONFIG_QUARANTINE_JITTER_KEY, key) == 0) {
+      if (!parse_number(name, key, value, 0, 100,
+                        &ch->conf.quarantine_jitter)) {
+        return false;
+      }
+    } else if (strcmp(CONFIG_QUARANTINE_RESET_KEY, key) == 0) {
+      if (!parse_number(name, key, value, 0, QUARANTINE_LIMIT,
+                        &ch->conf.quarantine_reset)) {
+        return false;
+      }
 
+    // The stop timeout is the number of seconds the process of the child
+    // gets to terminate before it is killed.
+    } else if (strcmp(CONFIG_STOP_TIMEOUT_KEY, key) == 0) {
+      if (!parse_number(name, key, value, 0, STOP_TIMEOUT_LIMIT,
+                        &ch->conf.stop_timeout)) {
+        return false;
+      }
 
-// Execution of children
-// ---------------------
+    // The readiness keys tell whether the child notifies us when it's
+    // ready, whether it's restarted by starting its replacement before
+    // its previous process is terminated, and how long we wait for the
+    // replacement to get ready.
+    } else if (strcmp(CONFIG_NOTIFY_KEY, key) == 0) {
+      if (!parse_flag(name, key, value, &ch->conf.notify)) {
+        return false;
+      }
+    } else if (strcmp(CONFIG_ROLLING_KEY, key) == 0) {
+      if (!parse_flag(name, key, value, &ch->conf.rolling)) {
+        return false;
+      }
+    } else if (strcmp(CONFIG_READY_TIMEOUT_KEY, key) == 0) {
+      if (!parse_number(name, key, value, 0, READY_TIMEOUT_LIMIT,
+                        &ch->conf.ready_timeout)) {
+        return false;
+      }
 
-// ### Spawn ready children
-// Iterates over all our children and spawn them if they currently are
-// quarantined and safely can be unquarantined.
-// This function can also spawn children for the first time since all
-// child structures are initialized as quarantined with a last started
-// timestamp of epoch.
-void spawn_ready_children(void) {
-  child_t *ch;
+    // The listen key can be given once for every address the child
+    // listens on.
+    } else if (strcmp(CONFIG_LISTEN_KEY, key) == 0) {
+      if (!add_listen(&ch->conf, name, value)) {
+        return false;
+      }
 
-  // Iterate over all children and spawn those which is quarantined
-  // and can be unquarantined.
-  for (ch = head_ch; ch != NULL; ch = ch->next) {
-    // The child can can be unquarantined if it:
-    //
-    //   * has never been spawned,
-    //   * or was last spawned more than or equal to the value of
-    //     `QUARANTINE_PERIOD` ago.
-    if (ch->quarantined
-        && !child_recently_spawned(ch, QUARANTINE_PERIOD.tv_sec)) {
-      spawn_child(ch);
-    }
-  }
-}
+    // The instance keys take the number of instances to run and where
+    // each of them runs.
+    } else if (strcmp(CONFIG_INSTANCES_KEY, key) == 0) {
+      if (!parse_instances(name, key, value, &ch->conf.instances)) {
+        return false;
+      }
+    } else if (strcmp(CONFIG_PIN_KEY, key) == 0) {
+      if (!parse_pin(name, key, value, &ch->conf.pin)) {
+        return false;
+      }
 
-// ### Respawn terminated children
-// Respawns all terminated children. This function is called
-// when we get a `SIGCHLD` signal.
-bool respawn_terminated_children(void) {
-  child_t *ch;
-  pid_t ch_pid;
-  bool all_respawned = true;
-
-  // We retrieve information about terminated child processes
-  // using `waitpid(3)`. It's possible that we only get one `SIGCHLD`
-  // signal delivered from the kernel even though more than one child
-  // terminated. We therefore loop until we've gotten the process id of
-  // all terminated children. We use the `WNOHANG` flag so that we don't
-  // block the thread until status of any terminated children is available.
-  while ((ch_pid = waitpid(-1, NULL, WNOHANG)) > 0) {
-
-    // We iterate over our global linked list of children to find
-    // the child structure of the exited child process.
-    for (ch = head_ch; ch; ch = ch->next) {
-      if (ch_pid == ch->pid) {
-        time_t now = time(NULL);
-
-        // If the child lived shorter than the value of `QUARANTINE_TRIGGER`
-        // we mark the child as quarantined and log its misbehavior. The
-        // child is not respawned.
-        // In addition the return value for this function is set to be falsy
-        // so that the caller can know that one or more children was
-        // quarantined and not respawned.
-        if (child_recently_spawned(ch, QUARANTINE_TRIGGER)) {
-          slog(LOG_WARNING, "%s terminated after: %ds (limit: %ds) and " \
-              "will be quarantined for %ds", ch->name, now - ch->up_at,
-              QUARANTINE_TRIGGER, QUARANTINE_PERIOD.tv_sec);
-          ch->quarantined = true;
-
-          all_respawned = false;
-
-        // If the child lived longh enough to not be quarantined we log its
-        // termination and respawn it.
-        } else {
-          slog(LOG_WARNING, "%s terminated after: %ds",
-               ch->name, now - ch->up_at);
-          spawn_child(ch);
-        }
+    // The after key can be given once for every child this child is
+    // started after.
+    } else if (strcmp(CONFIG_AFTER_KEY, key) == 0) {
+      if (!add_after(&ch->conf, name, value)) {
+        return false;
       }
-    }
-  }
-  return all_respawned;
-}
 
-// ### Spawn a child
-// Spawns the command line of the given child by forking and execing
-// a child process of the parent `going` process.
-void spawn_child(child_t *ch) {
+    // The control group keys take the limits of the control group of the
+    // child, which only has one when we're given a control group
+    // directory.
+    } else if (strcmp(CONFIG_MEMORY_MAX_KEY, key) == 0) {
+      if (!parse_memory_max(name, key, value, ch->conf.memory_max)) {
+        return false;
+      }
+    } else if (strcmp(CONFIG_CPU_MAX_KEY, key) == 0) {
+      if (!parse_cpu_max(name, key, value, ch->conf.cpu_max)) {
+        return false;
+      }
+    } else if (strcmp(CONFIG_IO_WEIGHT_KEY, key) == 0) {
+      if (!parse_number(name, key, value, 1, IO_WEIGHT_MAX,
+                        &ch->conf.io_weight)) {
+        return false;
+      }
 
-  // The child is no longer quarantined since it obviously got the go-ahead
-  // to spawn.
-  ch->quarantined = false;
+    // The scheduling keys take the processors the child runs on, its
+    // niceness, its IO priority, and its OOM score adjustment, while the
+    // limit keys each take a resource limit.
+    } else if (strcmp(CONFIG_CPUS_KEY, key) == 0) {
+      if (!parse_cpus(name, key, value, &ch->conf.cpus)) {
+        return false;
+      }
+    } else if (strcmp(CONFIG_NICE_KEY, key) == 0) {
+      if (!parse_number(name, key, value, NICE_MIN, NICE_MAX,
+                        &ch->conf.nice)) {
+        return false;
+      }
+    } else if (strcmp(CONFIG_IOPRIO_KEY, key) == 0) {
+      if (!parse_ioprio(name, key, value, &ch->conf.ioprio)) {
+        return false;
+      }
+    } else if (strcmp(CONFIG_OOM_SCORE_ADJ_KEY, key) == 0) {
+      if (!parse_number(name, key, value, OOM_SCORE_ADJ_MIN,
+                        OOM_SCORE_ADJ_MAX, &ch->conf.oom_score_adj)) {
+        return false;
+      }
+    } else if (strcmp(CONFIG_LIMIT_NOFILE_KEY, key) == 0) {
+      if (!parse_limit(name, key, value, &ch->conf.limit_nofile)) {
+        return false;
+      }
+    } else if (strcmp(CONFIG_LIMIT_MEMLOCK_KEY, key) == 0) {
+      if (!parse_limit(name, key, value, &ch->conf.limit_memlock)) {
+        return false;
+      }
+    } else if (strcmp(CONFIG_LIMIT_CORE_KEY, key) == 0) {
+      if (!parse_limit(name, key, value, &ch->conf.limit_core)) {
+        return false;
+      }
+    } else if (strcmp(CONFIG_LIMIT_AS_KEY, key) == 0) {
+      if (!parse_limit(name, key, value, &ch->conf.limit_as)) {
+        return false;
+      }
 
-  pid_t ch_pid;
+    // The watchdog keys take a number of bytes, seconds of processor time,
+    // and open files where zero means that it isn't watched.
+    } else if (strcmp(CONFIG_RESTART_RSS_KEY, key) == 0) {
+      if (!parse_size(name, key, value, &ch->conf.restart_rss)) {
+        return false;
+      }
+    } else if (strcmp(CONFIG_RESTART_CPU_KEY, key) == 0) {
+      if (!parse_number(name, key, value, 0, RESTART_CPU_LIMIT,
+                        &ch->conf.restart_cpu)) {
+        return false;
+      }
+    } else if (strcmp(CONFIG_RESTART_FDS_KEY, key) == 0) {
+      if (!parse_number(name, key, value, 0, RESTART_FDS_LIMIT,
+                        &ch->conf.restart_fds)) {
+        return false;
+      }
 
-  // We iterate until we get the desired behavior from `fork(3)`.
-  while (true) {
-    // `fork(3)` creates a new process which is an exact copy of its invoking
-    // process. We are inside the child process if the return value is zero.
-    if ((ch_pid = fork()) == 0) {
-
-      // FIXME: is this needed? do some research.
-      // The child should have its own session and become the process
-      // group leader.
-      setsid();
-
-      // We initialize an empty signal mask and block based on it, resulting
-      // in blockage of no signals. This is done since the parent process
-      // blocks certain signals and the child created by a `fork(3)` inherits
-      // its parents block mask.
-      sigset_t empty_mask;
-      sigemptyset(&empty_mask);
-      sigprocmask(SIG_SETMASK, &empty_mask, NULL);
-
-      // TODO: Should file descriptors 0, 1, 2 be closed or duped?
-
-      // TODO: Close file descriptors which should not be inherited or
-      //       use O_CLOEXEC when opening such files.
-
-
-      // Change the current working directory to that specified in the
-      // child's configuration file or the default `/`.
-      if (chdir(ch->cwd) < 0) {
-        slog(LOG_ERR, "Can't change working directory to %s: %m", ch->cwd);
-        cleanup_children();
-        _exit(EXIT_FAILURE);
-      }
-
-      // Replace the child process with the executable reciding at the path
-      // of the command line.
-      exec_child(ch->cmd);
-
-      // If we reach this code the `execvp(3)` call failed. We log the error
-      // and exit this child process. Note that the normal flow in the parent
-      // continues, but it will get a `SIGCHLD` signal since one of its
-      // children terminated.
-      slog(LOG_ERR, "Can't execute %s: %m", ch->cmd);
-      cleanup_children();
-      _exit(EXIT_FAILURE);
+    // The check keys take how the child is checked, and how often, how
+    // long, and how many times in a row it may fail in seconds.
+    } else if (strcmp(CONFIG_CHECK_KEY, key) == 0) {
+      if (!parse_check(name, key, value, &ch->conf)) {
+        return false;
+      }
+    } else if (strcmp(CONFIG_CHECK_INTERVAL_KEY, key) == 0) {
+      if (!parse_number(name, key, value, 1, CHECK_PERIOD_MAX,
+                        &ch->conf.check_interval)) {
+        return false;
+      }
+    } else if (strcmp(CONFIG_CHECK_TIMEOUT_KEY, key) == 0) {
+      if (!parse_number(name, key, value, 1, CHECK_PERIOD_MAX,
+                        &ch->conf.check_timeout)) {
+        return false;
+      }
+    } else if (strcmp(CONFIG_CHECK_FAILURES_KEY, key) == 0) {
+      if (!parse_number(name, key, value, 1, CHECK_FAILURES_MAX,
+                        &ch->conf.check_failures)) {
+        return false;
+      }
 
-    // If the return value of `fork(3)` is greater than zero we're in the
-    // parent process.
-    } else if (ch_pid > 0) {
-      // We note the time that the child process started so that we can track
-      // its uptime.
-      ch->up_at = time(NULL);
-      // Storing the process id of the child process is important so that we
-      // know which process failed if we get a `SIGCHLD` signal later.
-      ch->pid = ch_pid;
-      return;
+    // The pidfile key takes the absolute path of the pidfile of the daemon
+    // the child leaves behind.
+    } else if (strcmp(CONFIG_PIDFILE_KEY, key) == 0) {
+      if (value[0] != '/'
+          || !safe_strcpy(ch->conf.pidfile, value, sizeof(ch->conf.pidfile))) {
+        slog(LOG_ERR, "Value of %s= in %s must be an absolute path (max: %d)",
+             key, name, sizeof(ch->conf.pidfile)-1);
+        return false;
+      }
 
-    // If the return value of `fork(3)` is negative the call did not succeed.
-    // We log the error and wait a little before trying again.
-    } else {
-      slog(LOG_EMERG, "Could not fork, sleeping %ds", EMERG_SLEEP);
-      sleep(EMERG_SLEEP);
+    // The log file keys take a path, a size in bytes where zero means that
+    // the log file is never rotated, and a number of rotated log files to
+    // keep.
+    } else if (strcmp(CONFIG_LOG_KEY, key) == 0 && str_not_empty(value)) {
+      if (!safe_strcpy(ch->conf.log, value, sizeof(ch->conf.log))) {
+        slog(LOG_ERR, "Value of %s= in %s is too long (max: %d)",
+             CONFIG_LOG_KEY, name, sizeof(ch->conf.log)-1);
+        return false;
+      }
+    } else if (strcmp(CONFIG_LOG_SIZE_KEY, key) == 0) {
+      if (!parse_number(name, key, value, 0, OUTPUT_LOG_SIZE_LIMIT,
+                        &ch->conf.log_size)) {
+        return false;
+      }
+    } else if (strcmp(CONFIG_LOG_FILES_KEY, key) == 0) {
+      if (!parse_number(name, key, value, 0, OUTPUT_LOG_FILES_LIMIT,
+                        &ch->conf.log_files)) {
+        return false;
+      }
+
+    // The restart key takes the name of a restart policy.
+    } else if (strcmp(CONFIG_RESTART_KEY, key) == 0) {
+      if (!parse_restart(name, key, value, &ch->conf.restart)) {
+        return false;
+      }
     }
   }
-}
 
-// ### Exec wrapper
-// Parses the path and arguments from the given command line. Replaces
-// the current process with that of the executable file reciding at
-// the parsed path.
-void exec_child(const char *cmd) {
-
-  // A copy of the command line is made so that we can use `strsep(3)`
-  // (which modifies its argument) against it. It is safe to use `strcpy(3)`
-  // to copy the command line from our child structure into the buffer since
-  // we know that their constant sizes are equal.
-  char cmd_buf[CHILD_CMD_SIZE+1];
-  char *cmd_p = strcpy(cmd_buf, cmd);
-
-  // To avoid allocating space on the heap for the argument vector we
-  // use a constant sized array of pointers into the constant sized
-  // `cmd_buf` buffer.
-  int i = 1;
-  char *argv[CHILD_ARGV_LEN];
-  char *cmd_word;
-
-  // We iterate until the pointer returned by `strsep(3)` into our command
-  // line buffer is null, meaning no new words sperated by a space was found.
-  while ((cmd_word = strsep(&cmd_p, " ")) != NULL) {
-    // If the word returned is the null byte we're dealing with repeating
-    // spaces, so we skip it.
-    if (*cmd_word == '\0') {
-      continue;
-    }
+  // A maximum quarantine shorter than the first quarantine is a mistake,
+  // while the default maximum grows to fit a long first quarantine.
+  if (ch->conf.quarantine_max == 0) {
+    ch->conf.quarantine_max = ch->conf.quarantine > QUARANTINE_MAX
+                              ? ch->conf.quarantine : QUARANTINE_MAX;
+  } else if (ch->conf.quarantine_max < ch->conf.quarantine) {
+    slog(LOG_ERR, "Value of %s= in %s can't be less than %s=",
+         CONFIG_QUARANTINE_MAX_KEY, name, CONFIG_QUARANTINE_KEY);
+    return false;
+  }
 
-    // If we're in our first iteration we setup the two first slots
-    // of the argument vector which explains why we initialized the index
-    // to one.
-    if (i == 1) {
-      // The first and second argument will be the path to the binary
-      // we'll spawn.
-      argv[0] = argv[1] = cmd_word;
-    } else {
-      // The following arguments will be arguments given to the binary
-      // we'll spawn.
-      argv[i] = cmd_word;
+  // Instances share internet sockets, but the path of a unix socket can
+  // only be bound by one of them.
+  for (int i = 0; i < ch->conf.listen_count && ch->conf.instances > 1; i++) {
+    if (strncmp(ch->conf.listen[i], "unix:", 5) == 0) {
+      slog(LOG_ERR, "Value of %s= in %s can't be a unix socket with %s=",
+           CONFIG_LISTEN_KEY, name, CONFIG_INSTANCES_KEY);
+      return false;
     }
-    i++;
   }
-  // The argument vector given to `execvp(3)` needs to be null terminated.
-  argv[i] = NULL;
 
-  // `execvp(3)` is used to replace this child process with the binary
-  // reciding at the path we give as the first argument. In addition it
-  // tries to look up the binary in `$PATH` if a non-absolute path is
-  // given. By incrementing the `argv` pointer we give as the second
-  // argument the receiver sees it as `argv[1:]`.
-  execvp(argv[0], argv + 1);
-}
+  // Without a log file of its own the child logs to one named after it in
+  // our default log directory.
+  if (!str_not_empty(ch->conf.log)) {
+    snprintf(ch->conf.log, sizeof(ch->conf.log), "%s/%s.log",
+             OUTPUT_LOG_DIR, ch->name);
+  }
 
+  // If we were able to populate our child structure with a command
+  // we deem this configuration valid if the command can be split into
+  // an argument vector.
+  if (!str_not_empty(ch->conf.cmd) || !parse_cmd(&ch->conf, name)) {
+    return false;
+  }
 
-// Signal handling
-// ---------------
+  // We look up the binary of the command once here in stead of every time
+  // the child is spawned. If it can't be found it is looked up again when
+  // the child is spawned, since it might have been installed in the
+  // meantime.
+  resolve_cmd(&ch->conf);
+  return true;
+}
 
-// ### Block handled signals
-// For handling signals synchronously in our main loop with `sigtimedwait(3)`
-// we need to set the `going` process' signal mask (a set of signals whose
-// delivery from the kernel is blocked).
-void block_signals(sigset_t *block_mask) {
-  sigemptyset(block_mask);
+// ### Parse a number
+// Parses the given value of the given key in the configuration file with
+// the given name as a decimal number between the given bounds. Returns
+// false and logs the error if it is not.
+bool parse_number(const char *name, const char *key, const char *value,
+                  long min, long max, long *number) {
+  char *end;
 
-  // The `SIGCHLD` signal is delivered if a child process terminates. The
-  // entire `going` program is designed arround handling this signal and
-  // respawning the terminated child process.
-  sigaddset(block_mask, SIGCHLD);
+  errno = 0;
+  long n = strtol(value, &end, 10);
 
-  // The `SIGTERM` signal is the standard signal for terminating a process
-  // and the default signal sent by `kill(1)`. We block it so that we can
-  // handle it by cleaning up our main and child processes.
-  sigaddset(block_mask, SIGTERM);
+  if (errno != 0 || end == value || *end != '\0' || n < min || n > max) {
+    slog(LOG_ERR, "Value of %s= in %s must be a number from %ld to %ld",
+         key, name, min, max);
+    return false;
+  }
+  *number = n;
+  return true;
+}
 
+// ### Parse a restart policy
+// Parses the given value of the given key in the configuration file with
+// the given name as the name of a restart policy, and stores it in the
+// given pointer. Returns false and logs the error if it's not one.
+bool parse_restart(const char *name, const char *key, const char *value,
+                   int *restart) {
+  if (strcmp(value, "always") == 0) {
+    *restart = RESTART_ALWAYS;
+  } else if (strcmp(value, "on-failure") == 0) {
+    *restart = RESTART_ON_FAILURE;
+  } else if (strcmp(value, "never") == 0) {
+    *restart = RESTART_NEVER;
+  } else {
+    slog(LOG_ERR, "Value of %s= in %s must be always, on-failure, or never",
+         key, name);
+    return false;
+  }
+  return true;
+}
 
-  // The `SIGINT` signal is sent when the user sends an terminal interrupt
+// ### Parse a flag
+// Parses the given value of the given key in the configuration file with
+// the given name as `yes` or `no`, and stores it in the given pointer.
+// Returns false and logs the error if it's neither.
+bool parse_flag(const char *name, const char *key, const char *value,
+                bool *flag) {
+  if (strcmp(value, "yes") == 0) {
+    *flag = true;
+  } else if (strcmp(value, "no") == 0) {
+    *flag = false;
+  } else {
+    slog(LOG_ERR, "Value of %s= in %s must be yes or no", key, name);
+    return false;
+  }
+  return true;
+}
+
+// ### Add a listen address
+// Adds the given address to those the given configuration listens on.
+// Returns false and logs the error if it's malformed, too long, or one
+// too many for the configuration file with the given name.
+bool add_listen(conf_t *conf, const char *name, const char *value) {
+  char host[CHILD_LISTEN_SIZE + 1];
+  const char *port;
+  int family, type;
+
+  if (conf->listen_count >= CHILD_LISTEN_MAX) {
+    slog(LOG_ERR, "Too many %s= in %s (max: %d)", CONFIG_LISTEN_KEY, name,
+         CHILD_LISTEN_MAX);
+    return false;
+  }
+
+  if (!safe_strcpy(conf->listen[conf->listen_count], value,
+                   sizeof(conf->listen[0]))
+      || !parse_listen(value, &family, &type, host, sizeof(host), &port)) {
+    slog(LOG_ERR, "Value of %s= in %s must be tcp:[host:]port, " \
+         "udp:[host:]port, or unix:/path", CONFIG_LISTEN_KEY, name);
+    return false;
+  }
+  conf->listen_count++;
+  return true;
+}
+
+// ### Parse a number of instances
+// Parses the given value of the given key in the configuration file with
+// the given name as a number of instances, and stores it in the given
+// pointer. With `auto` there is an instance for every processor we're
+// allowed to run on. Returns false and logs the error if it's neither.
+bool parse_instances(const char *name, const char *key, const char *value,
+                     long *instances) {
+  cpu_set_t set;
+
+  if (strcmp(value, "auto") != 0) {
+    return parse_number(name, key, value, 1, INSTANCES_MAX, instances);
+  }
+
+  if (sched_getaffinity(0, sizeof(set), &set) < 0) {
+    slog(LOG_ERR, "Can't count processors for %s= in %s: %m", key, name);
+    return false;
+  }
+  *instances = CPU_COUNT(&set) < INSTANCES_MAX ? CPU_COUNT(&set)
+                                               : INSTANCES_MAX;
+  return true;
+}
+
+// ### Add a dependency
+// Adds the given name of a configuration file to those whose children
+// the given configuration is started after. Returns false and logs the
+// error if it's empty, too long, or one too many for the configuration
+// file with the given name.
+bool add_after(conf_t *conf, const char *name, const char *value) {
+  if (conf->after_count >= CHILD_AFTER_MAX) {
+    slog(LOG_ERR, "Too many %s= in %s (max: %d)", CONFIG_AFTER_KEY, name,
+         CHILD_AFTER_MAX);
+    return false;
+  }
+
+  if (value[0] == '\0'
+      || !safe_strcpy(conf->after[conf->after_count], value,
+                      sizeof(conf->after[0]))) {
+    slog(LOG_ERR, "Value of %s= in %s must be the name of a " \
+         "configuration file", CONFIG_AFTER_KEY, name);
+    return false;
+  }
+  conf->after_count++;
+  return true;
+}
+
+// ### Parse a memory limit
+// Parses the given value of the given key in the configuration file with
+// the given name as a memory limit for the `memory.max` file of a control
+// group: `max`, or a number of bytes with an optional `K`, `M`, `G`, or `T`
+// suffix. Stores it in the given buffer of `CGROUP_VALUE_SIZE` characters.
+// Returns false and logs the error if it's neither.
+bool parse_memory_max(const char *name, const char *key, const char *value,
+                      char *memory_max) {
+  const char *p = value;
+
+  while (*p >= '0' && *p <= '9') {
+    p++;
+  }
+  if (p != value && *p != '\0' && strchr("KMGT", *p) != NULL) {
+    p++;
+  }
+
+  if ((strcmp(value, "max") != 0 && (p == value || *p != '\0'))
+      || !safe_strcpy(memory_max, value, CGROUP_VALUE_SIZE + 1)) {
+    slog(LOG_ERR, "Value of %s= in %s must be max or a number of bytes " \
+         "with an optional K, M, G, or T suffix", key, name);
+    return false;
+  }
+  return true;
+}
+
+// ### Parse a processor limit
+// Parses the given value of the given key in the configuration file with
+// the given name as a processor limit for the `cpu.max` file of a control
+// group: `max` or a quota in microseconds, optionally followed by a space
+// and the period in microseconds the quota is for. Stores it in the given
+// buffer of `CGROUP_VALUE_SIZE` characters. Returns false and logs the
+// error if it's neither.
+bool parse_cpu_max(const char *name, const char *key, const char *value,
+                   char *cpu_max) {
+  const char *p = value;
+  char *end;
+
+  if (strncmp(p, "max", 3) == 0) {
+    p += 3;
+  } else if (strtol(p, &end, 10) > 0 && *p >= '0' && *p <= '9') {
+    p = end;
+  } else {
+    p = NULL;
+  }
+  if (p != NULL && *p == ' ') {
+    p = strtol(p + 1, &end, 10) > 0 && p[1] >= '0' && p[1] <= '9' ? end
+                                                                    : NULL;
+  }
+
+  if (p == NULL || *p != '\0'
+      || !safe_strcpy(cpu_max, value, CGROUP_VALUE_SIZE + 1)) {
+    slog(LOG_ERR, "Value of %s= in %s must be max or a quota in " \
+         "microseconds, optionally followed by a period", key, name);
+    return false;
+  }
+  return true;
+}
+
+// ### Parse processors
+// Parses the given value of the given key in the configuration file with
+// the given name as a list of processors, like `0-3,8-11`, and stores it
+// in the given set. Returns false and logs the error if it's malformed or
+// empty.
+bool parse_cpus(const char *name, const char *key, const char *value,
+                cpu_set_t *cpus) {
+  if (!parse_cpu_list(value, cpus) || CPU_COUNT(cpus) == 0) {
+    slog(LOG_ERR, "Value of %s= in %s must be a list of processors like " \
+         "0-3,8", key, name);
+    return false;
+  }
+  return true;
+}
+
+// ### Parse an IO priority
+// Parses the given value of the given key in the configuration file with
+// the given name as an IO priority: `realtime`, `best-effort`, or `idle`,
+// optionally followed by a colon and a level. Stores it in the given
+// pointer as it's given to `ioprio_set(2)`. Returns false and logs the
+// error if it's malformed.
+bool parse_ioprio(const char *name, const char *key, const char *value,
+                  long *ioprio) {
+  const char *level = strchr(value, ':');
+  size_t len = level != NULL ? (size_t)(level - value) : strlen(value);
+  long class = 0, n = IOPRIO_LEVEL_DEFAULT;
+
+  if (len == 8 && strncmp(value, "realtime", len) == 0) {
+    class = IOPRIO_CLASS_RT;
+  } else if (len == 11 && strncmp(value, "best-effort", len) == 0) {
+    class = IOPRIO_CLASS_BE;
+  } else if (len == 4 && strncmp(value, "idle", len) == 0) {
+    class = IOPRIO_CLASS_IDLE;
+  }
+
+  if (level != NULL && (level[1] < '0' || level[1] >= '0' + IOPRIO_LEVELS
+                        || level[2] != '\0')) {
+    class = 0;
+  } else if (level != NULL) {
+    n = level[1] - '0';
+  }
+
+  if (class == 0) {
+    slog(LOG_ERR, "Value of %s= in %s must be realtime, best-effort, or " \
+         "idle, optionally followed by :level from 0 to %d", key, name,
+         IOPRIO_LEVELS - 1);
+    return false;
+  }
+  *ioprio = class << IOPRIO_CLASS_SHIFT | n;
+  return true;
+}
+
+// ### Parse a resource limit
+// Parses the given value of the given key in the configuration file with
+// the given name as a resource limit: a number, or `unlimited` which is
+// stored as `LIMIT_UNLIMITED` in the given pointer. Returns false and logs
+// the error if it's neither.
+bool parse_limit(const char *name, const char *key, const char *value,
+                 long *limit) {
+  char *end;
+
+  if (strcmp(value, "unlimited") == 0) {
+    *limit = LIMIT_UNLIMITED;
+    return true;
+  }
+
+  errno = 0;
+  long n = strtol(value, &end, 10);
+
+  if (errno != 0 || end == value || *end != '\0' || n < 0) {
+    slog(LOG_ERR, "Value of %s= in %s must be a number or unlimited", key,
+         name);
+    return false;
+  }
+  *limit = n;
+  return true;
+}
+
+// ### Parse a size
+// Parses the given value of the given key in the configuration file with
+// the given name as a number of bytes with an optional `K`, `M`, `G`, or
+// `T` suffix, and stores it in the given pointer. Returns false and logs
+// the error if it's not one or too large.
+bool parse_size(const char *name, const char *key, const char *value,
+                long *size) {
+  const char *suffixes = "KMGT", *suffix;
+  char *end;
+
+  errno = 0;
+  long n = strtol(value, &end, 10);
+
+  if (end != value && *end != '\0' && end[1] == '\0'
+      && (suffix = strchr(suffixes, *end)) != NULL) {
+    for (long i = 0; i <= suffix - suffixes && errno == 0; i++) {
+      if (n > LONG_MAX / 1024) {
+        errno = ERANGE;
+      }
+      n *= 1024;
+    }
+    end++;
+  }
+
+  if (errno != 0 || end == value || *end != '\0' || n < 0) {
+    slog(LOG_ERR, "Value of %s= in %s must be a number of bytes with an " \
+         "optional K, M, G, or T suffix", key, name);
+    return false;
+  }
+  *size = n;
+  return true;
+}
+
+// ### Parse a check
+// Parses the given value of the given key in the configuration file with
+// the given name as how a child is checked, and stores it in the given
+// configuration: `exec:` followed by a command line for the shell,
+// `tcp:[host:]port` or `unix:/path` to connect to, or `file:/path` of a
+// heartbeat file. A missing host is the loopback address, and hosts are
+// numeric so that connecting never waits for a lookup. Returns false and
+// logs the error if it's none of them.
+bool parse_check(const char *name, const char *key, const char *value,
+                 conf_t *conf) {
+  char host[CHILD_LISTEN_SIZE + 1];
+  const char *port;
+  int family, type;
+
+  if (strncmp(value, "exec:", 5) == 0 && value[5] != '\0') {
+    conf->check = CHECK_EXEC;
+  } else if (strncmp(value, "file:", 5) == 0 && value[5] == '/') {
+    conf->check = CHECK_FILE;
+  } else if ((strncmp(value, "tcp:", 4) == 0
+              || strncmp(value, "unix:", 5) == 0)
+             && parse_listen(value, &family, &type, host, sizeof(host),
+                             &port)) {
+    conf->check = CHECK_CONNECT;
+  } else {
+    conf->check = CHECK_NONE;
+  }
+
+  if (conf->check == CHECK_NONE
+      || !safe_strcpy(conf->check_spec, value, sizeof(conf->check_spec))) {
+    slog(LOG_ERR, "Value of %s= in %s must be exec:command, " \
+         "tcp:[host:]port, unix:/path, or file:/path", key, name);
+    conf->check = CHECK_NONE;
+    return false;
+  }
+  return true;
+}
+
+// ### Parse a pinning
+// Parses the given value of the given key in the configuration file with
+// the given name as where instances are pinned, and stores it in the
+// given pointer. Returns false and logs the error if it's nowhere.
+bool parse_pin(const char *name, const char *key, const char *value,
+               int *pin) {
+  if (strcmp(value, "no") == 0) {
+    *pin = PIN_NONE;
+  } else if (strcmp(value, "cpu") == 0) {
+    *pin = PIN_CPU;
+  } else if (strcmp(value, "node") == 0) {
+    *pin = PIN_NODE;
+  } else {
+    slog(LOG_ERR, "Value of %s= in %s must be no, cpu, or node", key, name);
+    return false;
+  }
+  return true;
+}
+
+// ### Parse a command line
+// Splits the command line of the given configuration into words. Words
+// are separated by spaces or tabs. Quoting works like in `sh(1)`: single
+// quotes keep everything between them as is, a backslash outside of
+// quotes keeps the character after it as is, and between double quotes a
+// backslash only does so for `"`, `\`, `$`, and `` ` ``. The words are
+// stored one after another with terminating null bytes in the `args`
+// buffer of the configuration, and their offsets into it in `argv_off`.
+// Returns false and logs the error if the command line is malformed.
+bool parse_cmd(conf_t *conf, const char *name) {
+  const char *in = conf->cmd;
+  char *out = conf->args;
+  char quote = '\0';
+  bool in_word = false;
+
+  conf->argc = 0;
+
+  for (; *in != '\0'; in++) {
+
+    // Outside of quotes and words a blank is just a separator.
+    if (!quote && (*in == ' ' || *in == '\t')) {
+      if (in_word) {
+        *out++ = '\0';
+        in_word = false;
+      }
+      continue;
+    }
+
+    // Anything else starts a new word unless we're already in one. Room
+    // for the terminating null pointer of the argument vector is kept.
+    if (!in_word) {
+      if (conf->argc == CHILD_ARGV_LEN) {
+        slog(LOG_ERR, "Value of %s= in %s has too many arguments (max: %d)",
+             CONFIG_CMD_KEY, name, CHILD_ARGV_LEN);
+        return false;
+      }
+      conf->argv_off[conf->argc++] = out - conf->args;
+      in_word = true;
+    }
+
+    if (quote == '\'') {
+      // Inside single quotes only the closing quote is special.
+      if (*in == '\'') {
+        quote = '\0';
+      } else {
+        *out++ = *in;
+      }
+    } else if (*in == '\\' && in[1] != '\0'
+               && (!quote || strchr("\"\\$`", in[1]) != NULL)) {
+      // An escaped character is copied without the backslash.
+      *out++ = *++in;
+    } else if (*in == '"') {
+      quote = quote ? '\0' : '"';
+    } else if (*in == '\'' && !quote) {
+      quote = '\'';
+    } else {
+      *out++ = *in;
+    }
+  }
+
+  if (quote) {
+    slog(LOG_ERR, "Value of %s= in %s has an unterminated %c quote",
+         CONFIG_CMD_KEY, name, quote);
+    return false;
+  }
+  *out = '\0';
+
+  // Words are never longer than the command line they came from and at
+  // least one blank separates them, so the words and their terminating
+  // null bytes always fit in the `args` buffer.
+  return conf->argc > 0;
+}
+
+// ### Resolve a command
+// Stores the path to the binary of the command line of the given
+// configuration in its `path` member, following the rules of `execvp(3)`.
+// A command containing a slash is used as is, while other commands are
+// looked up in the directories of `$PATH`. Returns false and leaves the
+// path empty if no executable file was found.
+bool resolve_cmd(conf_t *conf) {
+  const char *file = conf->args + conf->argv_off[0];
+  char dirs[PATH_MAX + 1], *dirs_p = dirs, *dir;
+  struct stat st;
+
+  conf->path[0] = '\0';
+
+  if (strchr(file, '/') != NULL) {
+    return safe_strcpy(conf->path, file, sizeof(conf->path));
+  }
+
+  // Without `$PATH` in our environment we use the same default as the C
+  // library.
+  const char *env_path = getenv("PATH");
+  if (!safe_strcpy(dirs, env_path ? env_path : DEFAULT_PATH, sizeof(dirs))) {
+    return false;
+  }
+
+  while ((dir = strsep(&dirs_p, ":")) != NULL) {
+    // An empty directory in `$PATH` means the current working directory,
+    // which for a child is its configured working directory.
+    if (!str_not_empty(dir)) {
+      dir = conf->cwd;
+    }
+
+    // A directory can be searched, which `access(2)` takes for being
+    // executable, but `execvp(3)` would pass it by.
+    if ((unsigned) snprintf(conf->path, sizeof(conf->path), "%s/%s",
+                            dir, file) < sizeof(conf->path)
+        && access(conf->path, X_OK) == 0 && stat(conf->path, &st) == 0
+        && S_ISREG(st.st_mode)) {
+      return true;
+    }
+  }
+
+  conf->path[0] = '\0';
+  return false;
+}
+
+
+// Instances
+// ---------
+
+// ### Find the child of a configuration file
+// Returns the first instance of the child of the configuration file with
+// the given name, or null if we have none. A single instance has the name
+// of its file.
+child_t *find_config_child(const char *file) {
+  char name[INSTANCE_NAME_SIZE + 1];
+  child_t *ch;
+
+  // Nothing but an instance can have a name with our separator in it.
+  if (strchr(file, INSTANCE_SEPARATOR) != NULL) {
+    return NULL;
+  }
+
+  if ((ch = find_child(file)) != NULL) {
+    return ch;
+  }
+  instance_name(name, sizeof(name), file, 0, 2);
+  return find_child(name);
+}
+
+// ### Find an instance
+// Returns the instance with the given index of the child of the
+// configuration file with the given name, which has the given number of
+// instances, or null if we have none.
+child_t *find_instance(const char *file, int instance, long instances) {
+  char name[INSTANCE_NAME_SIZE + 1];
+
+  instance_name(name, sizeof(name), file, instance, instances);
+  return find_child(name);
+}
+
+// ### Name an instance
+// Writes the name of the instance with the given index of the child of
+// the configuration file with the given name, which has the given number
+// of instances, to the given buffer of the given size. Several instances
+// are named after the file with their index added, like `web@3`, while a
+// single instance has the name of the file.
+void instance_name(char *buf, size_t size, const char *file, int instance,
+                   long instances) {
+  if (instances > 1) {
+    snprintf(buf, size, "%s%c%d", file, INSTANCE_SEPARATOR, instance);
+  } else {
+    snprintf(buf, size, "%s", file);
+  }
+}
+
+// ### Add the instances of a child
+// Adds every instance of the given child, which was just loaded from its
+// configuration file, to our global linked list of children. They are
+// left for `spawn_ready_children()` to spawn. The given child only served
+// as the template of its instances and is freed.
+void add_instances(child_t *tmpl) {
+  for (int i = 0; i < tmpl->conf.instances; i++) {
+    append_child(new_instance(tmpl, i));
+  }
+  cleanup_child(tmpl);
+}
+
+// ### Create an instance
+// Returns a newly allocated instance with the given index of the given
+// child, which was just loaded from its configuration file and has neither
+// a process nor any file descriptors of its own. The events and timeouts
+// of the instance are its own.
+child_t *new_instance(child_t *tmpl, int instance) {
+  child_t *ch = safe_alloc(sizeof(child_t));
+
+  *ch = *tmpl;
+  ch->pidfd_ev.data = ch->output_ev.data = ch->cgroup_ev.data = ch;
+  ch->quarantine_to.data = ch->kill_to.data = ch->ready_to.data = ch;
+  ch->start_to.data = ch->check_to.data = ch->check_ev.data = ch;
+  ch->pidfile_to.data = ch;
+  ch->instance = instance;
+  ch->generation = confdir_generation;
+  instance_name(ch->name, sizeof(ch->name), ch->file, instance,
+                ch->conf.instances);
+  instance_conf(&ch->conf, instance);
+  return ch;
+}
+
+// ### Configure an instance
+// Adjusts the given configuration for the instance with the given index.
+// Several instances would trip over each other rotating a shared log
+// file, so each gets its own with the index added before the extension of
+// the file name, like `web@3.log`.
+void instance_conf(conf_t *conf, int instance) {
+  char ext[CHILD_PATH_SIZE + 1];
+  char *base, *dot;
+
+  if (conf->instances <= 1) {
+    return;
+  }
+
+  base = strrchr(conf->log, '/');
+  base = base != NULL ? base + 1 : conf->log;
+  if ((dot = strrchr(base, '.')) == NULL || dot == base) {
+    dot = base + strlen(base);
+  }
+
+  strcpy(ext, dot);
+  snprintf(dot, sizeof(conf->log) - (dot - conf->log), "%c%d%s",
+           INSTANCE_SEPARATOR, instance, ext);
+}
+
+// ### Refresh an instance
+// Brings the given instance in line with the given configuration of its
+// child. Changes to how it's spawned require it to be restarted, while
+// other changes like its quarantine policy take effect by themselves.
+void refresh_instance(child_t *ch, conf_t *conf) {
+  conf_t new_conf = *conf;
+
+  instance_conf(&new_conf, ch->instance);
+
+  bool restart = config_differs(&ch->conf, &new_conf);
+  bool reopen_log = strcmp(ch->conf.log, new_conf.log) != 0;
+
+  // Sockets on addresses the child still listens on are kept, so that
+  // connections queue up while it restarts.
+  keep_listeners(ch, &new_conf);
+  ch->conf = new_conf;
+
+  // Output from now on goes to the new log file if it changed, and the
+  // limits of its control group change while it runs.
+  if (reopen_log && ch->log_fd >= 0) {
+    close_output_log(ch);
+    open_output_log(ch, 0);
+  }
+  set_cgroup_limits(ch);
+  watch_child(ch);
+  schedule_check(ch);
+
+  if (restart) {
+    slog(LOG_NOTICE, "Configuration of %s changed, restarting", ch->name);
+    restart_child(ch);
+  }
+}
+
+// ### Rename an instance
+// Gives the given instance the name it has among the given number of
+// instances, which changes when there used to be one instance and now
+// are several, or the other way around. The instance keeps running
+// under its new name.
+void rename_instance(child_t *ch, long instances) {
+  char name[INSTANCE_NAME_SIZE + 1];
+
+  instance_name(name, sizeof(name), ch->file, ch->instance, instances);
+  if (strcmp(name, ch->name) != 0) {
+    unindex_name(ch);
+    strcpy(ch->name, name);
+    index_name(ch);
+  }
+}
+
+// ### Stamp instances
+// Stamps every instance of the given child, which is the first of them,
+// with the current generation.
+void stamp_instances(child_t *first) {
+  long instances = first->conf.instances;
+
+  for (int i = 0; i < instances; i++) {
+    find_instance(first->file, i, instances)->generation = confdir_generation;
+  }
+}
+
+// ### Note the configuration file of instances
+// Stores the identity of the configuration file of every instance of the
+// given child, which is the first of them, as given by `stat(2)`.
+void note_instances(child_t *first, struct stat *st) {
+  long instances = first->conf.instances;
+
+  for (int i = 0; i < instances; i++) {
+    note_config_file(find_instance(first->file, i, instances), st);
+  }
+}
+
+// ### Remove instances
+// Removes every instance of the given child, which is the first of them.
+// The first instance may be freed along the way, so we hold on to the
+// name of its file.
+void remove_instances(child_t *first) {
+  char file[CHILD_NAME_SIZE + 1];
+  long instances = first->conf.instances;
+
+  strcpy(file, first->file);
+  for (int i = 0; i < instances; i++) {
+    remove_child(find_instance(file, i, instances));
+  }
+}
+
+
+// Execution of children
+// ---------------------
+
+// ### Spawn ready children
+// Iterates over all our children and spawn those which have never been
+// spawned, once the children they're started after have started and as
+// long as we're not starting too many children at once. All child
+// structures are initialized as quarantined without a scheduled
+// quarantine timeout. Quarantined children which have been spawned before
+// are spawned by their own timeout. Children left waiting are looked at
+// again when another child has started.
+void spawn_ready_children(void) {
+  // Children we didn't have before might not get the file descriptors
+  // they need, and what they depend on has to be resolved.
+  if (dependencies_changed) {
+    check_fd_limit();
+    resolve_dependencies();
+  }
+
+  for (child_t *ch = head_ch; ch != NULL; ch = ch->next) {
+    if (starts_max > 0 && starting_count >= starts_max) {
+      return;
+    }
+
+    if (ch->quarantined && !timeout_pending(&ch->quarantine_to)
+        && dependencies_started(ch)) {
+      spawn_child(ch);
+    }
+  }
+}
+
+// ### Respawn terminated children
+// Respawns all terminated children. This function is called
+// when we get a `SIGCHLD` signal and we're not tracking our children
+// through process file descriptors. As a subreaper it's also called in
+// process file descriptor mode, on `SIGCHLD` and after a process has been
+// reaped through its process file descriptor, to reap orphans, which
+// have none.
+void respawn_terminated_children(void) {
+  child_t *ch;
+  struct rusage usage;
+  siginfo_t info;
+  pid_t ch_pid, session;
+  int status;
+
+  // We retrieve information about terminated child processes and the
+  // resources they used using `wait4(2)`. It's possible that we only get
+  // one `SIGCHLD` signal delivered from the kernel even though more than
+  // one child terminated. We therefore loop until we've gotten the process
+  // id of all terminated children. We use the `WNOHANG` flag so that we
+  // don't block the thread until status of any terminated children is
+  // available. Each process is looked at with `WNOWAIT` before it's
+  // reaped, since the session of an orphan can only be read while it's
+  // still around.
+  while (waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) == 0
+         && (ch_pid = info.si_pid) > 0) {
+
+    // We look up the child structure of the exited child process in our
+    // process id index. Processes we no longer supervise, like those of
+    // children removed on a reload, are simply not found. The process
+    // might also have been checking a child, or be an orphan.
+    ch = find_child_by_pid(ch_pid);
+
+    // In process file descriptor mode every process in our index is
+    // reaped by the handler of its process file descriptor. Orphans behind
+    // it are left for the sweep after that.
+    if (ch != NULL && pidfd_mode) {
+      break;
+    }
+    if (ch != NULL || !read_process_stat(ch_pid, NULL, NULL, &session)) {
+      session = 0;
+    }
+
+    if (wait4(ch_pid, &status, WNOHANG, &usage) <= 0) {
+      break;
+    }
+    if (ch == NULL) {
+      reap_orphan(session);
+    } else if (ch_pid == ch->check_pid) {
+      reap_check(ch, status);
+    } else {
+      reap_child(ch, status, &usage);
+    }
+  }
+
+  // The last child to terminate during a shutdown lets us exit.
+  finish_shutdown();
+}
+
+// ### Handle a terminated process file descriptor
+// The event handler for the process file descriptor of a child. It
+// becomes readable when the child process terminates, so we reap exactly
+// this child without looking at any other.
+void handle_pidfd(event_t *ev, uint32_t events) {
+  struct rusage usage;
+  siginfo_t info;
+
+  (void) events;
+
+  // A zero process id in the returned information means that the process
+  // has not terminated after all.
+  if (wait_pidfd(ev->fd, &info, &usage) < 0 || info.si_pid == 0) {
+    return;
+  }
+
+  reap_child(ev->data, wait_status(&info), &usage);
+
+  // Orphans which terminated along with the child might have been waiting
+  // behind it.
+  if (subreaper) {
+    respawn_terminated_children();
+  }
+
+  // The last child to terminate during a shutdown lets us exit.
+  finish_shutdown();
+}
+
+// ### Reap a child
+// Handles the termination of the process of the given child which has
+// already been waited for with the given status as returned by
+// `waitpid(3)` and the given resources used. Processes it left behind in
+// its control group are killed, and the child is settled once they're
+// gone.
+void reap_child(child_t *ch, int status, const struct rusage *usage) {
+  long uptime = seconds_since(&ch->up_at);
+
+  // The termination is counted in our metrics and remembered in the
+  // history of the child, from which we describe it in our log messages.
+  record_exit(ch, status, uptime);
+  remember_exit(ch, status, uptime, usage);
+
+  // A process which terminated while it was starting has only started if
+  // it was done successfully, like a one-off job.
+  finish_start(ch, WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  // The process id is no longer in use by this child and could be handed
+  // out to any new process, so we drop it from the index together with
+  // its process file descriptor.
+  release_child_process(ch);
+
+  // A child which stayed up long enough is considered stable and its next
+  // quarantine starts from scratch.
+  if (uptime >= ch->conf.quarantine_reset) {
+    ch->quarantines = 0;
+  }
+
+  // A child which daemonized is followed to its daemon. Otherwise nothing
+  // is done with the child until whatever its process forked is gone as
+  // well, so that a new process never runs alongside those of the
+  // previous one.
+  if (!follow_pidfile(ch, status)) {
+    drain_child(ch);
+  }
+}
+
+// ### Settle a child
+// Handles the termination of the process of the given child, described
+// by the last record in its history, once nothing of the process is left.
+// The child is either quarantined, respawned, or left down as its restart
+// policy says.
+void settle_child(child_t *ch) {
+  exit_record_t *rec = &ch->history[(ch->history_start + ch->history_len - 1)
+                                    % EXIT_HISTORY_SIZE];
+  long uptime = rec->uptime;
+  int status = rec->status;
+  char how[EXIT_DESCRIPTION_SIZE];
+
+  describe_exit(rec, how, sizeof(how));
+
+  // A removed child is done with once its process has terminated, and so
+  // is the previous process of a replaced child.
+  if (ch->removed) {
+    slog(LOG_NOTICE, "%s %s after: %lds with %s", ch->name,
+         ch->replaced ? "replaced" : "removed", uptime, how);
+    drop_removed_child(ch);
+    return;
+  }
+
+  // Nothing is respawned while we're shutting down.
+  if (shutting_down) {
+    slog(LOG_NOTICE, "%s shut down after: %lds with %s", ch->name, uptime,
+         how);
+    return;
+  }
+
+  // A replacement which terminated before it was ready leaves the child
+  // with its previous process, which is still up.
+  if (ch->rolling != NULL) {
+    slog(LOG_WARNING, "Replacement of %s terminated after: %lds with %s " \
+         "before it was ready, keeping its previous process", ch->name,
+         uptime, how);
+    adopt_child_process(ch);
+    return;
+  }
+
+  // A child stopped on request stays down until it is started again.
+  if (ch->stopped) {
+    slog(LOG_NOTICE, "%s stopped after: %lds with %s", ch->name, uptime,
+         how);
+    return;
+  }
+
+  // A child we terminated ourselves to restart it with a new configuration
+  // is respawned right away no matter how long it lived, and it gets a
+  // fresh start with its quarantines.
+  if (ch->restarting) {
+    ch->restarting = false;
+    ch->quarantines = 0;
+    slog(LOG_NOTICE, "%s restarted after: %lds with %s", ch->name, uptime,
+         how);
+    spawn_child(ch);
+    return;
+  }
+
+  // A child which isn't to be restarted after this termination is left
+  // down as if it was stopped, until it is started again.
+  if (!restart_allowed(ch, status)) {
+    ch->stopped = true;
+    slog(LOG_NOTICE, "%s terminated after: %lds with %s and will not be " \
+         "restarted", ch->name, uptime, how);
+    return;
+  }
+
+  // If the child lived shorter than the value of `QUARANTINE_TRIGGER`
+  // we mark the child as quarantined and log its misbehavior. The
+  // child is respawned by its quarantine timeout once its quarantine
+  // period has passed.
+  if (child_recently_spawned(ch, QUARANTINE_TRIGGER)) {
+    quarantine_child(ch);
+    slog(LOG_WARNING, "%s terminated after: %lds (limit: %ds) with %s " \
+        "and will be quarantined for %.1fs", ch->name, uptime,
+        QUARANTINE_TRIGGER, how, timespec_seconds(&ch->quarantine_period));
+    return;
+  }
+
+  // If the child lived longh enough to not be quarantined we log its
+  // termination and respawn it.
+  slog(LOG_WARNING, "%s terminated after: %lds with %s", ch->name, uptime,
+       how);
+  spawn_child(ch);
+}
+
+// ### Quarantine a child
+// Marks the given child as quarantined and schedules its quarantine
+// timeout to spawn it again after its quarantine period. The first
+// quarantine of a child lasts as long as its configured quarantine, and
+// every consecutive quarantine lasts twice as long as the one before up to
+// its configured maximum. A random jitter of up to the configured
+// percentage is added on top so that children which terminated together,
+// like when a service they all depend on went away, don't all come back
+// at the same moment.
+void quarantine_child(child_t *ch) {
+  // Periods are in milliseconds, which with jitter added to the longest
+  // quarantine we allow don't fit in a 32-bit `long`.
+  int64_t period = (int64_t) ch->conf.quarantine * 1000;
+  int64_t max = (int64_t) ch->conf.quarantine_max * 1000;
+
+  ch->quarantined = true;
+  ch->quarantines++;
+  ch->metrics.quarantines++;
+
+  // The period is doubled once per consecutive quarantine, but we stop as
+  // soon as we've reached the maximum so that it can't overflow.
+  for (int i = 1; i < ch->quarantines && period < max; i++) {
+    period *= 2;
+  }
+  if (period > max) {
+    period = max;
+  }
+  period += random() % (period * ch->conf.quarantine_jitter / 100 + 1);
+
+  ch->quarantine_period.tv_sec = period / 1000;
+  ch->quarantine_period.tv_nsec = period % 1000 * (NSEC_PER_SEC / 1000);
+  schedule_timeout(&ch->quarantine_to, &ch->quarantine_period);
+}
+
+// ### Handle quarantine timeout
+// The handler for the quarantine timeout of a child. The child has been
+// quarantined long enough and is spawned again.
+void handle_quarantine_timeout(timeout_t *to) {
+  spawn_child(to->data);
+}
+
+// ### Spawn a child
+// Spawns the command line of the given child in a new child process of
+// the parent `going` process. How the process is started is up to
+// `start_process()`.
+void spawn_child(child_t *ch) {
+
+  // Nothing is spawned while we're shutting down, whether it's a child
+  // coming out of quarantine or one started on request.
+  if (shutting_down) {
+    return;
+  }
+
+  // The child is no longer quarantined since it obviously got the go-ahead
+  // to spawn. It might have been given the go-ahead before its quarantine
+  // timeout, which is no longer needed then.
+  ch->quarantined = false;
+  cancel_timeout(&ch->quarantine_to);
+
+  struct timespec started_at;
+  pid_t ch_pid;
+  int err;
+
+  // The output of the child is captured if we can, otherwise it shares
+  // our output like it always has.
+  open_output(ch);
+
+  // A child which can't get the sockets it listens on has to wait for
+  // them just like a child which can't be executed.
+  if (!open_listeners(ch)) {
+    quarantine_child(ch);
+    slog(LOG_ERR, "Can't listen for %s and it will be quarantined for %.1fs",
+         ch->name, timespec_seconds(&ch->quarantine_period));
+    return;
+  }
+
+  // A child which can't get a control group of its own runs in ours, like
+  // it would without a control group directory.
+  open_cgroup(ch);
+
+  // We iterate until we get the desired behavior from `start_process()`.
+  while (true) {
+    monotonic_now(&started_at);
+
+    // If the child process could not be started because the system is
+    // out of resources we log the error and wait a little before trying
+    // again.
+    if ((err = start_process(ch, &ch_pid)) == EAGAIN || err == ENOMEM) {
+      slog(LOG_EMERG, "Could not spawn %s, sleeping %ds",
+           ch->name, EMERG_SLEEP);
+      sleep(EMERG_SLEEP);
+      continue;
+    }
+
+    // We note the time that the child process started so that we can track
+    // its uptime.
+    monotonic_now(&ch->up_at);
+
+    // Any other error means that the command line of the child could not
+    // be executed. This is no different from a child process terminating
+    // right away, so the child is quarantined.
+    if (err != 0) {
+      quarantine_child(ch);
+      slog(LOG_ERR, "Can't execute %s in %s: %s and will be quarantined " \
+           "for %.1fs", ch->conf.cmd, ch->conf.cwd, strerror(err),
+           timespec_seconds(&ch->quarantine_period));
+      return;
+    }
+
+    // We count the start of the child and how long it took. It isn't
+    // ready before it says so.
+    record_spawn(ch, &started_at);
+    ch->ready = false;
+
+    // Storing the process id of the child process is important so that we
+    // know which process failed if we get a `SIGCHLD` signal later.
+    ch->pid = ch_pid;
+    // The process leads a session of its own, which is named after it.
+    ch->session = ch_pid;
+    // The process id is added to our index so that we can find this
+    // child again in constant time when it terminates.
+    index_pid(ch, ch->pid);
+
+    // In process file descriptor mode every child process must have a
+    // process file descriptor since nothing else reaps it. If we can't
+    // get one we kill and reap the process we just started and try
+    // again after a little while.
+    if (pidfd_mode && !track_child_process(ch)) {
+      kill(ch_pid, SIGKILL);
+      waitpid(ch_pid, NULL, 0);
+      release_child_process(ch);
+      slog(LOG_EMERG, "Could not track %s, sleeping %ds",
+           ch->name, EMERG_SLEEP);
+      sleep(EMERG_SLEEP);
+      continue;
+    }
+
+    // The child is starting until it's ready or has been up for a while,
+    // and is watched from now on if it uses too much.
+    begin_start(ch);
+    watch_child(ch);
+    schedule_check(ch);
+    return;
+  }
+}
+
+// ### Build an argument vector
+// Points the given argument vector at the words of the command line of
+// the given configuration, which were split by `parse_cmd()`, and
+// terminates it with a null pointer. If the path to the binary is not yet
+// known we try to look it up once more.
+void build_argv(conf_t *conf, char **argv) {
+  for (int i = 0; i < conf->argc; i++) {
+    argv[i] = conf->args + conf->argv_off[i];
+  }
+  argv[conf->argc] = NULL;
+
+  if (!str_not_empty(conf->path)) {
+    resolve_cmd(conf);
+  }
+}
+
+// ### Build an environment
+// Returns a newly allocated environment vector for the given child, which
+// is our own environment with the variables of the child added. Variables
+// of the child replace ours of the same name. The given process id is
+// that of the process the environment is for, or zero if it's not known
+// yet. The variables are written to the given buffer of the given size,
+// which must outlive the vector.
+char **build_envp(child_t *ch, pid_t pid, char *buf, size_t size) {
+  size_t len = child_env(ch, pid, buf, size), n = 0, envc = 0;
+
+  while (environ[n] != NULL) {
+    n++;
+  }
+
+  char **envp = safe_alloc((n + CHILD_ENV_MAX + 1) * sizeof(char *));
+
+  for (size_t i = 0; i < n; i++) {
+    size_t name_len = strcspn(environ[i], "=");
+    bool replaced = false;
+
+    for (size_t off = 0; off < len; off += strlen(buf + off) + 1) {
+      if (strncmp(environ[i], buf + off, name_len + 1) == 0) {
+        replaced = true;
+        break;
+      }
+    }
+    if (!replaced) {
+      envp[envc++] = environ[i];
+    }
+  }
+
+  for (size_t off = 0; off < len && envc < n + CHILD_ENV_MAX;
+       off += strlen(buf + off) + 1) {
+    envp[envc++] = buf + off;
+  }
+  envp[envc] = NULL;
+  return envp;
+}
+
+// ### Environment of a child
+// Writes the variables the given child gets in addition to our own
+// environment to the given buffer of the given size, one after another
+// with terminating null bytes, for the process with the given process id
+// if it's known. Returns the number of bytes written.
+size_t child_env(child_t *ch, pid_t pid, char *buf, size_t size) {
+  size_t len = 0;
+
+  // A child which tells us when it's ready needs to know where to.
+  if (ch->conf.notify && str_not_empty(notify_path)) {
+    put_env(buf, size, &len, "%s=%s", NOTIFY_ENV, notify_path);
+  }
+
+  // Every process of an instance is told which one it is.
+  put_env(buf, size, &len, "%s=%d", INSTANCE_ENV, ch->instance);
+
+  // A child with sockets listening on its behalf is told how many it got.
+  // They are only meant for the process with the process id given along.
+  if (ch->conf.listen_count > 0) {
+    put_env(buf, size, &len, "LISTEN_FDS=%d", ch->conf.listen_count);
+    if (pid > 0) {
+      put_env(buf, size, &len, "LISTEN_PID=%d", pid);
+    }
+  }
+  return len;
+}
+
+// ### Put a variable in an environment
+// Formats a variable into the given buffer of the given size at the
+// given length, which is advanced past it. A variable which doesn't fit
+// is left out.
+void put_env(char *buf, size_t size, size_t *len, const char *fmt, ...) {
+  va_list ap;
+
+  va_start(ap, fmt);
+  int n = vsnprintf(buf + *len, size - *len, fmt, ap);
+  va_end(ap);
+
+  if (n >= 0 && *len + n + 1 <= size) {
+    *len += n + 1;
+  }
+}
+
+#ifndef SPAWN_FORK
+
+// ### Start a process
+// Starts a child process executing the command line of the given child and
+// stores its process id in the given pointer. Returns zero on success or
+// an error number.
+//
+// We use `posix_spawn(3)` which the C library implements with a
+// `clone(2)` sharing our address space, much like `vfork(2)`. Our page
+// tables are therefore not copied, which a `fork(2)` of a supervisor with
+// lots of children would spend most of its time doing. Since the child
+// process can't safely run any of our code before it execs, everything
+// it should do is described up front: it gets its own session, an empty
+// signal mask, its working directory, and the sockets listening on its
+// behalf. Failures to change the working directory or to execute the
+// command line are reported to us through the return value.
+//
+// A child with sockets listening on its behalf has to be told its own
+// process id, which we don't know before it's started, so its command
+// line is executed by a shell which sets it.
+//
+// There is no spawn attribute for the processors a child may run on, but
+// a new process inherits them from us. A child with processors of its own
+// is therefore spawned while we're pinned the same way ourselves, which
+// costs us two `sched_setaffinity(2)` calls in stead of the child running
+// anywhere until we get around to pinning it.
+//
+// Neither are there spawn attributes for the niceness, IO priority,
+// resource limits, and OOM score adjustment of a child. Setting those on
+// ourselves could keep us from spawning at all, or from getting our own
+// back without privileges, and setting them once the process is started
+// would let it run without them for a while. A child configured with any
+// of them is therefore forked like with `make SPAWN=fork`.
+//
+// Nor is there a spawn attribute for the control group of a child.
+// Moving the process once it's started would leave anything it forked
+// before that behind, so a child with a control group has its command
+// line executed by a shell which moves itself there first.
+int start_process(child_t *ch, pid_t *pid) {
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  sigset_t empty_mask;
+  cpu_set_t set, our_set;
+  char *argv[CHILD_ARGV_LEN + 5], **args = argv + 4;
+  char env[CHILD_ENV_SIZE], **envp, cgroup[PATH_MAX];
+  const char *path = ch->conf.path;
+  bool pinned = false;
+  int err;
+
+  if (child_tuned(ch)) {
+    return fork_process(ch, pid);
+  }
+
+  build_argv(&ch->conf, args);
+
+  // A binary we could not find is reported just like `execvp(3)` would.
+  if (!str_not_empty(ch->conf.path)) {
+    return ENOENT;
+  }
+
+  if ((err = posix_spawnattr_init(&attr)) != 0) {
+    return err;
+  }
+  if ((err = posix_spawn_file_actions_init(&actions)) != 0) {
+    posix_spawnattr_destroy(&attr);
+    return err;
+  }
+
+  sigemptyset(&empty_mask);
+  posix_spawnattr_setsigmask(&attr, &empty_mask);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGMASK);
+  posix_spawn_file_actions_addchdir_np(&actions, ch->conf.cwd);
+
+  // The standard output and error of the child are the pipe we capture
+  // its output from.
+  if (ch->output_wfd >= 0) {
+    posix_spawn_file_actions_adddup2(&actions, ch->output_wfd, STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, ch->output_wfd, STDERR_FILENO);
+  }
+
+  // The sockets listening on behalf of the child follow its standard
+  // error. Its command line follows the shell which tells it so, after
+  // the control group the shell moves itself into.
+  for (int i = 0; i < ch->conf.listen_count; i++) {
+    posix_spawn_file_actions_adddup2(&actions, ch->listen_fds[i],
+                                     LISTEN_FDS_START + i);
+  }
+  if (ch->conf.listen_count > 0 || ch->cgroup_fd >= 0) {
+    *args = ch->conf.path;
+    if (ch->cgroup_fd >= 0) {
+      snprintf(cgroup, sizeof(cgroup), "%s/%s", cgroup_root,
+               ch->cgroup_name);
+      *--args = cgroup;
+    }
+    *--args = ch->cgroup_fd < 0 ? LISTEN_WRAPPER
+              : ch->conf.listen_count > 0 ? CGROUP_LISTEN_WRAPPER
+                                          : CGROUP_WRAPPER;
+    *--args = "-c";
+    *--args = WRAPPER_SHELL;
+    path = WRAPPER_SHELL;
+  }
+
+  // Since the path to the binary was resolved when the configuration was
+  // parsed we use `posix_spawn(3)` which does no lookup in `$PATH`.
+  envp = build_envp(ch, 0, env, sizeof(env));
+  if (child_affinity(ch, &set)) {
+    pinned = sched_getaffinity(0, sizeof(our_set), &our_set) == 0
+             && sched_setaffinity(0, sizeof(set), &set) == 0;
+    if (!pinned) {
+      slog(LOG_WARNING, "Can't set processors of %s: %m", ch->name);
+    }
+  }
+  err = posix_spawn(pid, path, &actions, &attr, args, envp);
+  if (pinned) {
+    sched_setaffinity(0, sizeof(our_set), &our_set);
+  }
+
+  free(envp);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  return err;
+}
+
+#else
+
+// ### Start a process
+// Starts a child process executing the command line of the given child and
+// stores its process id in the given pointer. Returns zero on success or
+// an error number.
+//
+// This variant is built with `make SPAWN=fork` and forks every child.
+int start_process(child_t *ch, pid_t *pid) {
+  return fork_process(ch, pid);
+}
+
+#endif
+
+// ### Fork a process
+// Starts a child process executing the command line of the given child
+// with a plain `fork(2)` followed by `exec_child()`, and stores its
+// process id in the given pointer. Returns zero on success or an error
+// number. Failures in the child process after the `fork(2)` are logged by
+// the child, which then terminates.
+int fork_process(child_t *ch, pid_t *pid) {
+  char env[CHILD_ENV_SIZE];
+  cpu_set_t set;
+  bool pin = child_affinity(ch, &set);
+  pid_t ch_pid;
+
+  // `fork(3)` creates a new process which is an exact copy of its invoking
+  // process. We are inside the child process if the return value is zero.
+  if ((ch_pid = fork()) == 0) {
+
+    // Our event loop belongs to the parent process. The child shares
+    // the underlying `epoll(7)` instance and timer with its parent, so we
+    // make sure that nothing done before `exec_child()` touches them.
+    epoll_fd = -1;
+    timer_ev.fd = -1;
+
+    // Log messages queued by our parent are its own to send, and so are
+    // the repeats it counted.
+    log_count = 0;
+    for (int i = 0; i < LOG_REPEATS_MAX; i++) {
+      log_repeats[i].format = NULL;
+      log_repeats[i].repeats = 0;
+    }
+
+    // The child should have its own session and become the process
+    // group leader.
+    setsid();
+
+    // We initialize an empty signal mask and block based on it, resulting
+    // in blockage of no signals. This is done since the parent process
+    // blocks certain signals and the child created by a `fork(3)` inherits
+    // its parents block mask.
+    sigset_t empty_mask;
+    sigemptyset(&empty_mask);
+    sigprocmask(SIG_SETMASK, &empty_mask, NULL);
+
+    // The standard output and error of the child are the pipe we capture
+    // its output from.
+    if (ch->output_wfd >= 0) {
+      dup2(ch->output_wfd, STDOUT_FILENO);
+      dup2(ch->output_wfd, STDERR_FILENO);
+    }
+
+    // The sockets listening on behalf of the child follow its standard
+    // error. A socket sitting where the sockets go is moved above them
+    // first, so that it can't be overwritten before it's in place, and so
+    // that `dup2(2)`, which does nothing when a socket is already in
+    // place, always clears its close-on-exec flag.
+    int count = ch->conf.listen_count, listen_fds[CHILD_LISTEN_MAX];
+
+    for (int i = 0; i < count; i++) {
+      listen_fds[i] = ch->listen_fds[i];
+      if (listen_fds[i] < LISTEN_FDS_START + count) {
+        listen_fds[i] = fcntl(listen_fds[i], F_DUPFD_CLOEXEC,
+                              LISTEN_FDS_START + count);
+      }
+    }
+    for (int i = 0; i < count; i++) {
+      if (listen_fds[i] < 0
+          || dup2(listen_fds[i], LISTEN_FDS_START + i) < 0) {
+        slog(LOG_WARNING, "Can't pass socket %s to %s: %m",
+             ch->conf.listen[i], ch->name);
+      }
+    }
+
+    // A pinned child only runs on its own processors, and the child moves
+    // itself into its control group before it can fork anything.
+    if (pin && sched_setaffinity(0, sizeof(set), &set) < 0) {
+      slog(LOG_WARNING, "Can't set processors of %s: %m", ch->name);
+    }
+    join_cgroup(ch);
+
+    // The child is scheduled and limited as configured before it runs
+    // anything. Whatever couldn't be set is logged right away, since
+    // messages still queued are gone once the child is executed.
+    tune_process(ch);
+    flush_log();
+
+    // Change the current working directory to that specified in the
+    // child's configuration file or the default `/`.
+    if (chdir(ch->conf.cwd) < 0) {
+      slog(LOG_ERR, "Can't change working directory to %s: %m",
+           ch->conf.cwd);
+      cleanup_children();
+      close_log();
+      _exit(EXIT_FAILURE);
+    }
+
+    // Replace the child process with the executable reciding at the path
+    // of the command line.
+    exec_child(&ch->conf, build_envp(ch, getpid(), env, sizeof(env)));
+
+    // If we reach this code the `execv(3)` call failed. We log the error
+    // and exit this child process. Note that the normal flow in the parent
+    // continues, but it will be notified that one of its children
+    // terminated.
+    slog(LOG_ERR, "Can't execute %s: %m", ch->conf.cmd);
+    cleanup_children();
+    close_log();
+    _exit(EXIT_FAILURE);
+  }
+
+  // If the return value of `fork(3)` is negative the call did not succeed,
+  // otherwise we're in the parent process.
+  if (ch_pid < 0) {
+    return errno;
+  }
+  *pid = ch_pid;
+  return 0;
+}
+
+// ### Exec wrapper
+// Replaces the current process with that of the executable file reciding
+// at the resolved path of the given configuration's command line, with
+// the given environment.
+void exec_child(conf_t *conf, char **envp) {
+  char *argv[CHILD_ARGV_LEN + 1];
+
+  build_argv(conf, argv);
+
+  // A binary we could not find is reported just like `execvp(3)` would.
+  if (!str_not_empty(conf->path)) {
+    errno = ENOENT;
+    return;
+  }
+
+  // `execve(2)` is used to replace this child process with the binary
+  // reciding at the path we resolved when the configuration was parsed.
+  execve(conf->path, argv, envp);
+}
+
+// ### Affinity of a child
+// Stores the processors the process of the given child may run on in the
+// given set. A child runs on its configured processors, if any. An
+// instance pinned to a processor gets the one at its index among its
+// configured processors or those we may run on ourselves, wrapping around
+// if there are more instances than processors, and one pinned to a NUMA
+// node gets the processors of the node at its index in the same way which
+// it's configured to run on. Returns false if the child may run anywhere,
+// or if where it's pinned can't be found out.
+bool child_affinity(child_t *ch, cpu_set_t *set) {
+  bool configured = CPU_COUNT(&ch->conf.cpus) > 0;
+  cpu_set_t allowed;
+  int n;
+
+  switch (ch->conf.pin) {
+    case PIN_CPU:
+      if (configured) {
+        allowed = ch->conf.cpus;
+      } else if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+        return false;
+      }
+      if ((n = CPU_COUNT(&allowed)) == 0) {
+        return false;
+      }
+      n = ch->instance % n;
+
+      CPU_ZERO(set);
+      for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && n-- == 0) {
+          CPU_SET(cpu, set);
+          return true;
+        }
+      }
+      return false;
+
+    case PIN_NODE:
+      if (!node_cpus(ch->instance, set)) {
+        *set = ch->conf.cpus;
+        return configured;
+      }
+      if (configured) {
+        CPU_AND(&allowed, set, &ch->conf.cpus);
+        *set = CPU_COUNT(&allowed) > 0 ? allowed : ch->conf.cpus;
+      }
+      return true;
+
+    default:
+      *set = ch->conf.cpus;
+      return configured;
+  }
+}
+
+// ### Processors of a NUMA node
+// Stores the processors of the NUMA node at the given index among those
+// with any processors, wrapping around, in the given set. The nodes are
+// read from `sysfs(5)` every time since processors can come and go.
+// Returns false if there are no nodes to be found.
+bool node_cpus(int instance, cpu_set_t *set) {
+  char path[PATH_MAX + 1], list[CONFIG_LINE_BUFFER_SIZE];
+  int nodes[NODE_MAX], count = 0;
+  cpu_set_t node_set;
+  FILE *fp;
+
+  // We go through the nodes twice, first counting those with processors
+  // and then reading the list of the one we picked.
+  for (int node = 0; node < NODE_MAX; node++) {
+    snprintf(path, sizeof(path), "%s/node%d/cpulist", NODE_DIR, node);
+    if ((fp = fopen(path, "re")) == NULL) {
+      continue;
+    }
+    if (fgets(list, sizeof(list), fp) != NULL
+        && parse_cpu_list(list, &node_set) && CPU_COUNT(&node_set) > 0) {
+      nodes[count++] = node;
+    }
+    fclose(fp);
+  }
+
+  if (count == 0) {
+    return false;
+  }
+
+  snprintf(path, sizeof(path), "%s/node%d/cpulist", NODE_DIR,
+           nodes[instance % count]);
+  if ((fp = fopen(path, "re")) == NULL) {
+    return false;
+  }
+  bool found = fgets(list, sizeof(list), fp) != NULL
+               && parse_cpu_list(list, set) && CPU_COUNT(set) > 0;
+  fclose(fp);
+  return found;
+}
+
+// ### Parse a processor list
+// Parses the given list of processors, like `0-3,8-11`, into the given
+// set. Returns false if the list is malformed.
+bool parse_cpu_list(const char *list, cpu_set_t *set) {
+  const char *p = list;
+  char *end;
+  long first, last;
+
+  CPU_ZERO(set);
+  while (*p != '\0' && *p != '\n') {
+    first = last = strtol(p, &end, 10);
+    if (end == p) {
+      return false;
+    }
+    if (*end == '-') {
+      p = end + 1;
+      last = strtol(p, &end, 10);
+      if (end == p) {
+        return false;
+      }
+    }
+
+    for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+      CPU_SET(cpu, set);
+    }
+
+    p = *end == ',' ? end + 1 : end;
+    if (*end != ',' && *end != '\0' && *end != '\n') {
+      return false;
+    }
+  }
+  return true;
+}
+
+// ### Tuned child
+// Returns true if the given child has its niceness, IO priority, resource
+// limits, or OOM score adjustment configured, rather than inheriting ours.
+bool child_tuned(child_t *ch) {
+  conf_t *conf = &ch->conf;
+
+  return conf->nice != INHERIT || conf->ioprio != INHERIT
+         || conf->limit_nofile != INHERIT || conf->limit_memlock != INHERIT
+         || conf->limit_core != INHERIT || conf->limit_as != INHERIT
+         || conf->oom_score_adj != INHERIT;
+}
+
+// ### Tune a process
+// Sets the niceness, IO priority, resource limits, and OOM score
+// adjustment of the calling process, which is about to execute the
+// command line of the given child, as configured for the child. Anything
+// which can't be set is logged, and the process runs as it would have
+// without it.
+void tune_process(child_t *ch) {
+  conf_t *conf = &ch->conf;
+
+  if (conf->nice != INHERIT && setpriority(PRIO_PROCESS, 0, conf->nice) < 0) {
+    slog(LOG_WARNING, "Can't set %s= of %s: %m", CONFIG_NICE_KEY, ch->name);
+  }
+  if (conf->ioprio != INHERIT
+      && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, conf->ioprio) < 0) {
+    slog(LOG_WARNING, "Can't set %s= of %s: %m", CONFIG_IOPRIO_KEY,
+         ch->name);
+  }
+
+  set_limit(ch, RLIMIT_NOFILE, conf->limit_nofile, CONFIG_LIMIT_NOFILE_KEY);
+  set_limit(ch, RLIMIT_MEMLOCK, conf->limit_memlock,
+            CONFIG_LIMIT_MEMLOCK_KEY);
+  set_limit(ch, RLIMIT_CORE, conf->limit_core, CONFIG_LIMIT_CORE_KEY);
+  set_limit(ch, RLIMIT_AS, conf->limit_as, CONFIG_LIMIT_AS_KEY);
+  set_oom_score_adj(ch);
+}
+
+// ### Set a resource limit
+// Sets both the soft and hard limit of the given resource of the calling
+// process to the given limit configured with the given key for the given
+// child, unless it's inherited.
+void set_limit(child_t *ch, int resource, long limit, const char *key) {
+  struct rlimit rl;
+
+  if (limit == INHERIT) {
+    return;
+  }
+
+  rl.rlim_cur = rl.rlim_max = limit == LIMIT_UNLIMITED ? RLIM_INFINITY
+                                                       : (rlim_t) limit;
+  if (setrlimit(resource, &rl) < 0) {
+    slog(LOG_WARNING, "Can't set %s= of %s: %m", key, ch->name);
+  }
+}
+
+// ### Set an OOM score adjustment
+// Writes the OOM score adjustment configured for the given child, unless
+// it's inherited, to `/proc` for the calling process.
+void set_oom_score_adj(child_t *ch) {
+  char buf[CGROUP_VALUE_SIZE];
+  int fd;
+
+  if (ch->conf.oom_score_adj == INHERIT) {
+    return;
+  }
+
+  int len = snprintf(buf, sizeof(buf), "%ld", ch->conf.oom_score_adj);
+
+  if ((fd = open(OOM_SCORE_ADJ_PATH, O_WRONLY | O_CLOEXEC)) < 0
+      || write(fd, buf, len) < 0) {
+    slog(LOG_WARNING, "Can't set %s= of %s: %m", CONFIG_OOM_SCORE_ADJ_KEY,
+         ch->name);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+
+// Startup ordering
+// ----------------
+
+// ### Resolve dependencies
+// Walks the dependencies of every child in depth first order to make sure
+// they form a directed acyclic graph. A dependency which would close a
+// cycle is dropped, since the children in the cycle would otherwise wait
+// for each other forever.
+void resolve_dependencies(void) {
+  dependencies_changed = false;
+
+  for (child_t *ch = head_ch; ch != NULL; ch = ch->next) {
+    ch->deps_mark = DEPS_UNVISITED;
+  }
+
+  // The instances of a child share its dependencies, so only the first
+  // instance of every child is visited.
+  for (child_t *ch = head_ch; ch != NULL; ch = ch->next) {
+    if (ch->instance == 0) {
+      visit_dependencies(ch);
+    }
+  }
+}
+
+// ### Visit dependencies
+// Visits the children the given child, which is the first of its
+// instances, is started after, unless it has been visited already. A
+// child we're still visiting is one the given child depends on itself.
+// Dependencies on configuration files we don't know are left alone, and
+// simply don't hold anything up.
+void visit_dependencies(child_t *ch) {
+  child_t *dep;
+
+  if (ch->deps_mark != DEPS_UNVISITED) {
+    return;
+  }
+  ch->deps_mark = DEPS_VISITING;
+
+  for (int i = 0; i < ch->conf.after_count; ) {
+    if ((dep = find_config_child(ch->conf.after[i])) == NULL) {
+      i++;
+      continue;
+    }
+
+    if (dep->deps_mark == DEPS_VISITING) {
+      slog(LOG_ERR, "%s can't be started after %s which is started " \
+           "after it, ignoring the dependency", ch->file, dep->file);
+      drop_dependency(ch, i);
+      continue;
+    }
+
+    visit_dependencies(dep);
+    i++;
+  }
+  ch->deps_mark = DEPS_VISITED;
+}
+
+// ### Drop a dependency
+// Removes the dependency at the given index from every instance of the
+// given child, which is the first of them. It's back when the
+// configuration file of the child is read again.
+void drop_dependency(child_t *first, int i) {
+  long instances = first->conf.instances;
+
+  for (int j = 0; j < instances; j++) {
+    conf_t *conf = &find_instance(first->file, j, instances)->conf;
+
+    conf->after_count--;
+    memmove(conf->after[i], conf->after[i + 1],
+            (conf->after_count - i) * sizeof(conf->after[0]));
+  }
+}
+
+// ### Dependencies started
+// Check whether every instance of every child the given child is started
+// after has started since it was last spawned.
+bool dependencies_started(child_t *ch) {
+  child_t *dep;
+
+  for (int i = 0; i < ch->conf.after_count; i++) {
+    if ((dep = find_config_child(ch->conf.after[i])) == NULL) {
+      continue;
+    }
+
+    long instances = dep->conf.instances;
+    for (int j = 0; j < instances; j++) {
+      if (!find_instance(dep->file, j, instances)->started) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// ### Begin a start
+// Notes that the process just spawned for the given child is starting.
+// It has started once it tells us that it's ready, or once it has been up
+// for a little while if it doesn't tell us. A child which never tells us
+// is taken to have started after its ready timeout.
+void begin_start(child_t *ch) {
+  struct timespec timeout = { ch->conf.ready_timeout, 0 };
+
+  ch->started = false;
+  if (!ch->starting) {
+    ch->starting = true;
+    starting_count++;
+  }
+  schedule_timeout(&ch->start_to,
+                   ch->conf.notify ? &timeout : &START_SETTLE_PERIOD);
+}
+
+// ### Finish a start
+// Notes that the process of the given child is done starting, and whether
+// it has started. Children waiting for it, or for a child to start, are
+// looked at again.
+void finish_start(child_t *ch, bool started) {
+  if (!ch->starting) {
+    return;
+  }
+
+  ch->starting = false;
+  ch->started = started;
+  starting_count--;
+  cancel_timeout(&ch->start_to);
+  schedule_starts();
+}
+
+// ### Handle a start timeout
+// The handler for the start timeout of a child, whose process has been
+// up for long enough to have started.
+void handle_start_timeout(timeout_t *to) {
+  child_t *ch = to->data;
+
+  if (ch->conf.notify) {
+    slog(LOG_WARNING, "%s not ready within %lds, starting those after it " \
+         "anyway", ch->name, ch->conf.ready_timeout);
+  }
+  finish_start(ch, true);
+}
+
+// ### Schedule starts
+// Has our main loop look at the children waiting to be started once it's
+// done with what it's doing now, which might be in the middle of
+// handling a terminated child.
+void schedule_starts(void) {
+  struct timespec now = { 0, 0 };
+
+  if (!timeout_pending(&starts_to)) {
+    schedule_timeout(&starts_to, &now);
+  }
+}
+
+// ### Handle starts
+// The handler for looking at children waiting to be started.
+void handle_starts(timeout_t *to) {
+  (void) to;
+  spawn_ready_children();
+}
+
+
+// Signal handling
+// ---------------
+
+// ### Block handled signals
+// For handling signals synchronously in our main loop with `signalfd(2)`
+// we need to set the `going` process' signal mask (a set of signals whose
+// delivery from the kernel is blocked).
+void block_signals(sigset_t *block_mask) {
+  sigemptyset(block_mask);
+
+  // The `SIGCHLD` signal is delivered if a child process terminates. The
+  // entire `going` program is designed arround handling this signal and
+  // respawning the terminated child process.
+  sigaddset(block_mask, SIGCHLD);
+
+  // The `SIGTERM` signal is the standard signal for terminating a process
+  // and the default signal sent by `kill(1)`. We block it so that we can
+  // handle it by cleaning up our main and child processes.
+  sigaddset(block_mask, SIGTERM);
+
+
+  // The `SIGINT` signal is sent when the user sends an terminal interrupt
   // (Ctrl-C). While `going` is not designed to be run from a controlling
   // terminal it's useful to handle this signal when testing/debugging.
   sigaddset(block_mask, SIGINT);
 
-  // The `SIGHUP` signal can be used for reloading a daemon's configuration.
-  // We block it so that we can do exactly that.
-  sigaddset(block_mask, SIGHUP);
+  // The `SIGHUP` signal can be used for reloading a daemon's configuration.
+  // We block it so that we can do exactly that.
+  sigaddset(block_mask, SIGHUP);
+
+  // After building a signal set of those signals we're going to handle in
+  // our main loop we set it as the signal process mask (blocked signals).
+  sigprocmask(SIG_BLOCK, block_mask, NULL);
+}
+
+// ### Handle signals
+// The event handler for our `signalfd(2)` file descriptor. Several signals
+// can be pending at once, so we drain all of them before acting. Each kind
+// of signal is only acted upon once per wakeup no matter how many times it
+// was delivered since a single sweep handles all of them.
+void handle_signals(event_t *ev, uint32_t events) {
+  struct signalfd_siginfo info[SIGNAL_BATCH_SIZE];
+  bool got_chld = false, got_hup = false, got_term = false;
+  ssize_t n;
+
+  (void) events;
+
+  // We read as many signals as fit in our buffer at a time until the
+  // non-blocking file descriptor tells us that there are no more.
+  while ((n = read(ev->fd, info, sizeof(info))) > 0) {
+    for (size_t i = 0; i < n / sizeof(*info); i++) {
+      switch (info[i].ssi_signo) {
+        case SIGCHLD: got_chld = true; break;
+        case SIGHUP:  got_hup = true;  break;
+        default:      got_term = true; break;
+      }
+    }
+  }
+
+  // We've received a terminating signal that we can handle. We shut down
+  // our children and exit once all of them have been reaped.
+  if (got_term) {
+    shutdown_children();
+  }
+
+  // When the `SIGCHLD` signal is delivered one (or possible several) of
+  // our child processes has terminated.
+  // In process file descriptor mode each terminated child is reaped through
+  // its own process file descriptor, so we only look for orphans as a
+  // subreaper.
+  if (got_chld && (!pidfd_mode || subreaper)) {
+    // In response to the termination of children we respawn or
+    // quarantine them.
+    respawn_terminated_children();
+  }
+
+  // A `SIGHUP` signal indicates that we've been requested to reload
+  // our configuration of child processes to supervise.
+  if (got_hup) {
+    reload_confdir();
+  }
+}
+
+
+// Event loop
+// ----------
+
+// ### Setup event loop
+// Creates our `epoll(7)` instance and registers file descriptors for
+// accepting the given blocked signals and for our timer with it. We can't
+// supervise anything without them so failure here is fatal.
+void setup_event_loop(sigset_t *block_mask) {
+  // All our file descriptors are opened with close-on-exec so that they
+  // are not leaked into the processes of our children.
+  if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+    slog(LOG_ALERT, "Can't create epoll instance: %m");
+    exit(EX_OSERR);
+  }
+
+  if ((signal_ev.fd = signalfd(-1, block_mask,
+                               SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+    slog(LOG_ALERT, "Can't create signalfd: %m");
+    exit(EX_OSERR);
+  }
+
+  if ((timer_ev.fd = timerfd_create(CLOCK_MONOTONIC,
+                                    TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+    slog(LOG_ALERT, "Can't create timerfd: %m");
+    exit(EX_OSERR);
+  }
+
+  if (!add_event(&signal_ev, EPOLLIN) || !add_event(&timer_ev, EPOLLIN)) {
+    exit(EX_OSERR);
+  }
+}
+
+// ### Register an event source
+// Starts watching the file descriptor of the given event source for the
+// given `epoll(7)` events. The handler of the event source will be called
+// with the source itself and the ready events from our main loop. Returns
+// false if the file descriptor could not be watched.
+bool add_event(event_t *ev, uint32_t events) {
+  struct epoll_event epev = { .events = events, .data.ptr = ev };
+
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ev->fd, &epev) < 0) {
+    slog(LOG_ERR, "Can't watch file descriptor %d: %m", ev->fd);
+    return false;
+  }
+  return true;
+}
+
+// ### Change watched events
+// Changes the `epoll(7)` events we watch the file descriptor of the given
+// event source for. Returns false if they could not be changed.
+bool modify_event(event_t *ev, uint32_t events) {
+  struct epoll_event epev = { .events = events, .data.ptr = ev };
+
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, ev->fd, &epev) < 0) {
+    slog(LOG_ERR, "Can't watch file descriptor %d: %m", ev->fd);
+    return false;
+  }
+  return true;
+}
+
+// ### Unregister an event source
+// Stops watching the file descriptor of the given event source. Any of its
+// events already returned by `epoll_wait(2)` but not yet dispatched are
+// dropped so that the event source can be freed right after this call.
+void remove_event(event_t *ev) {
+  // Inside a freshly forked child our event loop is off limits.
+  if (epoll_fd >= 0) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, ev->fd, NULL);
+  }
+
+  forget_ready_events(ev);
+}
+
+// ### Forget ready events
+// Drops any events of the given event source already returned by
+// `epoll_wait(2)` but not yet dispatched.
+void forget_ready_events(event_t *ev) {
+  for (int i = 0; i < ready_count; i++) {
+    if (ready_events[i].data.ptr == ev) {
+      ready_events[i].data.ptr = NULL;
+    }
+  }
+}
+
+// ### Event loop
+// Tha main loop of the `going` process waits for any of our registered
+// event sources to become ready and dispatches the ready events to their
+// handlers.
+void wait_forever(void) {
+
+  // We loop until the process explicitly exits or the kernel decides
+  // to terminate it.
+  while (true) {
+    // Messages logged while handling the previous events are sent before
+    // we wait for more.
+    flush_log();
+
+    // Our timer has to be armed for the earliest of the timeouts scheduled
+    // while handling the previous events.
+    arm_timer();
+
+    ready_count = epoll_wait(epoll_fd, ready_events, EVENT_BATCH_SIZE, -1);
+
+    if (ready_count < 0) {
+      if (errno != EINTR) {
+        slog(LOG_ERR, "Can't wait for events: %m");
+      }
+      ready_count = 0;
+      continue;
+    }
+
+    for (int i = 0; i < ready_count; i++) {
+      event_t *ev = ready_events[i].data.ptr;
+
+      // An event source removed by an earlier handler in this batch has
+      // its pointer cleared.
+      if (ev != NULL) {
+        ev->handler(ev, ready_events[i].events);
+      }
+    }
+    ready_count = 0;
+  }
+}
+
+
+// Timers
+// ------
+
+// ### Schedule a timeout
+// Schedules the given timeout to expire after the given relative time. A
+// timeout which is already scheduled is rescheduled.
+void schedule_timeout(timeout_t *to, const struct timespec *after) {
+  cancel_timeout(to);
+
+  monotonic_now(&to->at);
+  timespec_add(&to->at, after);
+
+  // The heap is grown to twice its size when it is full.
+  if (timeouts_count + 1 >= timeouts_size) {
+    size_t old_size = timeouts_size;
+    timeout_t **old_timeouts = timeouts;
+
+    timeouts_size = old_size ? old_size * 2 : TIMEOUTS_MIN_SIZE;
+    timeouts = safe_alloc(timeouts_size * sizeof(timeout_t *));
+    if (old_timeouts) {
+      memcpy(timeouts, old_timeouts, old_size * sizeof(timeout_t *));
+      free(old_timeouts);
+    }
+  }
+
+  // The new timeout is placed last in the heap and moved up to where its
+  // deadline belongs.
+  timeouts[++timeouts_count] = to;
+  to->heap_index = timeouts_count;
+  sift_timeout_up(timeouts_count);
+}
+
+// ### Cancel a timeout
+// Removes the given timeout from the heap if it is scheduled. The last
+// timeout of the heap takes its place and is moved up or down to where its
+// deadline belongs.
+void cancel_timeout(timeout_t *to) {
+  size_t i = to->heap_index;
+
+  if (i == 0) {
+    return;
+  }
+  to->heap_index = 0;
+
+  timeout_t *last = timeouts[timeouts_count--];
+  if (last != to) {
+    timeouts[i] = last;
+    last->heap_index = i;
+    sift_timeout_up(i);
+    sift_timeout_down(last->heap_index);
+  }
+}
+
+// ### Timeout scheduled
+// Check whether the given timeout is currently scheduled.
+bool timeout_pending(timeout_t *to) {
+  return to->heap_index != 0;
+}
+
+// ### Move a timeout up the heap
+// Swaps the timeout at the given heap index with its parent until its
+// parent has an earlier deadline.
+void sift_timeout_up(size_t i) {
+  timeout_t *to = timeouts[i];
+
+  while (i > 1 && timespec_before(&to->at, &timeouts[i / 2]->at)) {
+    timeouts[i] = timeouts[i / 2];
+    timeouts[i]->heap_index = i;
+    i /= 2;
+  }
+  timeouts[i] = to;
+  to->heap_index = i;
+}
+
+// ### Move a timeout down the heap
+// Swaps the timeout at the given heap index with its earliest child until
+// both its children have later deadlines.
+void sift_timeout_down(size_t i) {
+  timeout_t *to = timeouts[i];
+
+  while (2 * i <= timeouts_count) {
+    size_t j = 2 * i;
+    if (j < timeouts_count
+        && timespec_before(&timeouts[j + 1]->at, &timeouts[j]->at)) {
+      j++;
+    }
+    if (!timespec_before(&timeouts[j]->at, &to->at)) {
+      break;
+    }
+    timeouts[i] = timeouts[j];
+    timeouts[i]->heap_index = i;
+    i = j;
+  }
+  timeouts[i] = to;
+  to->heap_index = i;
+}
+
+// ### Arm timer
+// Arms our timer for the deadline of the earliest timeout, or disarms it
+// if there are none. This is done once before each wait for events so
+// that we only talk to the kernel if the earliest deadline changed.
+void arm_timer(void) {
+  struct itimerspec spec = { { 0, 0 }, { 0, 0 } };
+
+  // Inside a freshly forked child our timer is off limits.
+  if (timer_ev.fd < 0) {
+    return;
+  }
+
+  if (timeouts_count > 0) {
+    spec.it_value = timeouts[1]->at;
+  }
+
+  if (spec.it_value.tv_sec == timer_armed_at.tv_sec
+      && spec.it_value.tv_nsec == timer_armed_at.tv_nsec) {
+    return;
+  }
+  timer_armed_at = spec.it_value;
+
+  if (timerfd_settime(timer_ev.fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0) {
+    slog(LOG_ERR, "Can't arm timer: %m");
+  }
+}
+
+// ### Handle timer expiration
+// The event handler for our `timerfd_create(2)` file descriptor. Every
+// timeout whose deadline has passed is removed from the heap before its
+// handler is called. A handler is free to schedule timeouts again.
+void handle_timer(event_t *ev, uint32_t events) {
+  uint64_t expirations;
+  struct timespec now;
+
+  (void) events;
+
+  // Reading the number of expirations disarms the readiness of the timer.
+  if (read(ev->fd, &expirations, sizeof(expirations)) < 0) {
+    return;
+  }
+
+  // Our timer is no longer armed for any deadline.
+  timer_armed_at.tv_sec = timer_armed_at.tv_nsec = 0;
+
+  monotonic_now(&now);
+  while (timeouts_count > 0 && !timespec_before(&now, &timeouts[1]->at)) {
+    timeout_t *to = timeouts[1];
+    cancel_timeout(to);
+    to->handler(to);
+  }
+}
+
+// ### Current monotonic time
+// Stores the current time of the monotonic clock, which is never set
+// back, in the given timespec.
+void monotonic_now(struct timespec *ts) {
+  clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+// ### Add to a timespec
+// Adds the given duration to the given timespec.
+void timespec_add(struct timespec *ts, const struct timespec *d) {
+  ts->tv_sec += d->tv_sec;
+  ts->tv_nsec += d->tv_nsec;
+  if (ts->tv_nsec >= NSEC_PER_SEC) {
+    ts->tv_sec++;
+    ts->tv_nsec -= NSEC_PER_SEC;
+  }
+}
+
+// ### Compare timespecs
+// Check whether the first timespec is before the second.
+bool timespec_before(const struct timespec *a, const struct timespec *b) {
+  return a->tv_sec < b->tv_sec
+    || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+// ### Timespec in seconds
+// Returns the given timespec as a number of seconds.
+double timespec_seconds(const struct timespec *ts) {
+  return ts->tv_sec + (double) ts->tv_nsec / NSEC_PER_SEC;
+}
+
+// ### Seconds since
+// Returns the number of whole seconds passed since the given time of the
+// monotonic clock.
+long seconds_since(const struct timespec *ts) {
+  struct timespec now;
+
+  monotonic_now(&now);
+  return now.tv_sec - ts->tv_sec - (now.tv_nsec < ts->tv_nsec);
+}
+
+
+// Configuration directory watching
+// --------------------------------
+
+// ### Watch configuration directory
+// Starts watching the given configuration directory for configuration
+// files being added, removed, or written to. We can still be asked to
+// reload our configuration with `SIGHUP` if this fails, so we only log the
+// error.
+void watch_confdir(const char *dir) {
+  uint32_t mask = IN_CREATE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM |
+                  IN_CLOSE_WRITE | IN_ONLYDIR;
+
+  if ((inotify_ev.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+    slog(LOG_ERR, "Can't watch %s: %m", dir);
+    return;
+  }
+
+  // Without a watch our file descriptor is of no use, and keeping it
+  // would only hide that we're not watching.
+  if (inotify_add_watch(inotify_ev.fd, dir, mask) < 0
+      || !add_event(&inotify_ev, EPOLLIN)) {
+    slog(LOG_ERR, "Can't watch %s: %m", dir);
+    close(inotify_ev.fd);
+    inotify_ev.fd = -1;
+  }
+}
+
+// ### Handle configuration directory changes
+// The event handler for our `inotify(7)` file descriptor. The names of
+// changed configuration files are noted so that they can be handled
+// together once `CONFIG_DEBOUNCE_PERIOD` has passed since the first of
+// them changed.
+void handle_inotify(event_t *ev, uint32_t events) {
+  // The buffer is aligned for `struct inotify_event` as recommended by
+  // `inotify(7)`.
+  char buf[INOTIFY_BUFFER_SIZE]
+    __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  const struct inotify_event *iev;
+  ssize_t n;
+
+  (void) events;
+
+  while ((n = read(ev->fd, buf, sizeof(buf))) > 0) {
+    for (char *p = buf; p < buf + n; p += sizeof(*iev) + iev->len) {
+      iev = (const struct inotify_event *) p;
+
+      // If the kernel dropped events we can't know which configuration
+      // files changed, so the whole directory has to be read again.
+      if (iev->mask & IN_Q_OVERFLOW) {
+        pending_confdir = true;
+      } else if (iev->len > 0) {
+        add_pending_config(iev->name);
+      }
+    }
+  }
+
+  // The debounce timeout is only scheduled by the first change in a burst
+  // so that a steady stream of changes can't postpone their handling
+  // forever.
+  if ((pending_confdir || pending_configs_count > 0)
+      && !timeout_pending(&debounce_to)) {
+    schedule_timeout(&debounce_to, &CONFIG_DEBOUNCE_PERIOD);
+  }
+}
+
+// ### Note a changed configuration file
+// Adds the given configuration file name to the names we have to handle.
+// An event for the same file as the last one is most often part of the
+// same change, like the creation of a file followed by it being written
+// to, so we skip it. If we run out of room we give up on single files and
+// read the whole configuration directory again.
+void add_pending_config(const char *name) {
+  if (pending_confdir) {
+    return;
+  }
+
+  if (pending_configs_count > 0
+      && strcmp(pending_configs[pending_configs_count - 1], name) == 0) {
+    return;
+  }
+
+  if (pending_configs_count == PENDING_CONFIGS_MAX
+      || !safe_strcpy(pending_configs[pending_configs_count], name,
+                      sizeof(pending_configs[0]))) {
+    pending_confdir = true;
+    return;
+  }
+  pending_configs_count++;
+}
+
+// ### Handle debounced configuration changes
+// The handler for our debounce timeout. Reloads each of the changed
+// configuration files we have noted, or the whole configuration directory
+// if we couldn't keep track of them.
+void handle_debounce(timeout_t *to) {
+  (void) to;
+
+  if (pending_confdir) {
+    parse_confdir(confdir);
+    spawn_ready_children();
+  } else {
+    for (int i = 0; i < pending_configs_count; i++) {
+      reload_config(confdir, pending_configs[i]);
+    }
+    spawn_ready_children();
+  }
+
+  pending_configs_count = 0;
+  pending_confdir = false;
+}
+
+
+// Output capture
+// --------------
+
+// ### Setup output capture
+// Creates the pipe we use to copy output of children into their tails
+// and opens `/dev/null` for output we have nowhere else to put. We can't
+// capture any output without them so failure here is fatal.
+void setup_output(void) {
+  if (pipe2(output_tee, O_NONBLOCK | O_CLOEXEC) < 0) {
+    slog(LOG_ALERT, "Can't create output pipe: %m");
+    exit(EX_OSERR);
+  }
+
+  if ((devnull_fd = open("/dev/null", O_WRONLY | O_CLOEXEC)) < 0) {
+    slog(LOG_ALERT, "Can't open /dev/null: %m");
+    exit(EX_OSERR);
+  }
+}
+
+// ### Open output of a child
+// Makes sure the given child has a pipe for its standard output and
+// error and a log file to write them to before it is spawned. The pipe
+// lives as long as the child, so output of processes left behind by a
+// previous process of the child is captured as well. Returns false if the
+// child has no pipe and should inherit our output in stead.
+bool open_output(child_t *ch) {
+  // Output we have nowhere to write would be lost, so a child whose log
+  // file can't be opened inherits our output like it did before we
+  // captured it. Its log file is tried again the next time it's spawned.
+  // A pipe still written to by the previous process it's replacing is
+  // kept, and its log file is tried again every so often.
+  if (ch->log_fd < 0 && !open_output_log(ch, 0)) {
+    if (ch->rolling == NULL) {
+      close_output(ch);
+    }
+    return ch->output_ev.fd >= 0;
+  }
+
+  if (ch->output_ev.fd < 0) {
+    int fds[2];
+
+    // Only our end of the pipe is non-blocking. The child gets a plain
+    // blocking pipe, so a child writing faster than we can keep up with
+    // is held back without holding us back.
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+      slog(LOG_ERR, "Can't create output pipe for %s: %m", ch->name);
+      return false;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    ch->output_ev.fd = fds[0];
+    ch->output_wfd = fds[1];
+
+    if (!add_event(&ch->output_ev, EPOLLIN)) {
+      close_output(ch);
+      return false;
+    }
+  }
+  return true;
+}
+
+// ### Close output of a child
+// Captures what is left of the output of the given child before its pipe
+// and log file are closed.
+void close_output(child_t *ch) {
+  if (ch->output_ev.fd >= 0) {
+    // Inside a freshly forked child the output of its siblings is off
+    // limits.
+    if (epoll_fd >= 0) {
+      capture_output(ch);
+    }
+    remove_event(&ch->output_ev);
+    close(ch->output_ev.fd);
+    ch->output_ev.fd = -1;
+  }
+
+  if (ch->output_wfd >= 0) {
+    close(ch->output_wfd);
+    ch->output_wfd = -1;
+  }
+
+  close_output_log(ch);
+}
+
+// ### Handle output of a child
+// Called from our main loop when there is output to capture from the
+// child given as data of the event source.
+void handle_output(event_t *ev, uint32_t events) {
+  (void)events;
+
+  capture_output(ev->data);
+}
+
+// ### Capture output of a child
+// Moves output from the pipe of the given child to its tail and log file
+// one chunk at a time. Each chunk is first duplicated into our tail pipe
+// with `tee(2)` and then moved to the log file with `splice(2)`, so the
+// log file is written without the output ever being copied into our
+// memory. We stop after a few chunks so that a chatty child can't starve
+// other events. Any output left makes the pipe stay readable, and we come
+// back to it the next time around our main loop.
+void capture_output(child_t *ch) {
+  for (int i = 0; i < OUTPUT_BATCH_SIZE; i++) {
+    ssize_t n = tee(ch->output_ev.fd, output_tee[1], OUTPUT_CHUNK_SIZE,
+                    SPLICE_F_NONBLOCK);
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return;
+    }
+
+    keep_output_tail(ch, n);
+    write_output_log(ch, n);
+  }
+}
+
+// ### Keep the tail of output
+// Reads the last of the given number of bytes of output from our tail pipe
+// into the ring buffer of the given child, overwriting its oldest output.
+// Output which would be overwritten right away is discarded in the kernel.
+// Our tail pipe is shared by all children, so it's left empty no matter
+// what.
+void keep_output_tail(child_t *ch, size_t n) {
+  size_t skip = n > OUTPUT_TAIL_SIZE ? n - OUTPUT_TAIL_SIZE : 0;
+
+  while (skip > 0) {
+    ssize_t m = splice(output_tee[0], NULL, devnull_fd, NULL, skip,
+                       SPLICE_F_NONBLOCK);
+    if (m < 0 && errno == EINTR) {
+      continue;
+    }
+    if (m <= 0) {
+      discard_output_tee();
+      return;
+    }
+    skip -= m;
+  }
+
+  // We read into the ring buffer from where its output ends, wrapping
+  // around to its beginning.
+  size_t end = (ch->tail_start + ch->tail_len) % OUTPUT_TAIL_SIZE;
+  struct iovec iov[2] = {
+    { ch->tail + end, OUTPUT_TAIL_SIZE - end },
+    { ch->tail, end }
+  };
+  ssize_t m = readv(output_tee[0], iov, 2);
+
+  if (m > 0) {
+    ch->tail_len += m;
+    if (ch->tail_len > OUTPUT_TAIL_SIZE) {
+      ch->tail_start = (ch->tail_start + ch->tail_len - OUTPUT_TAIL_SIZE)
+                       % OUTPUT_TAIL_SIZE;
+      ch->tail_len = OUTPUT_TAIL_SIZE;
+    }
+  }
+  discard_output_tee();
+}
+
+// ### Discard the tail pipe
+// Reads whatever is left in our tail pipe into a scratch buffer and
+// throws it away. Output left behind would otherwise end up in the tail of
+// the next child to have output, and keep `tee(2)` from copying any more.
+void discard_output_tee(void) {
+  char buf[OUTPUT_TAIL_SIZE];
+
+  while (true) {
+    ssize_t m = read(output_tee[0], buf, sizeof(buf));
+
+    if (m < 0 && errno == EINTR) {
+      continue;
+    }
+    if (m <= 0) {
+      return;
+    }
+  }
+}
+
+// ### Write output to the log
+// Moves the given number of bytes of output from the pipe of the given
+// child to its log file, rotating the log file whenever it is full. If the
+// child has no log file, or writing to it fails, the output is discarded
+// so that the child is never held back by a log file it can't have. A
+// log file we don't have is opened again every so often, so a full disk
+// only costs the output written while it was full.
+void write_output_log(child_t *ch, size_t n) {
+  struct timespec now;
+
+  monotonic_now(&now);
+  if (ch->log_fd < 0 && !timespec_before(&now, &ch->log_retry_at)) {
+    open_output_log(ch, 0);
+  }
+
+  while (n > 0) {
+    int fd = devnull_fd;
+    size_t len = n;
+
+    if (ch->log_fd >= 0) {
+      if (ch->conf.log_size > 0 && ch->log_written >= ch->conf.log_size) {
+        rotate_output_log(ch);
+        continue;
+      }
+
+      fd = ch->log_fd;
+      if (ch->conf.log_size > 0
+          && (off_t)len > ch->conf.log_size - ch->log_written) {
+        len = ch->conf.log_size - ch->log_written;
+      }
+    }
+
+    ssize_t m = splice(ch->output_ev.fd, NULL, fd, NULL, len,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+    if (m < 0 && errno == EINTR) {
+      continue;
+    }
+    if (m <= 0) {
+      if (fd == ch->log_fd) {
+        slog(LOG_ERR, "Can't write output of %s to %s: %m",
+             ch->name, ch->conf.log);
+        close_output_log(ch);
+        retry_output_log(ch);
+        continue;
+      }
+      return;
+    }
+
+    if (fd == ch->log_fd) {
+      ch->log_written += m;
+    }
+    n -= m;
+  }
+}
+
+// ### Open the log file of a child
+// Opens the log file of the given child for writing at its end, creating
+// it if need be, with the given extra flags for `open(2)`. `splice(2)`
+// won't write to files opened for appending, so we rather seek to the end
+// of the file ourselves. A log file which can't be opened is tried again
+// after a while.
+bool open_output_log(child_t *ch, int flags) {
+  if ((ch->log_fd = open(ch->conf.log,
+                         O_WRONLY | O_CREAT | O_CLOEXEC | O_NOCTTY | flags,
+                         0640)) < 0) {
+    slog(LOG_ERR, "Can't open log %s of %s: %m", ch->conf.log, ch->name);
+    retry_output_log(ch);
+    return false;
+  }
+
+  if ((ch->log_written = lseek(ch->log_fd, 0, SEEK_END)) < 0) {
+    slog(LOG_ERR, "Can't seek in log %s of %s: %m", ch->conf.log, ch->name);
+    close_output_log(ch);
+    retry_output_log(ch);
+    return false;
+  }
+  return true;
+}
+
+// ### Retry the log file of a child
+// Has the log file of the given child, which we don't have, opened again
+// once `OUTPUT_LOG_RETRY` seconds have passed.
+void retry_output_log(child_t *ch) {
+  monotonic_now(&ch->log_retry_at);
+  ch->log_retry_at.tv_sec += OUTPUT_LOG_RETRY;
+}
+
+// ### Rotate the log file of a child
+// Renames the log file of the given child and its rotated log files so
+// that `name.log` becomes `name.log.1`, `name.log.1` becomes
+// `name.log.2`, and so on, with the oldest rotated log file replaced. A
+// child keeping no rotated log files starts over in its log file.
+void rotate_output_log(child_t *ch) {
+  char from[CHILD_PATH_SIZE + 16], to[CHILD_PATH_SIZE + 16];
+
+  close_output_log(ch);
+
+  for (int i = ch->conf.log_files; i > 0; i--) {
+    if (i > 1) {
+      snprintf(from, sizeof(from), "%s.%d", ch->conf.log, i - 1);
+    } else {
+      safe_strcpy(from, ch->conf.log, sizeof(from));
+    }
+    snprintf(to, sizeof(to), "%s.%d", ch->conf.log, i);
+
+    // Rotated log files we don't have yet are simply skipped.
+    if (rename(from, to) < 0 && errno != ENOENT) {
+      slog(LOG_ERR, "Can't rotate log %s to %s: %m", from, to);
+    }
+  }
+
+  // Should the log file still be around we start it over in stead of
+  // letting it grow past its size.
+  open_output_log(ch, O_TRUNC);
+}
+
+// ### Close the log file of a child
+// Closes the log file of the given child if it has one open.
+void close_output_log(child_t *ch) {
+  if (ch->log_fd >= 0) {
+    close(ch->log_fd);
+    ch->log_fd = -1;
+  }
+}
+
+// ### Tail of output
+// Copies as much of the last output of the given child as fits into the
+// given buffer of the given size and terminates it. Returns the number of
+// bytes copied.
+size_t output_tail(child_t *ch, char *buf, size_t size) {
+  size_t len = ch->tail_len < size - 1 ? ch->tail_len : size - 1;
+  size_t start = (ch->tail_start + ch->tail_len - len) % OUTPUT_TAIL_SIZE;
+
+  for (size_t i = 0; i < len; i++) {
+    buf[i] = ch->tail[(start + i) % OUTPUT_TAIL_SIZE];
+  }
+  buf[len] = '\0';
+  return len;
+}
+
+
+// Listening sockets
+// -----------------
+
+// ### Parse a listen address
+// Splits the given listen address into the family and type of its
+// socket, and its host or path, which is stored in the given buffer of
+// the given size, and its port, which is pointed into the address. An
+// address is `tcp:[host:]port`, `udp:[host:]port`, or `unix:/path`. A
+// missing host, or a `*`, is any address, and an IPv6 host is written
+// between brackets. Returns false if the address is malformed.
+bool parse_listen(const char *spec, int *family, int *type, char *host,
+                  size_t size, const char **port) {
+  const char *p, *sep;
+  size_t len;
+
+  if (strncmp(spec, "unix:", 5) == 0) {
+    // The path of a unix socket has to fit its address, and is absolute
+    // since we might be asked to remove it again from another directory.
+    p = spec + 5;
+    *family = AF_UNIX;
+    *type = SOCK_STREAM;
+    *port = NULL;
+    return p[0] == '/'
+           && strlen(p) < sizeof(((struct sockaddr_un *)0)->sun_path)
+           && safe_strcpy(host, p, size);
+  }
+
+  if (strncmp(spec, "tcp:", 4) == 0) {
+    *type = SOCK_STREAM;
+  } else if (strncmp(spec, "udp:", 4) == 0) {
+    *type = SOCK_DGRAM;
+  } else {
+    return false;
+  }
+  p = spec + 4;
+  *family = AF_UNSPEC;
+
+  // The port follows the last colon, unless the whole address is a port.
+  // Brackets around an IPv6 host keep its colons apart from the port.
+  if (p[0] == '[') {
+    if ((sep = strchr(p, ']')) == NULL || sep[1] != ':') {
+      return false;
+    }
+    len = sep - p - 1;
+    p++;
+    sep++;
+  } else if ((sep = strrchr(p, ':')) != NULL) {
+    len = sep - p;
+  } else {
+    len = 0;
+    sep = p - 1;
+  }
+  *port = sep + 1;
+
+  if (len >= size || strlen(*port) == 0
+      || strspn(*port, "0123456789") != strlen(*port)) {
+    return false;
+  }
+  memcpy(host, p, len);
+  host[len] = '\0';
+  if (strcmp(host, "*") == 0) {
+    host[0] = '\0';
+  }
+  return true;
+}
+
+// ### Open the listening sockets of a child
+// Makes sure the given child has a socket listening on each of the
+// addresses of its configuration. Sockets are only opened the first time
+// they are needed and are kept open from then on, so that connections
+// made while the child is down wait for it to come back up. Returns false
+// if any of them can't be opened.
+bool open_listeners(child_t *ch) {
+  for (int i = 0; i < ch->conf.listen_count; i++) {
+    if (ch->listen_fds[i] >= 0) {
+      continue;
+    }
+
+    if ((ch->listen_fds[i] = open_listener(ch->conf.listen[i],
+                                           ch->conf.instances > 1)) < 0) {
+      slog(LOG_ERR, "Can't listen on %s for %s: %m", ch->conf.listen[i],
+           ch->name);
+      return false;
+    }
+  }
+  return true;
+}
+
+// ### Open a listening socket
+// Opens a socket listening on the given address, which is shared with
+// other sockets if asked to. The socket is moved above the file
+// descriptors children get their sockets on, so that handing one socket
+// over never replaces another. Returns the file descriptor of the socket,
+// or -1 if it can't be opened.
+int open_listener(const char *spec, bool shared) {
+  char host[CHILD_LISTEN_SIZE + 1];
+  const char *port;
+  int family, type, fd, high_fd;
+
+  if (!parse_listen(spec, &family, &type, host, sizeof(host), &port)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (family == AF_UNIX) {
+    fd = bind_unix_listener(host, type);
+  } else {
+    fd = bind_inet_listener(host, port, type, shared);
+  }
+  if (fd < 0) {
+    return -1;
+  }
+
+  if ((type == SOCK_STREAM && listen(fd, LISTEN_BACKLOG) < 0)
+      || (high_fd = fcntl(fd, F_DUPFD_CLOEXEC, LISTEN_FD_MIN)) < 0) {
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  return high_fd;
+}
+
+// ### Bind a unix socket
+// Opens a unix socket of the given type bound to the given path. A socket
+// left behind at the path by an earlier run of ours is removed first,
+// while one somebody still listens on, and anything else there, is left
+// alone. Returns the file descriptor of the socket, or -1 if it can't be
+// bound.
+int bind_unix_listener(const char *path, int type) {
+  struct sockaddr_un addr;
+  int fd;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  safe_strcpy(addr.sun_path, path, sizeof(addr.sun_path));
+
+  if (!remove_stale_socket(path, type)) {
+    return -1;
+  }
+
+  if ((fd = socket(AF_UNIX, type | SOCK_CLOEXEC, 0)) < 0) {
+    return -1;
+  }
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// ### Bind an internet socket
+// Opens an internet socket of the given type bound to the given numeric
+// host and port. An empty host is any address. Every address the host
+// and port resolve to is tried in turn. A shared socket is bound along
+// with those of the other instances of its child, and the kernel spreads
+// connections between them. Returns the file descriptor of the socket, or
+// -1 if it can't be bound.
+int bind_inet_listener(const char *host, const char *port, int type,
+                       bool shared) {
+  struct addrinfo hints, *res, *ai;
+  int fd = -1, one = 1, err;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = type;
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+
+  // We never look up names, which could hang our main loop.
+  if ((err = getaddrinfo(host[0] != '\0' ? host : NULL, port, &hints,
+                         &res)) != 0) {
+    errno = err == EAI_SYSTEM ? errno : EINVAL;
+    return -1;
+  }
+
+  for (ai = res; ai != NULL; ai = ai->ai_next) {
+    if ((fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+                     ai->ai_protocol)) < 0) {
+      continue;
+    }
+
+    // A restarted supervisor binds the address again right away even with
+    // connections of its previous run lingering.
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (shared) {
+      setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    }
+    if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+      break;
+    }
+    err = errno;
+    close(fd);
+    fd = -1;
+    errno = err;
+  }
+  freeaddrinfo(res);
+  return fd;
+}
+
+// ### Keep listening sockets
+// Matches the listening sockets of the given child with the addresses of
+// the given new configuration of it. Sockets on addresses which are kept
+// stay open, so that no connection is refused through a reload, while
+// the others are closed. Sockets on new addresses are opened when the
+// child is spawned.
+void keep_listeners(child_t *ch, conf_t *conf) {
+  int fds[CHILD_LISTEN_MAX];
+
+  for (int i = 0; i < CHILD_LISTEN_MAX; i++) {
+    fds[i] = -1;
+  }
+
+  for (int i = 0; i < ch->conf.listen_count; i++) {
+    for (int j = 0; j < conf->listen_count && ch->listen_fds[i] >= 0; j++) {
+      if (fds[j] < 0 && strcmp(ch->conf.listen[i], conf->listen[j]) == 0) {
+        fds[j] = ch->listen_fds[i];
+        ch->listen_fds[i] = -1;
+      }
+    }
+  }
+
+  close_listeners(ch);
+  memcpy(ch->listen_fds, fds, sizeof(fds));
+}
+
+// ### Close the listening sockets of a child
+// Closes every listening socket the given child has open.
+void close_listeners(child_t *ch) {
+  for (int i = 0; i < ch->conf.listen_count; i++) {
+    if (ch->listen_fds[i] >= 0) {
+      close_listener(ch->conf.listen[i], ch->listen_fds[i]);
+      ch->listen_fds[i] = -1;
+    }
+  }
+}
+
+// ### Close a listening socket
+// Closes the given socket listening on the given address. The path of a
+// unix socket is removed as well, so that clients find nobody there in
+// stead of a stale socket. A child process of ours which failed to
+// execute its command line closes its copy without touching the path,
+// which is still ours.
+void close_listener(const char *spec, int fd) {
+  close(fd);
+
+  if (strncmp(spec, "unix:", 5) == 0 && epoll_fd >= 0) {
+    unlink(spec + 5);
+  }
+}
+
+
+// Control groups
+// --------------
+
+// ### Setup control groups
+// Opens the control group directory we were given, if any, and enables
+// the controllers the limits of children need below it. A controller
+// which isn't available to us only leaves its limits without effect, but
+// without a usable directory children run in our own control group.
+void setup_cgroups(void) {
+  const char *controllers[] = CGROUP_CONTROLLERS;
+  char buf[CGROUP_VALUE_SIZE];
+  int fd;
+
+  if (cgroup_root == NULL) {
+    return;
+  }
+
+  // Only a `cgroup2` directory has a `cgroup.subtree_control` file.
+  if ((cgroup_root_fd = open(cgroup_root,
+                             O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0
+      || (fd = openat(cgroup_root_fd, "cgroup.subtree_control",
+                      O_WRONLY | O_CLOEXEC)) < 0) {
+    slog(LOG_ERR, "Can't use %s for control groups: %m", cgroup_root);
+    if (cgroup_root_fd >= 0) {
+      close(cgroup_root_fd);
+      cgroup_root_fd = -1;
+    }
+    return;
+  }
+
+  for (size_t i = 0; i < sizeof(controllers) / sizeof(controllers[0]); i++) {
+    int len = snprintf(buf, sizeof(buf), "+%s", controllers[i]);
+
+    if (write(fd, buf, len) < 0) {
+      slog(LOG_WARNING, "Can't enable the %s controller in %s: %m",
+           controllers[i], cgroup_root);
+    }
+  }
+  close(fd);
+}
+
+// ### Open a control group
+// Makes sure the given child has a control group of its own when we have
+// a control group directory, with the limits of its configuration.
+// Processes left behind in it by an earlier process of the child, which
+// we can't have been draining, are killed. A previous process which is
+// being replaced is of course left alone. Returns false and logs the
+// error if the child can't have a control group.
+//
+// Control groups can't be renamed, so an instance which was renamed
+// keeps the control group named after its previous name until it's
+// empty.
+bool open_cgroup(child_t *ch) {
+  if (cgroup_root_fd < 0) {
+    return false;
+  }
+
+  if (ch->cgroup_fd >= 0 && strcmp(ch->cgroup_name, ch->name) != 0
+      && ch->rolling == NULL && !cgroup_populated(ch)) {
+    close_cgroup(ch);
+  }
+
+  if (ch->cgroup_fd < 0) {
+    strcpy(ch->cgroup_name, ch->name);
+    if ((mkdirat(cgroup_root_fd, ch->name, 0755) < 0 && errno != EEXIST)
+        || (ch->cgroup_fd = openat(cgroup_root_fd, ch->name,
+                                   O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+      slog(LOG_ERR, "Can't create control group for %s: %m", ch->name);
+      return false;
+    }
+
+    // Changes to `cgroup.events` are signalled as priority data.
+    if ((ch->cgroup_ev.fd = openat(ch->cgroup_fd, "cgroup.events",
+                                   O_RDONLY | O_CLOEXEC)) < 0
+        || !add_event(&ch->cgroup_ev, EPOLLPRI)) {
+      slog(LOG_ERR, "Can't watch control group of %s: %m", ch->name);
+      close_cgroup(ch);
+      return false;
+    }
+  }
+
+  set_cgroup_limits(ch);
+
+  if (ch->rolling == NULL && cgroup_populated(ch)) {
+    slog(LOG_WARNING, "Killing processes left behind in control group " \
+         "of %s", ch->name);
+    kill_cgroup(ch);
+  }
+  return true;
+}
+
+// ### Set control group limits
+// Writes the limits of the configuration of the given child to the files
+// of its control group, or lifts them when they're not configured. A
+// limit whose controller isn't enabled can't be written, which only
+// matters when the limit is configured.
+void set_cgroup_limits(child_t *ch) {
+  char io_weight[CGROUP_VALUE_SIZE];
+
+  if (ch->cgroup_fd < 0) {
+    return;
+  }
+
+  snprintf(io_weight, sizeof(io_weight), "default %ld",
+           ch->conf.io_weight > 0 ? ch->conf.io_weight : 100);
+
+  if (!write_cgroup_file(ch, "memory.max",
+                         str_not_empty(ch->conf.memory_max)
+                         ? ch->conf.memory_max : "max")
+      && str_not_empty(ch->conf.memory_max)) {
+    slog(LOG_WARNING, "Can't limit memory of %s: %m", ch->name);
+  }
+  if (!write_cgroup_file(ch, "cpu.max",
+                         str_not_empty(ch->conf.cpu_max)
+                         ? ch->conf.cpu_max : "max")
+      && str_not_empty(ch->conf.cpu_max)) {
+    slog(LOG_WARNING, "Can't limit processor time of %s: %m", ch->name);
+  }
+  if (!write_cgroup_file(ch, "io.weight", io_weight)
+      && ch->conf.io_weight > 0) {
+    slog(LOG_WARNING, "Can't weigh IO of %s: %m", ch->name);
+  }
+}
+
+// ### Write a control group file
+// Writes the given value to the file with the given name in the control
+// group of the given child. Returns false if it can't be written, leaving
+// the error in `errno`.
+bool write_cgroup_file(child_t *ch, const char *file, const char *value) {
+  int fd = openat(ch->cgroup_fd, file, O_WRONLY | O_CLOEXEC);
+
+  if (fd < 0) {
+    return false;
+  }
+
+  bool written = write(fd, value, strlen(value)) >= 0;
+  int err = errno;
+
+  close(fd);
+  errno = err;
+  return written;
+}
+
+// ### Join a control group
+// Moves the calling process into the control group of the given child if
+// it has one. Returns false if it can't be moved.
+bool join_cgroup(child_t *ch) {
+  return ch->cgroup_fd >= 0 && write_cgroup_file(ch, "cgroup.procs", "0");
+}
+
+// ### Control group populated
+// Check whether there are any processes left in the control group of the
+// given child, according to the `populated` line of its `cgroup.events`
+// file. Reading the file also acknowledges a change we've been told of.
+bool cgroup_populated(child_t *ch) {
+  char buf[CGROUP_VALUE_SIZE * 4];
+  ssize_t n;
+
+  if (ch->cgroup_ev.fd < 0
+      || (n = pread(ch->cgroup_ev.fd, buf, sizeof(buf) - 1, 0)) < 0) {
+    return false;
+  }
+  buf[n] = '\0';
+
+  char *line = strstr(buf, "populated ");
+
+  return line != NULL && line[strlen("populated ")] == '1';
+}
+
+// ### Kill a control group
+// Kills every process in the control group of the given child at once
+// with `cgroup.kill`, which also catches processes forking while they're
+// killed. A child being replaced shares its control group with its
+// previous process and is killed by signal like one without a control
+// group. Returns false if the child's processes have to be killed by
+// signal.
+bool kill_cgroup(child_t *ch) {
+  if (ch->cgroup_fd < 0 || ch->rolling != NULL) {
+    return false;
+  }
+
+  if (!write_cgroup_file(ch, "cgroup.kill", "1")) {
+    slog(LOG_WARNING, "Can't kill control group of %s: %m", ch->name);
+    return false;
+  }
+  return true;
+}
+
+// ### Drain a control group
+// Kills the processes left behind in the control group of the given child
+// by its terminated process. The child is draining until the control
+// group is no longer populated, and is settled by
+// `handle_cgroup_events()` then. Returns false if nothing was left behind,
+// or if it can't be killed, in which case the child can be settled right
+// away.
+bool drain_cgroup(child_t *ch) {
+  if (ch->rolling != NULL || !cgroup_populated(ch)) {
+    return false;
+  }
+
+  slog(LOG_NOTICE, "Killing processes left behind by %s", ch->name);
+  if (!kill_cgroup(ch)) {
+    return false;
+  }
+
+  ch->draining = true;
+  draining_count++;
+  return true;
+}
+
+// ### Handle control group events
+// The event handler for the `cgroup.events` file of the control group of
+// a child. A draining child is settled once its control group is no longer
+// populated.
+void handle_cgroup_events(event_t *ev, uint32_t events) {
+  child_t *ch = ev->data;
+
+  (void) events;
+
+  if (cgroup_populated(ch) || !ch->draining) {
+    return;
+  }
+
+  ch->draining = false;
+  draining_count--;
+  settle_child(ch);
+
+  // The last child to be drained during a shutdown lets us exit.
+  finish_shutdown();
+}
+
+// ### Close a control group
+// Stops watching the control group of the given child and removes it,
+// which fails harmlessly while processes are left in it. A child
+// process which failed to execute leaves the control group to its parent.
+void close_cgroup(child_t *ch) {
+  if (ch->cgroup_ev.fd >= 0) {
+    remove_event(&ch->cgroup_ev);
+    close(ch->cgroup_ev.fd);
+    ch->cgroup_ev.fd = -1;
+  }
+
+  if (ch->draining) {
+    ch->draining = false;
+    draining_count--;
+  }
+
+  if (ch->cgroup_fd >= 0) {
+    close(ch->cgroup_fd);
+    ch->cgroup_fd = -1;
+    if (epoll_fd >= 0) {
+      unlinkat(cgroup_root_fd, ch->cgroup_name, AT_REMOVEDIR);
+    }
+  }
+}
+
+
+// Control socket
+// --------------
+
+// ### Setup control socket
+// Listens for connections on a Unix socket at the given path through which
+// we can be asked about our children and told what to do with them. Only
+// our own user can connect to it. We can supervise without it, so failure
+// here is only logged.
+void setup_control(const char *path) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+  for (int i = 0; i < CONTROL_CONNECTIONS_MAX; i++) {
+    control_conns[i].ev.fd = -1;
+  }
+
+  if (!safe_strcpy(addr.sun_path, path, sizeof(addr.sun_path))) {
+    slog(LOG_ERR, "Control socket path %s is too long (max: %d)",
+         path, sizeof(addr.sun_path)-1);
+    return;
+  }
+
+  // A socket left behind by a previous run of ours is in our way, while
+  // one still listened on belongs to somebody else.
+  if (!remove_stale_socket(path, SOCK_STREAM)) {
+    slog(LOG_ERR, "Can't listen on control socket %s: %m", path);
+    return;
+  }
+
+  if ((control_ev.fd = socket(AF_UNIX,
+                              SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                              0)) < 0) {
+    slog(LOG_ERR, "Can't create control socket: %m");
+    return;
+  }
+
+  // The socket is created without permissions for anyone but us.
+  mode_t mask = umask(0077);
+  int err = bind(control_ev.fd, (struct sockaddr *)&addr, sizeof(addr));
+  umask(mask);
+
+  if (err < 0 || listen(control_ev.fd, CONTROL_CONNECTIONS_MAX) < 0) {
+    slog(LOG_ERR, "Can't listen on control socket %s: %m", path);
+    close(control_ev.fd);
+    control_ev.fd = -1;
+    return;
+  }
+
+  if (!add_event(&control_ev, EPOLLIN)) {
+    close_control();
+  }
+}
+
+// ### Close control socket
+// Stops listening on our control socket and removes it. Called at normal
+// process termination.
+void close_control(void) {
+  if (control_ev.fd >= 0) {
+    remove_event(&control_ev);
+    close(control_ev.fd);
+    control_ev.fd = -1;
+    unlink(control_path);
+  }
+}
+
+// ### Handle control connections
+// Called from our main loop when there are connections to accept on our
+// control socket. Each connection gets a free slot of ours, and a
+// connection we have no slot for is closed right away.
+void handle_control(event_t *ev, uint32_t events) {
+  int fd;
+
+  (void)events;
+
+  while ((fd = accept4(ev->fd, NULL, NULL,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    control_conn_t *conn = NULL;
+
+    for (int i = 0; i < CONTROL_CONNECTIONS_MAX; i++) {
+      if (control_conns[i].ev.fd < 0) {
+        conn = &control_conns[i];
+        break;
+      }
+    }
+
+    if (conn == NULL) {
+      slog(LOG_WARNING, "Too many control connections (max: %d)",
+           CONTROL_CONNECTIONS_MAX);
+      close(fd);
+      continue;
+    }
+
+    conn->ev.fd = fd;
+    conn->ev.handler = handle_control_conn;
+    conn->ev.data = conn;
+    conn->in_len = conn->out_len = conn->out_sent = 0;
+    conn->cursor = NULL;
+    conn->streaming = conn->writing = false;
+
+    if (!add_event(&conn->ev, EPOLLIN)) {
+      close(fd);
+      conn->ev.fd = -1;
+    }
+  }
+}
+
+// ### Handle a control connection
+// Called from our main loop when the control connection given as data of
+// the event source has a request for us to read or room for more of our
+// reply.
+void handle_control_conn(event_t *ev, uint32_t events) {
+  control_conn_t *conn = ev->data;
+
+  (void)events;
+
+  if (conn->writing) {
+    write_control(conn);
+  } else {
+    read_control(conn);
+  }
+}
+
+// ### Read control requests
+// Reads what we have room for from the given control connection and
+// serves the request once we have all of it. A connection closed by the
+// client, or broken, is closed by us as well.
+void read_control(control_conn_t *conn) {
+  ssize_t n = read(conn->ev.fd, conn->in + conn->in_len,
+                   sizeof(conn->in) - conn->in_len);
+
+  if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+    return;
+  }
+  if (n <= 0) {
+    close_control_conn(conn);
+    return;
+  }
+
+  conn->in_len += n;
+  serve_control(conn);
+}
+
+// ### Serve a control request
+// Handles the first request read from the given control connection if we
+// have all of it and starts sending its reply. A request which could never
+// fit a frame closes the connection.
+void serve_control(control_conn_t *conn) {
+  uint32_t len;
+
+  if (conn->ev.fd < 0 || conn->in_len < CONTROL_LENGTH_SIZE) {
+    return;
+  }
+
+  memcpy(&len, conn->in, CONTROL_LENGTH_SIZE);
+  len = ntohl(len);
+
+  if (len == 0 || len > CONTROL_FRAME_SIZE - CONTROL_LENGTH_SIZE) {
+    close_control_conn(conn);
+    return;
+  }
+  if (conn->in_len < CONTROL_LENGTH_SIZE + len) {
+    return;
+  }
+
+  handle_control_request(conn, conn->in + CONTROL_LENGTH_SIZE, len);
+
+  // Any request sent right after this one is kept for when we're done
+  // replying.
+  conn->in_len -= CONTROL_LENGTH_SIZE + len;
+  memmove(conn->in, conn->in + CONTROL_LENGTH_SIZE + len, conn->in_len);
+
+  write_control(conn);
+}
+
+// ### Handle a control request
+// Does what the given request of the given length asks for and queues its
+// reply on the given control connection. Every request but those for the
+// status of all children and a reload must name a child we know.
+void handle_control_request(control_conn_t *conn, const char *req,
+                            size_t len) {
+  char name[INSTANCE_NAME_SIZE + 1];
+  child_t *ch = NULL;
+
+  if (len > 1) {
+    if (len - 1 > INSTANCE_NAME_SIZE) {
+      queue_control_reply(conn, CONTROL_REPLY_ERROR, "No such child");
+      return;
+    }
+    memcpy(name, req + 1, len - 1);
+    name[len - 1] = '\0';
+
+    if ((ch = find_child(name)) == NULL) {
+      queue_control_reply(conn, CONTROL_REPLY_ERROR, "No such child");
+      return;
+    }
+  } else if (req[0] != CONTROL_STATUS && req[0] != CONTROL_RELOAD) {
+    queue_control_reply(conn, CONTROL_REPLY_ERROR, "Missing child name");
+    return;
+  }
+
+  switch (req[0]) {
+    case CONTROL_STATUS:
+      // The status of a single child comes with its last terminations and
+      // the last of its output,
+      // while the status of all children is built as it is sent.
+      if (ch != NULL) {
+        queue_control_child(conn, ch);
+        queue_control_history(conn, ch);
+        queue_control_output(conn, ch);
+        break;
+      }
+      conn->cursor = head_ch;
+      conn->streaming = true;
+      fill_control_status(conn);
+      return;
+
+    case CONTROL_START:
+      slog(LOG_NOTICE, "Starting %s on request", ch->name);
+      start_child(ch);
+      break;
+
+    case CONTROL_STOP:
+      slog(LOG_NOTICE, "Stopping %s on request", ch->name);
+      stop_child(ch);
+      break;
+
+    case CONTROL_RESTART:
+      slog(LOG_NOTICE, "Restarting %s on request", ch->name);
+      if (ch->stopped) {
+        start_child(ch);
+      } else {
+        restart_child(ch);
+      }
+      break;
+
+    case CONTROL_RELOAD:
+      slog(LOG_NOTICE, "Reloading configuration on request");
+      reload_confdir();
+      break;
+
+    default:
+      queue_control_reply(conn, CONTROL_REPLY_ERROR, "Unknown request");
+      return;
+  }
+
+  queue_control_reply(conn, CONTROL_REPLY_DONE, NULL);
+}
+
+// ### Fill status of all children
+// Queues the status of as many children as there is room for on the given
+// control connection, continuing from the child it has come to, and ends
+// the reply when all of them are queued.
+void fill_control_status(control_conn_t *conn) {
+  while (conn->cursor != NULL) {
+    if (!queue_control_child(conn, conn->cursor)) {
+      return;
+    }
+    conn->cursor = conn->cursor->next;
+  }
+
+  if (queue_control_reply(conn, CONTROL_REPLY_DONE, NULL)) {
+    conn->streaming = false;
+  }
+}
+
+// ### Queue a control frame
+// Queues a frame with the given body of the given length on the given
+// control connection. Returns false if there is no room for it.
+bool queue_control_frame(control_conn_t *conn, const char *body, size_t len) {
+  if (conn->out_len + CONTROL_LENGTH_SIZE + len > sizeof(conn->out)) {
+    return false;
+  }
+
+  put_control_number(conn->out + conn->out_len, len);
+  memcpy(conn->out + conn->out_len + CONTROL_LENGTH_SIZE, body, len);
+  conn->out_len += CONTROL_LENGTH_SIZE + len;
+  return true;
+}
+
+// ### Queue status of a child
+// Queues a child frame with the status of the given child on the given
+// control connection. The number of seconds is the uptime of a child
+// with a process, and what is left of the quarantine of a quarantined
+// child. Returns false if there is no room for it.
+bool queue_control_child(control_conn_t *conn, child_t *ch) {
+  char body[CONTROL_CHILD_NAME + INSTANCE_NAME_SIZE];
+  int state = control_state(ch);
+  long seconds = 0;
+
+  if (ch->pid > 0) {
+    seconds = seconds_since(&ch->up_at);
+  } else if (state == CONTROL_STATE_QUARANTINED
+             && timeout_pending(&ch->quarantine_to)) {
+    seconds = -seconds_since(&ch->quarantine_to.at);
+  }
+
+  size_t name_len = strlen(ch->name);
+
+  body[0] = CONTROL_REPLY_CHILD;
+  put_control_number(body + CONTROL_CHILD_PID, ch->pid);
+  body[CONTROL_CHILD_STATE] = state;
+  put_control_number(body + CONTROL_CHILD_SECONDS, seconds);
+  put_control_number(body + CONTROL_CHILD_QUARANTINES, ch->quarantines);
+  memcpy(body + CONTROL_CHILD_NAME, ch->name, name_len);
+
+  return queue_control_frame(conn, body, CONTROL_CHILD_NAME + name_len);
+}
+
+// ### Queue history of a child
+// Queues an exit frame for each termination of the given child we
+// remember on the given control connection, from the oldest to the most
+// recent one. Returns false if there is no room for them.
+bool queue_control_history(control_conn_t *conn, child_t *ch) {
+  char body[CONTROL_EXIT_SIZE];
+
+  for (size_t i = 0; i < ch->history_len; i++) {
+    exit_record_t *rec =
+      &ch->history[(ch->history_start + i) % EXIT_HISTORY_SIZE];
+
+    body[0] = CONTROL_REPLY_EXIT;
+    put_control_number(body + CONTROL_EXIT_AGO, seconds_since(&rec->at));
+    put_control_number(body + CONTROL_EXIT_UPTIME, rec->uptime);
+    put_control_number(body + CONTROL_EXIT_STATUS, rec->status);
+    put_control_number(body + CONTROL_EXIT_MAXRSS, rec->maxrss);
+    put_control_number(body + CONTROL_EXIT_USER,
+                       rec->utime.tv_sec * 1000 + rec->utime.tv_usec / 1000);
+    put_control_number(body + CONTROL_EXIT_SYS,
+                       rec->stime.tv_sec * 1000 + rec->stime.tv_usec / 1000);
+
+    if (!queue_control_frame(conn, body, sizeof(body))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// ### Queue output of a child
+// Queues an output frame with as much of the last output of the given
+// child as fits a frame on the given control connection. Returns false if
+// there is no room for it.
+bool queue_control_output(control_conn_t *conn, child_t *ch) {
+  char body[CONTROL_FRAME_SIZE - CONTROL_LENGTH_SIZE];
+
+  body[0] = CONTROL_REPLY_OUTPUT;
+  size_t len = output_tail(ch, body + 1, sizeof(body) - 1);
+
+  return queue_control_frame(conn, body, 1 + len);
+}
+
+// ### Queue a control reply
+// Queues a frame of the given kind with the given text, if any, on the
+// given control connection. Returns false if there is no room for it.
+bool queue_control_reply(control_conn_t *conn, int kind, const char *text) {
+  char body[CONTROL_FRAME_SIZE - CONTROL_LENGTH_SIZE];
+  size_t len = 0;
+
+  body[0] = kind;
+  if (text != NULL) {
+    len = strlen(text);
+    memcpy(body + 1, text, len);
+  }
+
+  return queue_control_frame(conn, body, 1 + len);
+}
+
+// ### Put a number in a control frame
+// Stores the given number at the given place in a frame as 32 bits in
+// network byte order.
+void put_control_number(char *p, uint32_t n) {
+  n = htonl(n);
+  memcpy(p, &n, sizeof(n));
+}
+
+// ### State of a child
+// Returns the state of the given child as reported through our control
+// socket. A child which is neither stopped nor has a process is waiting
+// for its quarantine to end.
+int control_state(child_t *ch) {
+  if (ch->stopped) {
+    return ch->pid > 0 || ch->draining ? CONTROL_STATE_STOPPING
+                                       : CONTROL_STATE_STOPPED;
+  }
+  if (ch->restarting || ch->rolling != NULL || ch->draining) {
+    return CONTROL_STATE_RESTARTING;
+  }
+  if (ch->pid > 0) {
+    return CONTROL_STATE_RUNNING;
+  }
+  if (ch->quarantined && !timeout_pending(&ch->quarantine_to)) {
+    return CONTROL_STATE_WAITING;
+  }
+  return CONTROL_STATE_QUARANTINED;
+}
+
+// ### Write control replies
+// Sends as much of the reply queued on the given control connection as it
+// accepts. The status of more children is queued as the reply is sent.
+// If the client can't keep up we wait for the connection to become
+// writable. Once the whole reply is sent we go back to reading requests.
+void write_control(control_conn_t *conn) {
+  while (conn->out_sent < conn->out_len) {
+    ssize_t n = send(conn->ev.fd, conn->out + conn->out_sent,
+                     conn->out_len - conn->out_sent, MSG_NOSIGNAL);
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && errno == EAGAIN) {
+      if (!conn->writing) {
+        conn->writing = modify_event(&conn->ev, EPOLLOUT);
+      }
+      return;
+    }
+    if (n < 0) {
+      close_control_conn(conn);
+      return;
+    }
+
+    conn->out_sent += n;
+
+    if (conn->out_sent == conn->out_len && conn->streaming) {
+      conn->out_len = conn->out_sent = 0;
+      fill_control_status(conn);
+    }
+  }
+
+  conn->out_len = conn->out_sent = 0;
+  if (conn->writing) {
+    conn->writing = false;
+    modify_event(&conn->ev, EPOLLIN);
+  }
+
+  serve_control(conn);
+}
+
+// ### Close a control connection
+// Closes the given control connection and frees its slot.
+void close_control_conn(control_conn_t *conn) {
+  remove_event(&conn->ev);
+  close(conn->ev.fd);
+  conn->ev.fd = -1;
+  conn->cursor = NULL;
+  conn->streaming = conn->writing = false;
+}
+
+// ### Forget a child
+// Moves any control connection in the middle of sending the status of
+// the given child on to the next child, since the given child is about
+// to be freed.
+void forget_control_child(child_t *ch) {
+  for (int i = 0; i < CONTROL_CONNECTIONS_MAX; i++) {
+    if (control_conns[i].cursor == ch) {
+      control_conns[i].cursor = ch->next;
+    }
+  }
+}
+
+
+// Readiness notification
+// ----------------------
+
+// ### Setup readiness notification
+// Creates the datagram socket children tell us that they're ready
+// through, in the abstract namespace so that there is no file to clean
+// up. Anyone can send to it, so we ask the kernel for the credentials of
+// the sender of each datagram and only listen to our own children.
+// Without it children are never ready before their ready timeout.
+void setup_notify(void) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  int on = 1;
+
+  snprintf(notify_path, sizeof(notify_path), NOTIFY_PATH_FORMAT, getpid());
+
+  // The leading `@` of the name stands for the null byte which starts an
+  // address in the abstract namespace.
+  size_t len = strlen(notify_path);
+  memcpy(addr.sun_path + 1, notify_path + 1, len - 1);
+  socklen_t addr_len = offsetof(struct sockaddr_un, sun_path) + len;
+
+  if ((notify_ev.fd = socket(AF_UNIX,
+                             SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                             0)) < 0
+      || setsockopt(notify_ev.fd, SOL_SOCKET, SO_PASSCRED, &on,
+                    sizeof(on)) < 0
+      || bind(notify_ev.fd, (struct sockaddr *)&addr, addr_len) < 0) {
+    slog(LOG_ERR, "Can't listen for readiness on %s: %m", notify_path);
+  } else if (add_event(&notify_ev, EPOLLIN)) {
+    return;
+  }
+
+  if (notify_ev.fd >= 0) {
+    close(notify_ev.fd);
+    notify_ev.fd = -1;
+  }
+  notify_path[0] = '\0';
+}
+
+// ### Handle readiness notifications
+// The event handler for our readiness socket. We read every datagram
+// waiting, look up the child whose process sent it, and look for a
+// `READY=1` line in it. Other lines are ignored, as are file descriptors
+// sent along which we close right away.
+void handle_notify(event_t *ev, uint32_t events) {
+  char buf[NOTIFY_BUFFER_SIZE];
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(struct ucred))
+             + CMSG_SPACE(NOTIFY_FDS_MAX * sizeof(int))];
+  } control;
+
+  (void) events;
+
+  while (true) {
+    struct iovec iov = { buf, sizeof(buf) - 1 };
+    struct msghdr msg = {
+      .msg_iov = &iov, .msg_iovlen = 1,
+      .msg_control = control.buf, .msg_controllen = sizeof(control.buf)
+    };
+    ssize_t n = recvmsg(ev->fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    pid_t pid = 0;
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return;
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level != SOL_SOCKET) {
+        continue;
+      }
+
+      if (cmsg->cmsg_type == SCM_CREDENTIALS) {
+        struct ucred cred;
+
+        memcpy(&cred, CMSG_DATA(cmsg), sizeof(cred));
+        pid = cred.pid;
+      } else if (cmsg->cmsg_type == SCM_RIGHTS) {
+        size_t fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+        for (size_t i = 0; i < fds; i++) {
+          int fd;
+
+          memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+          close(fd);
+        }
+      }
+    }
+
+    // A datagram which didn't fit our buffer is no notification of ours,
+    // and neither is one from a process checking a child.
+    child_t *ch = find_child_by_pid(pid);
+
+    if (ch == NULL || ch->removed || pid != ch->pid
+        || (msg.msg_flags & MSG_TRUNC)) {
+      continue;
+    }
+
+    buf[n] = '\0';
+    for (char *line, *rest = buf; (line = strsep(&rest, "\n")) != NULL;) {
+      if (strcmp(line, "READY=1") == 0) {
+        child_ready(ch);
+      }
+    }
+  }
+}
+
+// ### Child ready
+// Notes that the process of the given child is ready. A replacement
+// which is ready takes over from the previous process of its child.
+void child_ready(child_t *ch) {
+  if (ch->ready) {
+    return;
+  }
+
+  ch->ready = true;
+  slog(LOG_INFO, "%s ready after: %lds", ch->name, seconds_since(&ch->up_at));
+  finish_start(ch, true);
+  finish_rolling(ch);
+}
+
+// ### Handle ready timeout
+// The handler for the ready timeout of a child. Its replacement didn't
+// tell us it's ready in time, or can't tell us at all, so it takes over
+// from the previous process of the child anyway.
+void handle_ready_timeout(timeout_t *to) {
+  child_t *ch = to->data;
+
+  if (ch->conf.notify && ch->rolling != NULL) {
+    slog(LOG_WARNING, "Replacement of %s not ready within %lds, " \
+         "replacing its previous process anyway", ch->name,
+         ch->conf.ready_timeout);
+  }
+  finish_rolling(ch);
+}
+
+
+// Children handling
+// -----------------
+
+// ### Append child
+// Adds the given child to the tail of the global linked list of children
+// and to our index of children by name.
+void append_child(child_t *ch) {
+  ch->prev = tail_ch;
+  ch->next = NULL;
+
+  if (tail_ch) {
+    // If we have a non-null tail child we add this child after it.
+    tail_ch->next = ch;
+  } else {
+    // If we don't have a tail child, this child is shall be the
+    // head of the global linked list.
+    head_ch = ch;
+  }
+  // This child is now the new tail of the global linked list of
+  // children.
+  tail_ch = ch;
+
+  index_name(ch);
+}
+
+// ### Remove child
+// Removes the given child from the global linked list of children and our
+// index of children by name, and frees it. A child with a process is
+// moved to our list of removed children in stead, and is freed once its
+// process has been terminated and reaped.
+void remove_child(child_t *ch) {
+  if (ch->prev) {
+    // If we have a child before this child in the global linked list
+    // we point that to the child after this one. If this is the
+    // last child the child before this will be the new last child.
+    ch->prev->next = ch->next;
+  } else {
+    // If this child is the first in the global linked list we point
+    // our global head pointer to the child after this one. If this is
+    // the first and last child, the head pointer will be null.
+    head_ch = ch->next;
+  }
+
+  // The same goes for the child after this one and the tail pointer.
+  if (ch->next) {
+    ch->next->prev = ch->prev;
+  } else {
+    tail_ch = ch->prev;
+  }
+
+  // The child can no longer be found by its name. A previous process it
+  // was being replaced with goes as well.
+  unindex_name(ch);
+  finish_rolling(ch);
+
+  // Nobody is listening on its addresses any more.
+  close_listeners(ch);
+
+  // Without a process, or processes it left behind, we make sure to free
+  // the memory its structure took up on the heap right away. A process
+  // which was checking it has to be reaped first.
+  if (ch->pid == 0 && !ch->draining && ch->check_pid == 0) {
+    cleanup_child(ch);
+    return;
+  }
+
+  // We terminate the child process since it no longer has a
+  // configuration file. The child stays in our process id index and keeps
+  // its process file descriptor so that it's reaped like any other, is
+  // killed if it doesn't terminate in time, and holds up a shutdown until
+  // it has terminated.
+  ch->removed = true;
+  ch->restarting = false;
+  add_removed_child(ch);
+  kill_child(ch);
+}
+
+// ### Add a removed child
+// Adds the given child, whose process has yet to be reaped, to the head of
+// our list of removed children.
+void add_removed_child(child_t *ch) {
+  ch->prev = NULL;
+  ch->next = removed_ch;
+  if (removed_ch) {
+    removed_ch->prev = ch;
+  }
+  removed_ch = ch;
+}
+
+// ### Drop a removed child
+// Removes the given child from our list of removed children once its
+// process has been reaped, and frees it. A process still checking it is
+// killed, and the child is only dropped once that has been reaped as
+// well, by `reap_check()`, so that we never wait for it.
+void drop_removed_child(child_t *ch) {
+  if (ch->check_pid > 0) {
+    stop_check(ch);
+    return;
+  }
+
+  if (ch->prev) {
+    ch->prev->next = ch->next;
+  } else {
+    removed_ch = ch->next;
+  }
+  if (ch->next) {
+    ch->next->prev = ch->prev;
+  }
+
+  cleanup_child(ch);
+}
+
+// ### Child spawned recently
+// Check whether a child was last spawned less than the given number
+// of seconds ago.
+bool child_recently_spawned(child_t *ch, int seconds_ago) {
+  // We have to check that the child has been spawned before, indicated by
+  // a non-zero `up_at` since it is zeroed when a child is initialized,
+  // and that less than the given number of seconds has passed since.
+  return ch->up_at.tv_sec > 0 && seconds_since(&ch->up_at) < seconds_ago;
+}
+
+// ### Restart child
+// Restarts the given child. A running child is terminated and respawned by
+// `reap_child()` when it has terminated, or replaced by a new process
+// first if it's restarted by rolling, while a quarantined child is
+// spawned right away.
+void restart_child(child_t *ch) {
+  // A replacement in the middle of taking over is restarted like any
+  // other process once its previous process is on its way out.
+  finish_rolling(ch);
+
+  if (ch->pid > 0 && ch->conf.rolling && !shutting_down) {
+    roll_child(ch);
+  } else if (ch->pid > 0) {
+    ch->restarting = true;
+    kill_child(ch);
+  } else if (ch->quarantined) {
+    spawn_child(ch);
+  }
+}
+
+// ### Roll a child
+// Restarts the given child without a gap by starting a replacement while
+// its previous process keeps running. The previous process is terminated
+// once the replacement is ready, or once its ready timeout has passed. A
+// replacement which can't be started at all leaves the child with its
+// previous process, just like one which terminates before it's ready.
+void roll_child(child_t *ch) {
+  struct timespec timeout = { ch->conf.ready_timeout, 0 };
+
+  slog(LOG_NOTICE, "Starting replacement of %s", ch->name);
+  retire_child_process(ch);
+  spawn_child(ch);
+
+  // The previous process is still up, so the child isn't quarantined.
+  if (ch->pid == 0) {
+    slog(LOG_WARNING, "Replacement of %s could not be started, keeping " \
+         "its previous process", ch->name);
+    ch->quarantined = false;
+    cancel_timeout(&ch->quarantine_to);
+    adopt_child_process(ch);
+    return;
+  }
+  schedule_timeout(&ch->ready_to, &timeout);
+}
+
+// ### Finish rolling
+// Terminates the previous process of the given child, if it's being
+// replaced, now that its replacement has taken over.
+void finish_rolling(child_t *ch) {
+  child_t *old = ch->rolling;
+
+  cancel_timeout(&ch->ready_to);
+  if (old == NULL) {
+    return;
+  }
+
+  ch->rolling = old->rolling = NULL;
+  kill_child(old);
+}
+
+// ### Retire a child process
+// Hands the running process of the given child over to a copy of the child
+// in our list of removed children, which is reaped from there. The copy
+// doesn't own the output pipe or log file, which the previous process
+// keeps writing to along with its replacement, nor the listening sockets,
+// which they share. Returns the copy.
+child_t *retire_child_process(child_t *ch) {
+  child_t *old = safe_alloc(sizeof(child_t));
+
+  cancel_timeout(&ch->kill_to);
+  cancel_timeout(&ch->ready_to);
+  finish_start(ch, true);
+  close_proc_files(ch);
+  stop_check(ch);
+  *old = *ch;
+
+  old->pidfd_ev.data = old;
+  old->output_ev.fd = old->output_wfd = old->log_fd = -1;
+  for (int i = 0; i < CHILD_LISTEN_MAX; i++) {
+    old->listen_fds[i] = -1;
+  }
+  old->cgroup_fd = old->cgroup_ev.fd = old->check_ev.fd = -1;
+  old->check_pid = 0;
+  old->quarantine_to.data = old->kill_to.data = old->ready_to.data = old;
+  old->start_to.data = old->check_to.data = old->check_ev.data = old;
+  old->pidfile_to.data = old;
+  old->removed = old->replaced = true;
+  old->restarting = old->stopped = false;
+  old->rolling = ch;
+  ch->rolling = old;
+
+  // The process id and process file descriptor now belong to the copy.
+  unindex_pid(ch->pid);
+  index_pid(old, old->pid);
+  if (old->pidfd_ev.fd >= 0) {
+    modify_event(&old->pidfd_ev, EPOLLIN);
+  }
+  ch->pid = 0;
+  ch->session = 0;
+  ch->pidfd_ev.fd = -1;
+
+  add_removed_child(old);
+  return old;
+}
+
+// ### Adopt a child process
+// Takes the previous process of the given child back from the copy it
+// was handed over to, after its replacement failed, and frees the copy.
+void adopt_child_process(child_t *ch) {
+  child_t *old = ch->rolling;
+
+  ch->rolling = old->rolling = NULL;
+  ch->pid = old->pid;
+  ch->session = old->session;
+  ch->up_at = old->up_at;
+  ch->ready = old->ready;
+  ch->pidfd_ev.fd = old->pidfd_ev.fd;
+
+  unindex_pid(old->pid);
+  index_pid(ch, ch->pid);
+
+  // Events of the process file descriptor are delivered to the child from
+  // now on, and those already delivered to the copy are dropped before
+  // it's freed.
+  if (ch->pidfd_ev.fd >= 0) {
+    forget_ready_events(&old->pidfd_ev);
+    modify_event(&ch->pidfd_ev, EPOLLIN);
+  }
+  old->pid = 0;
+  old->session = 0;
+  old->pidfd_ev.fd = -1;
+
+  drop_removed_child(old);
+  schedule_check(ch);
+}
+
+// ### Start a child
+// Spawns the given child right away unless it has a process already,
+// whether it was stopped or waiting for its quarantine to end. A stopped
+// child is supervised again.
+void start_child(child_t *ch) {
+  ch->stopped = false;
+
+  if (ch->pid == 0 && !ch->draining) {
+    ch->quarantines = 0;
+    spawn_child(ch);
+  }
+}
+
+// ### Stop a child
+// Terminates the process of the given child, if it has one, and leaves it
+// down until it is started again. A stopped child stays stopped through
+// changes to its configuration.
+void stop_child(child_t *ch) {
+  finish_rolling(ch);
+  ch->stopped = true;
+  ch->restarting = false;
+  ch->quarantined = false;
+  cancel_timeout(&ch->quarantine_to);
+  kill_child(ch);
+}
+
+// ### Restart allowed
+// Checks whether the restart policy of the given child allows it to be
+// respawned after terminating with the given status as returned by
+// `waitpid(3)`. Only an exit with a zero exit status is a success.
+bool restart_allowed(child_t *ch, int status) {
+  switch (ch->conf.restart) {
+    case RESTART_NEVER:
+      return false;
+    case RESTART_ON_FAILURE:
+      return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    default:
+      return true;
+  }
+}
+
+// ### Remember an exit
+// Records the termination of a process of the given child with the given
+// status and uptime, and the given resources used if we know them, in
+// the history of the child. The oldest record is overwritten when the
+// history is full. Returns the new record.
+exit_record_t *remember_exit(child_t *ch, int status, long uptime,
+                             const struct rusage *usage) {
+  size_t i = (ch->history_start + ch->history_len) % EXIT_HISTORY_SIZE;
+  exit_record_t *rec = &ch->history[i];
+
+  if (ch->history_len < EXIT_HISTORY_SIZE) {
+    ch->history_len++;
+  } else {
+    ch->history_start = (ch->history_start + 1) % EXIT_HISTORY_SIZE;
+  }
+
+  memset(rec, 0, sizeof(*rec));
+  monotonic_now(&rec->at);
+  rec->uptime = uptime;
+  rec->status = status;
+  if (usage != NULL) {
+    rec->maxrss = usage->ru_maxrss;
+    rec->utime = usage->ru_utime;
+    rec->stime = usage->ru_stime;
+  }
+  return rec;
+}
+
+// ### Describe an exit
+// Describes the given termination in the given buffer of the given size
+// for our log messages, like `exit status 1` or `signal 11 (Segmentation
+// fault) and a core dump`, followed by the resources used.
+void describe_exit(const exit_record_t *rec, char *buf, size_t size) {
+  int n;
+
+  if (WIFEXITED(rec->status)) {
+    n = snprintf(buf, size, "exit status %d", WEXITSTATUS(rec->status));
+  } else if (WIFSIGNALED(rec->status)) {
+    n = snprintf(buf, size, "signal %d (%s)%s", WTERMSIG(rec->status),
+                 strsignal(WTERMSIG(rec->status)),
+                 WCOREDUMP(rec->status) ? " and a core dump" : "");
+  } else {
+    n = snprintf(buf, size, "status %#x", rec->status);
+  }
+
+  if (n >= 0 && (size_t)n < size) {
+    snprintf(buf + n, size - n, " (max rss: %ldkB, cpu: %ld.%02lds user, " \
+             "%ld.%02lds sys)", rec->maxrss, (long)rec->utime.tv_sec,
+             (long)rec->utime.tv_usec / 10000, (long)rec->stime.tv_sec,
+             (long)rec->stime.tv_usec / 10000);
+  }
+}
+
+// ### Shut down children
+// Terminates the processes of all children at once, and keeps quarantined
+// children from being spawned again. We exit once every process has been
+// reaped, which might be right away. If we're asked to terminate while
+// already shutting down, whatever is left is killed right away.
+void shutdown_children(void) {
+  if (shutting_down) {
+    slog(LOG_WARNING, "Killing %zu remaining children", running_children());
+
+    for (child_t *ch = head_ch; ch != NULL; ch = ch->next) {
+      if (!kill_cgroup(ch)) {
+        signal_child(ch, SIGKILL);
+      }
+    }
+    for (child_t *ch = removed_ch; ch != NULL; ch = ch->next) {
+      if (!kill_cgroup(ch)) {
+        signal_child(ch, SIGKILL);
+      }
+    }
+    return;
+  }
+
+  shutting_down = true;
+  monotonic_now(&shutdown_at);
+  slog(LOG_NOTICE, "Shutting down %zu children", running_children());
+
+  // Removed children are terminating already, except for previous
+  // processes waiting for their replacement to get ready.
+  for (child_t *ch = head_ch; ch != NULL; ch = ch->next) {
+    ch->quarantined = false;
+    cancel_timeout(&ch->quarantine_to);
+    finish_rolling(ch);
+    kill_child(ch);
+  }
+
+  finish_shutdown();
+}
+
+// ### Finish shutdown
+// Exits if we're shutting down and every process of our children has been
+// reaped, logging how long the shutdown took.
+void finish_shutdown(void) {
+  struct timespec now;
+
+  if (!shutting_down || pid_index.count > 0 || draining_count > 0) {
+    return;
+  }
+
+  monotonic_now(&now);
+  slog(LOG_NOTICE, "Shut down in %.3fs",
+       timespec_seconds(&now) - timespec_seconds(&shutdown_at));
+  exit(EXIT_SUCCESS);
+}
+
+// ### Running children
+// Counts the children with a running process, including removed children
+// still waiting for theirs to terminate. Our process id index can't tell
+// us, since it holds the processes checking children and the sessions
+// being drained as well.
+size_t running_children(void) {
+  size_t count = 0;
+
+  for (child_t *ch = head_ch; ch != NULL; ch = ch->next) {
+    count += ch->pid > 0;
+  }
+  for (child_t *ch = removed_ch; ch != NULL; ch = ch->next) {
+    count += ch->pid > 0;
+  }
+  return count;
+}
+
+// ### Terminate child
+// Terminate a given child by sending it the `SIGTERM` signal. If its
+// process hasn't terminated within its stop timeout it is killed. Asking
+// a child which is already terminating again doesn't give it more time.
+void kill_child(child_t *ch) {
+  signal_child(ch, SIGTERM);
+
+  if (ch->pid > 0 && !timeout_pending(&ch->kill_to)) {
+    struct timespec timeout = { ch->conf.stop_timeout, 0 };
+    schedule_timeout(&ch->kill_to, &timeout);
+  }
+}
+
+// ### Handle kill timeout
+// The handler for the kill timeout of a child. Its process didn't
+// terminate in time so it's killed.
+void handle_kill_timeout(timeout_t *to) {
+  child_t *ch = to->data;
+
+  // A child draining its session has no process of its own left, but
+  // those in its session are killed in its stead.
+  if (ch->pid == 0) {
+    kill_session(ch);
+    return;
+  }
+
+  slog(LOG_WARNING, "%s did not terminate within %lds and will be killed",
+       ch->name, ch->conf.stop_timeout);
+  if (!kill_cgroup(ch)) {
+    signal_child(ch, SIGKILL);
+  }
+}
+
+// ### Signal child
+// Sends the given signal to the process of the given child, if it has one.
+void signal_child(child_t *ch, int sig) {
+  // A process id of zero means that the child has no running process, and
+  // `kill(2)` would happily signal our own process group in that case.
+  // With a process file descriptor the signal can't hit another process
+  // which happened to reuse the process id of an already terminated child.
+  if (ch->pidfd_ev.fd >= 0) {
+    signal_pidfd(ch->pidfd_ev.fd, sig);
+  } else if (ch->pid > 0) {
+    kill(ch->pid, sig);
+
+  // The processes left behind by a terminated process are signalled in
+  // its stead while they're drained.
+  } else if (ch->draining && ch->session > 0) {
+    signal_session(ch->session, sig);
+  }
+}
+
+// ### Remove all children
+// Free the memory consumed by our linked list of children.
+void cleanup_children(void) {
+  child_t *tmp_ch;
+
+  // Iterate until the head pointer of our linked list is null.
+  while (head_ch != NULL) {
+    // Store a temporary pointer to the next child after the current head
+    // of the linked list.
+    tmp_ch = head_ch->next;
+    // Free the memory the current head of the linked list points to.
+    cleanup_child(head_ch);
+    // Set the temporary pointer as the current head of the linked list.
+    head_ch = tmp_ch;
+  }
+  tail_ch = NULL;
+
+  // Removed children still waiting for their process to terminate are
+  // freed as well.
+  while (removed_ch != NULL) {
+    tmp_ch = removed_ch->next;
+    cleanup_child(removed_ch);
+    removed_ch = tmp_ch;
+  }
+
+  // With no children left our indexes can be freed as well.
+  cleanup_index(&pid_index);
+  cleanup_index(&name_index);
+}
+
+// ### Free memory for a child
+// Free the memory consumed by the given child.
+void cleanup_child(child_t *ch) {
+  // A running child has to be removed from our process id index and event
+  // loop, and a quarantined child from our timeouts, before its memory is
+  // freed so that we don't keep a dangling pointer to it.
+  finish_start(ch, false);
+  release_child_process(ch);
+  close_output(ch);
+  close_listeners(ch);
+  close_cgroup(ch);
+  close_check(ch);
+  release_session(ch);
+  cancel_timeout(&ch->quarantine_to);
+  cancel_timeout(&ch->pidfile_to);
+  forget_control_child(ch);
+
+  // The other of a previous process and its replacement no longer has a
+  // partner.
+  if (ch->rolling != NULL) {
+    ch->rolling->rolling = NULL;
+  }
+  free(ch);
+}
+
+
+// Child process tracking
+// ----------------------
+
+// ### Track a child process
+// Opens a process file descriptor for the running process of the given
+// child and registers it with our event loop. Returns false if this
+// failed.
+bool track_child_process(child_t *ch) {
+  if ((ch->pidfd_ev.fd = open_pidfd(ch->pid)) < 0) {
+    return false;
+  }
+
+  if (!add_event(&ch->pidfd_ev, EPOLLIN)) {
+    close(ch->pidfd_ev.fd);
+    ch->pidfd_ev.fd = -1;
+    return false;
+  }
+  return true;
+}
+
+// ### Release a child process
+// Forgets the process of the given child, which has either been reaped or
+// is about to be handed off. The process id is dropped from our index and
+// the process file descriptor is closed and removed from our event loop.
+void release_child_process(child_t *ch) {
+  // A process which is gone no longer needs to be killed, or waited for
+  // to get ready.
+  cancel_timeout(&ch->kill_to);
+  cancel_timeout(&ch->ready_to);
+
+  if (ch->pid > 0) {
+    unindex_pid(ch->pid);
+    ch->pid = 0;
+  }
+
+  if (ch->pidfd_ev.fd >= 0) {
+    remove_event(&ch->pidfd_ev);
+    close(ch->pidfd_ev.fd);
+    ch->pidfd_ev.fd = -1;
+  }
+
+  close_proc_files(ch);
+  stop_check(ch);
+}
+
+// ### Process file descriptor support
+// Checks whether the kernel supports everything we need for tracking our
+// children through process file descriptors. We open one for ourselves
+// and wait for it, which fails with `ECHILD` only if waiting for process
+// file descriptors is supported.
+bool pidfd_supported(void) {
+  siginfo_t info;
+  int fd = open_pidfd(getpid());
+
+  if (fd < 0) {
+    return false;
+  }
+
+  bool supported = wait_pidfd(fd, &info, NULL) < 0 && errno == ECHILD;
+  close(fd);
+  return supported;
+}
+
+// ### Open a process file descriptor
+// A wrapper arround `pidfd_open(2)` which is not available in all C
+// libraries. The returned file descriptor is close-on-exec. Returns -1 and
+// sets `errno` on failure.
+int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+  return syscall(SYS_pidfd_open, pid, 0);
+#else
+  (void) pid;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+// ### Signal a process file descriptor
+// A wrapper arround `pidfd_send_signal(2)` which sends the given signal to
+// the process referred to by the given process file descriptor.
+int signal_pidfd(int fd, int sig) {
+#ifdef SYS_pidfd_send_signal
+  return syscall(SYS_pidfd_send_signal, fd, sig, NULL, 0);
+#else
+  (void) fd;
+  (void) sig;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+// ### Wait for a process file descriptor
+// Reaps the terminated process referred to by the given process file
+// descriptor without blocking, and stores the resources it used in the
+// given pointer unless it's null. The C library doesn't know about the
+// `P_PIDFD` id type of `waitid(2)` on all systems so we call it directly,
+// which also gives us the resources used like `wait4(2)` does.
+int wait_pidfd(int fd, siginfo_t *info, struct rusage *usage) {
+  info->si_pid = 0;
+  return syscall(SYS_waitid, WAIT_P_PIDFD, fd, info, WEXITED | WNOHANG,
+                 usage);
+}
+
+// ### Status of a waited process
+// Returns the status of a process reaped with `waitid(2)` from the given
+// information, encoded like `waitpid(3)` does it so that the `WIFEXITED()`
+// family of macros can be used no matter how a child was reaped.
+int wait_status(const siginfo_t *info) {
+  switch (info->si_code) {
+    case CLD_EXITED:
+      return (info->si_status & 0xff) << 8;
+    case CLD_DUMPED:
+      return (info->si_status & 0x7f) | WCOREFLAG;
+    default:
+      return info->si_status & 0x7f;
+  }
+}
+
+
+// Orphans
+// -------
+
+// ### Setup subreaper
+// Makes us the subreaper of our children, so that processes orphaned by
+// them, like those left behind or the daemons they forked, are reparented
+// to us instead of to `init`. We can supervise without it, so failure here
+// is only logged.
+void setup_subreaper(void) {
+  if (prctl(PR_SET_CHILD_SUBREAPER, 1) < 0) {
+    slog(LOG_WARNING, "Can't become a subreaper: %m");
+    return;
+  }
+  subreaper = true;
+}
+
+// ### Reap an orphan
+// Handles the termination of a process orphaned by a child which has
+// already been waited for, given the session it was in. A child draining
+// the processes left behind in its session is settled once the last of
+// them is gone from the process group of the session leader, which is
+// cheap to ask about. We don't look through every process for those
+// which started a group of their own, as orphans terminate by the
+// thousand when children are restarted in a storm. Processes which
+// should never escape are better kept in a control group.
+void reap_orphan(pid_t session) {
+  child_t *ch = session > 0 ? find_child_by_pid(session) : NULL;
+
+  if (ch == NULL || ch->session != session || !ch->draining || ch->pid != 0
+      || kill(-session, 0) == 0) {
+    return;
+  }
+  settle_session(ch);
+}
+
+// ### Read process status
+// Reads the parent process id, the process group id, and the session id
+// of the process with the given id from its `stat` file in `/proc`, and
+// stores those asked for in the given pointers unless they're null.
+// Returns false if the process is gone. The command name in the file can
+// hold any character, so we parse what comes after its last parenthesis.
+bool read_process_stat(pid_t pid, pid_t *ppid, pid_t *pgid,
+                       pid_t *session) {
+  char path[PATH_MAX], buf[PROC_BUFFER_SIZE];
+  pid_t parent, group, sid;
+  ssize_t len;
+  char *p;
+  int fd;
+
+  snprintf(path, sizeof(path), PROC_PATH_FORMAT, pid, "stat");
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+    return false;
+  }
+  len = read(fd, buf, sizeof(buf)-1);
+  close(fd);
+  if (len <= 0) {
+    return false;
+  }
+  buf[len] = '\0';
+
+  if ((p = strrchr(buf, ')')) == NULL
+      || sscanf(p+1, " %*c %d %d %d", &parent, &group, &sid) != 3) {
+    return false;
+  }
+
+  if (ppid != NULL) {
+    *ppid = parent;
+  }
+  if (pgid != NULL) {
+    *pgid = group;
+  }
+  if (session != NULL) {
+    *session = sid;
+  }
+  return true;
+}
+
+// ### Drain a child
+// Makes sure nothing is left of the terminated process of the given child
+// before it's settled, whether processes it forked are in its control
+// group or only in its session.
+void drain_child(child_t *ch) {
+  if (drain_cgroup(ch)) {
+    // Whatever is left in the session is in the control group as well.
+    ch->session = 0;
+    return;
+  }
+  if (!drain_session(ch)) {
+    settle_child(ch);
+  }
+}
+
+// ### Drain a session
+// Terminates the processes left behind in the session of the given child
+// by its terminated process, which as their subreaper we reap once
+// they've terminated. Like the process itself they get the stop timeout
+// of the child to terminate before they're killed. The child is draining
+// until there are no processes left in the session, and is settled by
+// `reap_orphan()` or `kill_session()` then. Returns false if nothing was
+// left behind, in which case the child can be settled right away.
+bool drain_session(child_t *ch) {
+  struct timespec timeout = { ch->conf.stop_timeout, 0 };
+  pid_t session = ch->session;
+
+  ch->session = 0;
+
+  // Most processes leave nothing behind, and those which do leave it in
+  // the process group of the session leader. Only then do we look
+  // through every process for the whole session.
+  if (!subreaper || session <= 0 || kill(-session, 0) < 0
+      || signal_session(session, SIGTERM) == 0) {
+    return false;
+  }
+
+  slog(LOG_NOTICE, "Terminating processes left behind by %s", ch->name);
+
+  // The session id can't be handed out to a new process while there are
+  // processes left in it, so we find the child of an orphan by indexing
+  // it until they're all gone.
+  ch->session = session;
+  index_pid(ch, session);
+  ch->draining = true;
+  draining_count++;
+  schedule_timeout(&ch->kill_to, &timeout);
+  return true;
+}
+
+// ### Signal a session
+// Sends the given signal to every process group with processes in the
+// session with the given id, which we find by reading the `stat` file of
+// every process in `/proc`. Processes which started a process group of
+// their own are signalled along with those in the group of the session
+// leader. A signal of zero only looks for processes. Returns the number
+// of processes found in the session.
+size_t signal_session(pid_t session, int sig) {
+  pid_t groups[SESSION_GROUPS_MAX], pid, pgid, sid;
+  size_t count = 0, groups_len = 0;
+  struct dirent *d;
+  DIR *dir;
+
+  // Kernel threads are in no session, and a process group id of zero
+  // would have `kill(2)` signal our own process group.
+  if (session <= 0 || (dir = opendir("/proc")) == NULL) {
+    return 0;
+  }
+
+  while ((d = readdir(dir)) != NULL) {
+    if ((pid = atoi(d->d_name)) <= 0
+        || !read_process_stat(pid, NULL, &pgid, &sid) || sid != session
+        || pgid <= 0) {
+      continue;
+    }
+    count++;
+
+    // Each process group is signalled once, as long as we can tell them
+    // apart. Signalling one again does no harm.
+    bool seen = false;
+    for (size_t i = 0; i < groups_len && !seen; i++) {
+      seen = groups[i] == pgid;
+    }
+    if (seen || sig == 0) {
+      continue;
+    }
+    if (groups_len < SESSION_GROUPS_MAX) {
+      groups[groups_len++] = pgid;
+    }
+    kill(-pgid, sig);
+  }
+
+  closedir(dir);
+  return count;
+}
+
+// ### Kill a session
+// Kills the processes left in the session of the given child which
+// didn't terminate within its stop timeout. Processes reaped by a parent
+// other than us don't tell us when they're gone, so we look again after
+// another stop timeout until the process group of the session leader is
+// empty.
+void kill_session(child_t *ch) {
+  struct timespec timeout = { ch->conf.stop_timeout, 0 };
+
+  if (!ch->draining) {
+    return;
+  }
+  if (kill(-ch->session, 0) < 0
+      || signal_session(ch->session, SIGKILL) == 0) {
+    settle_session(ch);
+
+    // The last child to be drained during a shutdown lets us exit.
+    finish_shutdown();
+    return;
+  }
+
+  slog(LOG_WARNING, "Processes left behind by %s did not terminate " \
+       "within %lds and will be killed", ch->name, ch->conf.stop_timeout);
+  schedule_timeout(&ch->kill_to, &timeout);
+}
+
+// ### Settle a session
+// Settles the given child once no processes are left in its session.
+void settle_session(child_t *ch) {
+  cancel_timeout(&ch->kill_to);
+  release_session(ch);
+  ch->draining = false;
+  draining_count--;
+  settle_child(ch);
+}
+
+// ### Release a session
+// Drops the session of the given child from our process id index, unless
+// it's the id of its running process.
+void release_session(child_t *ch) {
+  if (ch->session > 0 && ch->session != ch->pid
+      && find_child_by_pid(ch->session) == ch) {
+    unindex_pid(ch->session);
+  }
+  ch->session = 0;
+}
+
+// ### Follow a pidfile
+// Follows the given child, whose process exited with the given status, to
+// the daemon it forked when it has a pidfile. A process which exited
+// successfully has daemonized, but the daemon might not have written its
+// pidfile yet. The child is draining while we retry reading it until its
+// ready timeout has passed. Returns false if the child isn't followed.
+bool follow_pidfile(child_t *ch, int status) {
+  if (ch->conf.pidfile[0] == '\0' || !WIFEXITED(status)
+      || WEXITSTATUS(status) != 0 || ch->stopped || ch->restarting
+      || ch->removed || shutting_down) {
+    return false;
+  }
+
+  if (adopt_pidfile(ch)) {
+    return true;
+  }
+
+  ch->draining = true;
+  draining_count++;
+  schedule_timeout(&ch->pidfile_to, &PIDFILE_RETRY_PERIOD);
+  return true;
+}
+
+// ### Handle a pidfile timeout
+// The handler for retrying to read the pidfile of a child. A child which
+// is no longer supposed to run, or whose daemon didn't show up in time,
+// is drained and settled as if it was never followed.
+void handle_pidfile_timeout(timeout_t *to) {
+  child_t *ch = to->data;
+  exit_record_t *rec = &ch->history[(ch->history_start + ch->history_len - 1)
+                                    % EXIT_HISTORY_SIZE];
+  bool give_up = ch->stopped || ch->restarting || ch->removed
+                 || shutting_down
+                 || seconds_since(&rec->at) >= ch->conf.ready_timeout;
+
+  if (!give_up && !adopt_pidfile(ch)) {
+    schedule_timeout(&ch->pidfile_to, &PIDFILE_RETRY_PERIOD);
+    return;
+  }
+
+  ch->draining = false;
+  draining_count--;
+
+  if (give_up) {
+    slog(LOG_WARNING, "Can't follow %s through %s", ch->name,
+         ch->conf.pidfile);
+    drain_child(ch);
+  }
+
+  // The last child to be drained during a shutdown lets us exit.
+  finish_shutdown();
+}
+
+// ### Adopt a pidfile
+// Makes the process named in the pidfile of the given child its process,
+// as long as it was reparented to us. Returns false if there's no such
+// process yet.
+bool adopt_pidfile(child_t *ch) {
+  char buf[PIDFILE_BUFFER_SIZE], *end;
+  pid_t ppid, session, launcher = ch->session;
+  ssize_t len;
+  long pid;
+  int fd;
+
+  if ((fd = open(ch->conf.pidfile, O_RDONLY | O_CLOEXEC)) < 0) {
+    return false;
+  }
+  len = read(fd, buf, sizeof(buf)-1);
+  close(fd);
+  if (len <= 0) {
+    return false;
+  }
+  buf[len] = '\0';
+
+  errno = 0;
+  pid = strtol(buf, &end, 10);
+  if (errno != 0 || end == buf || (*end != '\0' && *end != '\n')
+      || pid <= 0 || pid > INT_MAX
+      || !read_process_stat(pid, &ppid, NULL, &session)
+      || ppid != getpid()) {
+    return false;
+  }
+
+  ch->pid = pid;
+  ch->session = session;
+  index_pid(ch, ch->pid);
+
+  // The daemon is reaped through its process file descriptor like any
+  // other child process in process file descriptor mode.
+  if (pidfd_mode && !track_child_process(ch)) {
+    unindex_pid(ch->pid);
+    ch->pid = 0;
+    ch->session = launcher;
+    return false;
+  }
+
+  slog(LOG_NOTICE, "Following %s as process %d from %s", ch->name,
+       ch->pid, ch->conf.pidfile);
+  watch_child(ch);
+  schedule_check(ch);
+  return true;
+}
+
+
+// Metrics
+// -------
+
+// ### Setup metrics
+// Writes the metrics of our children to the file we were given, if any,
+// and keeps writing them periodically. The file is replaced as a whole
+// each time so that a reader never sees half of it, which makes it
+// suitable for the textfile collector of the Prometheus node exporter.
+void setup_metrics(void) {
+  if (metrics_path == NULL) {
+    return;
+  }
+
+  write_metrics();
+  schedule_timeout(&metrics_to, &METRICS_PERIOD);
+}
+
+// ### Handle metrics timeout
+// The handler for the metrics timeout which writes our metrics and
+// schedules itself to do so again.
+void handle_metrics_timeout(timeout_t *to) {
+  write_metrics();
+  schedule_timeout(to, &METRICS_PERIOD);
+}
+
+// ### Write metrics
+// Writes the metrics of all children in the Prometheus text format to a
+// temporary file next to our metrics file, which is then renamed over it.
+// All samples of a metric are written together under its header as the
+// format demands it.
+void write_metrics(void) {
+  char tmp[PATH_MAX + 1], label[2 * INSTANCE_NAME_SIZE + 1];
+  FILE *fp;
+
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp", metrics_path)
+      >= (int)sizeof(tmp)) {
+    slog(LOG_ERR, "Can't write metrics to %s: path too long", metrics_path);
+    return;
+  }
+
+  if ((fp = fopen(tmp, "we")) == NULL) {
+    slog(LOG_ERR, "Can't write metrics to %s: %m", tmp);
+    return;
+  }
+
+  write_metric_header(fp, "going_child_up", "gauge",
+                      "Whether the child has a running process.");
+  for (child_t *ch = head_ch; ch; ch = ch->next) {
+    fprintf(fp, "going_child_up{child=\"%s\"} %d\n",
+            label_value(ch->name, label, sizeof(label)), ch->pid > 0);
+  }
+
+  write_metric_header(fp, "going_child_starts_total", "counter",
+                      "Processes started for the child.");
+  for (child_t *ch = head_ch; ch; ch = ch->next) {
+    fprintf(fp, "going_child_starts_total{child=\"%s\"} %lu\n",
+            label_value(ch->name, label, sizeof(label)), ch->metrics.starts);
+  }
+
+  // Exits are labeled with their exit code or signal. Those we ran out of
+  // room to tell apart are counted with an empty status.
+  write_metric_header(fp, "going_child_exits_total", "counter",
+                      "Processes of the child which terminated.");
+  for (child_t *ch = head_ch; ch; ch = ch->next) {
+    label_value(ch->name, label, sizeof(label));
+
+    for (size_t i = 0; i < METRICS_EXITS_MAX; i++) {
+      exit_count_t *ec = &ch->metrics.exits[i];
+
+      if (ec->count == 0) {
+        break;
+      }
+      fprintf(fp, "going_child_exits_total{child=\"%s\",reason=\"%s\"," \
+              "status=\"%d\"} %lu\n", label, ec->signaled ? "signal" : "exit",
+              ec->status, ec->count);
+    }
+    if (ch->metrics.other_exits > 0) {
+      fprintf(fp, "going_child_exits_total{child=\"%s\",reason=\"other\"," \
+              "status=\"\"} %lu\n", label, ch->metrics.other_exits);
+    }
+  }
+
+  write_metric_header(fp, "going_child_quarantines_total", "counter",
+                      "Times the child was quarantined.");
+  for (child_t *ch = head_ch; ch; ch = ch->next) {
+    fprintf(fp, "going_child_quarantines_total{child=\"%s\"} %lu\n",
+            label_value(ch->name, label, sizeof(label)),
+            ch->metrics.quarantines);
+  }
+
+  write_metric_header(fp, "going_child_last_exit_timestamp_seconds", "gauge",
+                      "Time of the last termination of a process of the " \
+                      "child.");
+  for (child_t *ch = head_ch; ch; ch = ch->next) {
+    if (ch->metrics.last_exit_at > 0) {
+      fprintf(fp, "going_child_last_exit_timestamp_seconds{child=\"%s\"} " \
+              "%lld\n", label_value(ch->name, label, sizeof(label)),
+              (long long)ch->metrics.last_exit_at);
+    }
+  }
+
+  write_metric_header(fp, "going_child_spawn_latency_seconds", "histogram",
+                      "Time it took to start processes of the child.");
+  for (child_t *ch = head_ch; ch; ch = ch->next) {
+    write_histogram(fp, "going_child_spawn_latency_seconds",
+                    label_value(ch->name, label, sizeof(label)),
+                    &ch->metrics.spawn_latency, 1e-6);
+  }
+
+  write_metric_header(fp, "going_child_uptime_seconds", "histogram",
+                      "Uptime of processes of the child when they " \
+                      "terminated.");
+  for (child_t *ch = head_ch; ch; ch = ch->next) {
+    write_histogram(fp, "going_child_uptime_seconds",
+                    label_value(ch->name, label, sizeof(label)),
+                    &ch->metrics.uptime, 1);
+  }
+
+  // Errors writing to the file are remembered by the stream and reported
+  // when it's closed. We don't replace good metrics with broken ones.
+  if (fclose(fp) != 0 || rename(tmp, metrics_path) < 0) {
+    slog(LOG_ERR, "Can't write metrics to %s: %m", metrics_path);
+    unlink(tmp);
+  }
+}
+
+// ### Write metric header
+// Writes the help text and type of the metric with the given name.
+void write_metric_header(FILE *fp, const char *name, const char *type,
+                         const char *help) {
+  fprintf(fp, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// ### Write histogram
+// Writes the given histogram of a child with the given label as the
+// buckets, sum, and count of the metric with the given name. Values are
+// multiplied by the given unit to get seconds. Buckets are cumulative in
+// the Prometheus text format, so empty buckets add nothing and are left
+// out, as is our last bucket which has no upper bound of its own.
+void write_histogram(FILE *fp, const char *name, const char *label,
+                     histogram_t *h, double unit) {
+  unsigned long cumulative = 0;
+
+  for (size_t i = 0; i < HISTOGRAM_BUCKETS - 1; i++) {
+    if (h->buckets[i] == 0) {
+      continue;
+    }
+    cumulative += h->buckets[i];
+    fprintf(fp, "%s_bucket{child=\"%s\",le=\"%.9g\"} %lu\n", name, label,
+            histogram_bound(i) * unit, cumulative);
+  }
+  fprintf(fp, "%s_bucket{child=\"%s\",le=\"+Inf\"} %lu\n", name, label,
+          h->count);
+  fprintf(fp, "%s_sum{child=\"%s\"} %.9g\n", name, label, h->sum * unit);
+  fprintf(fp, "%s_count{child=\"%s\"} %lu\n", name, label, h->count);
+}
+
+// ### Record a spawn
+// Counts a started process of the given child which was started at the
+// given time and has just noted its time of start in `up_at`.
+void record_spawn(child_t *ch, const struct timespec *started_at) {
+  int64_t usec = (int64_t)(ch->up_at.tv_sec - started_at->tv_sec) * 1000000
+                 + (ch->up_at.tv_nsec - started_at->tv_nsec) / 1000;
+
+  ch->metrics.starts++;
+  record_histogram(&ch->metrics.spawn_latency, usec > 0 ? usec : 0);
+}
+
+// ### Record an exit
+// Counts the termination of a process of the given child with the given
+// status as returned by `waitpid(3)` after the given uptime. An exit code
+// or signal gets the first free slot of the child, and exits are counted
+// as others when it has run out of them.
+void record_exit(child_t *ch, int status, long uptime) {
+  metrics_t *m = &ch->metrics;
+  bool signaled = WIFSIGNALED(status);
+  int value = signaled ? WTERMSIG(status) : WEXITSTATUS(status);
+
+  m->last_exit_at = time(NULL);
+  record_histogram(&m->uptime, uptime > 0 ? uptime : 0);
+
+  if (!signaled && !WIFEXITED(status)) {
+    m->other_exits++;
+    return;
+  }
+
+  for (size_t i = 0; i < METRICS_EXITS_MAX; i++) {
+    exit_count_t *ec = &m->exits[i];
+
+    if (ec->count == 0) {
+      ec->signaled = signaled;
+      ec->status = value;
+    }
+    if (ec->signaled == signaled && ec->status == value) {
+      ec->count++;
+      return;
+    }
+  }
+  m->other_exits++;
+}
+
+// ### Record a value in a histogram
+// Counts the given value in its bucket of the given histogram.
+void record_histogram(histogram_t *h, uint64_t value) {
+  h->buckets[histogram_bucket(value)]++;
+  h->count++;
+  h->sum += value;
+}
+
+// ### Bucket of a histogram value
+// Returns the index of the bucket of the given value. The first eight
+// buckets hold a single value each, and every doubling after that is
+// split into four buckets of equal width. The bucket of a larger value is
+// found from its highest set bit, which tells its doubling, and the two
+// bits below it, which tell its quarter.
+size_t histogram_bucket(uint64_t value) {
+  if (value <= 8) {
+    return value > 0 ? value - 1 : 0;
+  }
+
+  uint64_t v = value - 1;
+  int bit = 63 - __builtin_clzll(v);
+  size_t i = 8 + (bit - 3) * 4 + ((v >> (bit - 2)) & 3);
+
+  return i < HISTOGRAM_BUCKETS ? i : HISTOGRAM_BUCKETS - 1;
+}
+
+// ### Bound of a histogram bucket
+// Returns the largest value counted in the bucket with the given index.
+uint64_t histogram_bound(size_t i) {
+  if (i < 8) {
+    return i + 1;
+  }
+  return (uint64_t)(5 + (i - 8) % 4) << (1 + (i - 8) / 4);
+}
+
+// ### Label value
+// Returns the given value escaped for use as a label value in the given
+// buffer of the given size, which must have room for twice the value.
+const char *label_value(const char *value, char *buf, size_t size) {
+  size_t n = 0;
+
+  for (; *value && n + 2 < size; value++) {
+    if (*value == '\\' || *value == '"') {
+      buf[n++] = '\\';
+      buf[n++] = *value;
+    } else if (*value == '\n') {
+      buf[n++] = '\\';
+      buf[n++] = 'n';
+    } else {
+      buf[n++] = *value;
+    }
+  }
+  buf[n] = '\0';
+  return buf;
+}
+
+
+// Resource watchdog
+// -----------------
+
+// ### Watch a child
+// Makes sure the watchdog samples the given child if it has a limit on
+// what its process may use.
+void watch_child(child_t *ch) {
+  if (child_watched(ch) && !timeout_pending(&watchdog_to)) {
+    schedule_timeout(&watchdog_to, &WATCHDOG_PERIOD);
+  }
+}
+
+// ### Child watched
+// Returns whether the given child has a limit on what its process may use.
+bool child_watched(child_t *ch) {
+  return ch->conf.restart_rss > 0 || ch->conf.restart_cpu > 0
+         || ch->conf.restart_fds > 0;
+}
+
+// ### Handle watchdog
+// The handler for the watchdog timeout which samples the processes of all
+// watched children in one go, and restarts those using more than they
+// may. A child which is already on its way down is left alone. We keep
+// sampling periodically as long as a watched child has a process, and
+// otherwise start again when one is spawned.
+void handle_watchdog(timeout_t *to) {
+  bool watching = false;
+  sample_t sample;
+  const char *key;
+
+  if (shutting_down) {
+    return;
+  }
+
+  for (child_t *ch = head_ch; ch; ch = ch->next) {
+    if (!child_watched(ch)) {
+      close_proc_files(ch);
+      continue;
+    }
+    if (ch->pid <= 0 || ch->restarting || ch->stopped
+        || ch->rolling != NULL) {
+      continue;
+    }
+
+    watching = true;
+    if (!sample_process(ch, &sample)) {
+      continue;
+    }
+
+    if (ch->conf.restart_rss > 0 && sample.rss > ch->conf.restart_rss / 1024) {
+      key = CONFIG_RESTART_RSS_KEY;
+    } else if (ch->conf.restart_cpu > 0
+               && sample.cpu > ch->conf.restart_cpu) {
+      key = CONFIG_RESTART_CPU_KEY;
+    } else if (ch->conf.restart_fds > 0
+               && sample.fds > ch->conf.restart_fds) {
+      key = CONFIG_RESTART_FDS_KEY;
+    } else {
+      continue;
+    }
+
+    slog(LOG_WARNING, "%s is over its %s= using %ldkB of memory, %.2fs of " \
+         "processor time, and %ld files, restarting", ch->name, key,
+         sample.rss, sample.cpu, sample.fds);
+    restart_child(ch);
+  }
+
+  if (watching) {
+    schedule_timeout(to, &WATCHDOG_PERIOD);
+  }
+}
+
+// ### Sample a process
+// Stores what the process of the given child is using in the given
+// sample. Its files below `/proc` are read from the start with `pread(2)`
+// each time, which spares us opening them every period. Returns false
+// when the process can't be sampled, like when it has just terminated and
+// is about to be reaped, in which case its files are closed and opened
+// again the next time around.
+bool sample_process(child_t *ch, sample_t *sample) {
+  char buf[PROC_BUFFER_SIZE];
+  unsigned long utime, stime;
+  long pages;
+  ssize_t len;
+  char *p;
+
+  if (!open_proc_files(ch)) {
+    return false;
+  }
+
+  // The second field of `statm` is the resident set size in pages.
+  if ((len = pread(ch->statm_fd, buf, sizeof(buf) - 1, 0)) <= 0) {
+    goto fail;
+  }
+  buf[len] = '\0';
+  if (sscanf(buf, "%*d %ld", &pages) != 1) {
+    goto fail;
+  }
+  sample->rss = pages * (sysconf(_SC_PAGESIZE) / 1024);
+
+  // The command name in `stat` is in parentheses and may hold anything,
+  // so we skip past the last closing parenthesis to the state, which is
+  // followed by eleven fields before the user and system time in clock
+  // ticks.
+  if ((len = pread(ch->stat_fd, buf, sizeof(buf) - 1, 0)) <= 0) {
+    goto fail;
+  }
+  buf[len] = '\0';
+  if ((p = strrchr(buf, ')')) == NULL
+      || sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u " \
+                "%lu %lu", &utime, &stime) != 2) {
+    goto fail;
+  }
+  sample->cpu = (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+
+  if ((sample->fds = count_fds(ch->fds_fd)) < 0) {
+    goto fail;
+  }
+  return true;
+
+fail:
+  close_proc_files(ch);
+  return false;
+}
+
+// ### Open files of a process
+// Opens the `statm` and `stat` files and the `fd` directory of the process
+// of the given child, unless they're already open. Returns false if they
+// can't be opened, leaving them all closed.
+bool open_proc_files(child_t *ch) {
+  char path[PATH_MAX + 1];
+
+  if (ch->statm_fd >= 0) {
+    return true;
+  }
+
+  snprintf(path, sizeof(path), PROC_PATH_FORMAT, ch->pid, "statm");
+  ch->statm_fd = open(path, O_RDONLY | O_CLOEXEC);
+  snprintf(path, sizeof(path), PROC_PATH_FORMAT, ch->pid, "stat");
+  ch->stat_fd = open(path, O_RDONLY | O_CLOEXEC);
+  snprintf(path, sizeof(path), PROC_PATH_FORMAT, ch->pid, "fd");
+  ch->fds_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  if (ch->statm_fd < 0 || ch->stat_fd < 0 || ch->fds_fd < 0) {
+    slog(LOG_WARNING, "Can't sample %s: %m", ch->name);
+    close_proc_files(ch);
+    return false;
+  }
+  return true;
+}
+
+// ### Count open files
+// Returns the number of open files of a process from the given `fd`
+// directory of it, or -1 on failure. Linux 6.2 and later tell the number
+// as the size of the directory, while older kernels have us count its
+// entries through a directory stream of our own.
+long count_fds(int fd) {
+  struct dirent *entry;
+  struct stat st;
+  long count = 0;
+  DIR *dir;
+  int dir_fd;
+
+  if (fstat(fd, &st) < 0) {
+    return -1;
+  }
+  if (st.st_size > 0) {
+    return st.st_size;
+  }
+
+  if ((dir_fd = openat(fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+    return -1;
+  }
+  if ((dir = fdopendir(dir_fd)) == NULL) {
+    close(dir_fd);
+    return -1;
+  }
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] != '.') {
+      count++;
+    }
+  }
+  closedir(dir);
+  return count;
+}
+
+// ### Close files of a process
+// Closes the files below `/proc` of the process of the given child, if
+// they're open.
+void close_proc_files(child_t *ch) {
+  int *fds[] = { &ch->statm_fd, &ch->stat_fd, &ch->fds_fd };
+
+  for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+    if (*fds[i] >= 0) {
+      close(*fds[i]);
+      *fds[i] = -1;
+    }
+  }
+}
+
+
+// Health checks
+// -------------
+
+// ### Schedule a check
+// Schedules the next check of the given child if it's checked, has a
+// process, and isn't being checked already. The first check of a process
+// is run once it has been up for the interval between checks.
+void schedule_check(child_t *ch) {
+  struct timespec interval = { ch->conf.check_interval, 0 };
+
+  if (ch->conf.check != CHECK_NONE && ch->pid > 0 && !ch->checking
+      && !timeout_pending(&ch->check_to)) {
+    schedule_timeout(&ch->check_to, &interval);
+  }
+}
+
+// ### Handle check timeout
+// The handler for the check timeout of a child. A running check which
+// hasn't passed by now has failed, and otherwise it's time for the next
+// check. A process on its way down isn't checked, and neither is one
+// taking over from its previous process, or one while the process which
+// checked it the last time is still around.
+void handle_check_timeout(timeout_t *to) {
+  child_t *ch = to->data;
+  struct timespec interval = { ch->conf.check_interval, 0 };
+
+  if (ch->checking) {
+    end_check(ch);
+    check_result(ch, false, "timed out");
+    return;
+  }
+
+  if (ch->conf.check == CHECK_NONE || ch->pid <= 0 || ch->restarting
+      || ch->stopped || shutting_down) {
+    return;
+  }
+  if (ch->rolling != NULL || ch->check_pid > 0) {
+    schedule_timeout(to, &interval);
+    return;
+  }
+  start_check(ch);
+}
+
+// ### Start a check
+// Checks the given child the way it's configured to. A heartbeat file is
+// looked at right away, while a connection or a process checking the
+// child runs until we're told that it's done through our event loop, or
+// until its deadline has passed. A check which can't even be started has
+// failed.
+void start_check(child_t *ch) {
+  struct timespec timeout = { ch->conf.check_timeout, 0 };
+  char why[EXIT_DESCRIPTION_SIZE];
+  int err;
+
+  switch (ch->conf.check) {
+    case CHECK_FILE:
+      check_result(ch, check_file(ch, why, sizeof(why)), why);
+      return;
+
+    // A connection which is made right away is reported just like one
+    // which takes a while, since its socket is writable from the start.
+    case CHECK_CONNECT:
+      ch->check_ev.handler = handle_check_connect;
+      if ((ch->check_ev.fd = connect_check(ch)) < 0) {
+        check_result(ch, false, strerror(errno));
+        return;
+      }
+      if (!add_event(&ch->check_ev, EPOLLOUT)) {
+        close(ch->check_ev.fd);
+        ch->check_ev.fd = -1;
+        check_result(ch, false, "can't watch connection");
+        return;
+      }
+      break;
+
+    case CHECK_EXEC:
+      if ((err = spawn_check(ch)) != 0) {
+        check_result(ch, false, strerror(err));
+        return;
+      }
+      break;
+  }
+
+  ch->checking = true;
+  schedule_timeout(&ch->check_to, &timeout);
+}
+
+// ### Check a heartbeat file
+// Checks whether the heartbeat file of the given child was modified
+// within the timeout of its checks. Describes why not in the given buffer
+// of the given size if it wasn't.
+bool check_file(child_t *ch, char *why, size_t size) {
+  const char *path = strchr(ch->conf.check_spec, ':') + 1;
+  struct stat st;
+  time_t age;
+
+  if (stat(path, &st) < 0) {
+    snprintf(why, size, "%s: %s", path, strerror(errno));
+    return false;
+  }
+
+  if ((age = time(NULL) - st.st_mtime) > ch->conf.check_timeout) {
+    snprintf(why, size, "%s not modified for %lds", path, (long)age);
+    return false;
+  }
+  why[0] = '\0';
+  return true;
+}
+
+// ### Connect for a check
+// Starts connecting a non-blocking socket to the address the given child
+// is checked on. A missing host is the IPv4 loopback address. Every
+// address the host and port resolve to is tried in turn until connecting
+// to one doesn't fail right away. Returns the file descriptor of the
+// socket, or -1 if no connection could be started.
+int connect_check(child_t *ch) {
+  char host[CHILD_LISTEN_SIZE + 1];
+  struct addrinfo hints, unix_ai, *res, *ai;
+  struct sockaddr_un addr;
+  const char *port;
+  int family, type, fd = -1, err;
+
+  parse_listen(ch->conf.check_spec, &family, &type, host, sizeof(host),
+               &port);
+
+  // A unix socket has a single address, which we don't have to look up.
+  if (family == AF_UNIX) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    safe_strcpy(addr.sun_path, host, sizeof(addr.sun_path));
+
+    memset(&unix_ai, 0, sizeof(unix_ai));
+    unix_ai.ai_family = AF_UNIX;
+    unix_ai.ai_socktype = SOCK_STREAM;
+    unix_ai.ai_addr = (struct sockaddr *)&addr;
+    unix_ai.ai_addrlen = sizeof(addr);
+    res = &unix_ai;
+  } else {
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+
+    if ((err = getaddrinfo(host[0] != '\0' ? host : CHECK_HOST, port,
+                           &hints, &res)) != 0) {
+      errno = err == EAI_SYSTEM ? errno : EINVAL;
+      return -1;
+    }
+  }
+
+  for (ai = res; ai != NULL; ai = ai->ai_next) {
+    if ((fd = socket(ai->ai_family,
+                     ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                     ai->ai_protocol)) < 0) {
+      continue;
+    }
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0
+        || errno == EINPROGRESS) {
+      break;
+    }
+    err = errno;
+    close(fd);
+    fd = -1;
+    errno = err;
+  }
+
+  if (res != &unix_ai) {
+    freeaddrinfo(res);
+  }
+  return fd;
+}
 
-  // After building a signal set of those signals we're going to handle in
-  // our main loop we set it as the signal process mask (blocked signals).
-  sigprocmask(SIG_BLOCK, block_mask, NULL);
+// ### Spawn a check
+// Starts the process checking the given child, which executes the command
+// line of its check with `WRAPPER_SHELL` in the working directory of the
+// child and with its output going wherever the output of the child goes.
+// The process gets a session of its own, so that anything it started is
+// killed along with it if it runs past its deadline. It's spawned with
+// `posix_spawn(3)` even when children are forked, since nothing has to be
+// done in it before the shell is executed. In process file descriptor
+// mode it's tracked like the process of a child, and otherwise it's
+// reaped when we get a `SIGCHLD` signal. Returns zero on success or an
+// error number.
+int spawn_check(child_t *ch) {
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  sigset_t empty_mask;
+  char *argv[] = { WRAPPER_SHELL, "-c", strchr(ch->conf.check_spec, ':') + 1,
+                   NULL };
+  pid_t pid;
+  int err;
+
+  if ((err = posix_spawnattr_init(&attr)) != 0) {
+    return err;
+  }
+  if ((err = posix_spawn_file_actions_init(&actions)) != 0) {
+    posix_spawnattr_destroy(&attr);
+    return err;
+  }
+
+  sigemptyset(&empty_mask);
+  posix_spawnattr_setsigmask(&attr, &empty_mask);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGMASK);
+  posix_spawn_file_actions_addchdir_np(&actions, ch->conf.cwd);
+  if (ch->output_wfd >= 0) {
+    posix_spawn_file_actions_adddup2(&actions, ch->output_wfd, STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, ch->output_wfd, STDERR_FILENO);
+  }
+
+  err = posix_spawn(&pid, WRAPPER_SHELL, &actions, &attr, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  if (err != 0) {
+    return err;
+  }
+
+  ch->check_pid = pid;
+  index_pid(ch, pid);
+
+  // A process we can't track has to be killed and reaped right away, as
+  // nothing else would reap it.
+  if (pidfd_mode) {
+    ch->check_ev.handler = handle_check_pidfd;
+    if ((ch->check_ev.fd = open_pidfd(pid)) < 0
+        || !add_event(&ch->check_ev, EPOLLIN)) {
+      err = errno;
+      kill(pid, SIGKILL);
+      waitpid(pid, NULL, 0);
+      forget_check_process(ch);
+      return err;
+    }
+  }
+  return 0;
 }
 
-// ### Signal handling loop
-// Tha main loop of the `going` process waits for the kernel to deliver
-// signals we've blocked with our process mask. Each signal is
-// accepted synchronously.
-void wait_forever(sigset_t *block_mask, const char *confdir) {
-  struct timespec *timeout = NULL;
+// ### Handle a check connection
+// The event handler for the socket connecting to a child for a check. It
+// becomes writable once the connection has been made or has failed.
+void handle_check_connect(event_t *ev, uint32_t events) {
+  socklen_t len = sizeof(int);
+  int err = 0;
 
-  // We loop until the process explicitly exits or the kernel decides
-  // to terminate it. In each iteration we wait for a signal in our
-  // process mask to arrive.
-  while (true) switch(sigtimedwait(block_mask, NULL, timeout)) {
-
-    // If no signal was delivered within the given timeout period we
-    // get an `EAGAIN` error.
-    case -1:
-      if (errno == EAGAIN) {
-        // This means that we've previously set a timeout of
-        // `QUARANTINE_PERIOD` so that we could wake up and unquarantine
-        // and spawn ready children.
-        spawn_ready_children();
-        // Since all quarantined children can be unquarantined and spawned
-        // after waiting `QUARANTINE_PERIOD` we don't have to wake up
-        // again before we get a new signal.
-        timeout = NULL;
+  (void) events;
+
+  if (getsockopt(ev->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+    err = errno;
+  }
+  end_check(ev->data);
+  check_result(ev->data, err == 0, strerror(err));
+}
+
+// ### Handle a terminated check process
+// The event handler for the process file descriptor of the process
+// checking a child, which becomes readable when it terminates.
+void handle_check_pidfd(event_t *ev, uint32_t events) {
+  siginfo_t info;
+
+  (void) events;
+
+  if (wait_pidfd(ev->fd, &info, NULL) < 0 || info.si_pid == 0) {
+    return;
+  }
+  reap_check(ev->data, wait_status(&info));
+
+  // Orphans might have been waiting behind the check process.
+  if (subreaper) {
+    respawn_terminated_children();
+  }
+}
+
+// ### Reap a check
+// Handles the termination of the process checking the given child, which
+// has already been waited for with the given status as returned by
+// `waitpid(3)`. The check passed if the process exited with a zero exit
+// status, unless it was abandoned in the meantime.
+void reap_check(child_t *ch, int status) {
+  char why[EXIT_DESCRIPTION_SIZE];
+
+  forget_check_process(ch);
+
+  // A removed child which is done with its own process was only waiting
+  // for this one.
+  if (ch->removed && ch->pid == 0 && !ch->draining) {
+    drop_removed_child(ch);
+    return;
+  }
+  if (!ch->checking) {
+    return;
+  }
+  ch->checking = false;
+
+  if (WIFEXITED(status)) {
+    snprintf(why, sizeof(why), "exit status %d", WEXITSTATUS(status));
+  } else {
+    snprintf(why, sizeof(why), "signal %d (%s)", WTERMSIG(status),
+             strsignal(WTERMSIG(status)));
+  }
+  check_result(ch, WIFEXITED(status) && WEXITSTATUS(status) == 0, why);
+}
+
+// ### Check result
+// Counts the check of the given child which passed, or failed for the
+// given reason, and schedules its next check. A child which has failed as
+// many checks in a row as it may is restarted in stead.
+void check_result(child_t *ch, bool passed, const char *why) {
+  cancel_timeout(&ch->check_to);
+
+  if (passed) {
+    ch->failed_checks = 0;
+    schedule_check(ch);
+    return;
+  }
+
+  ch->failed_checks++;
+  slog(LOG_WARNING, "Check of %s failed %ld of %ld times in a row: %s",
+       ch->name, ch->failed_checks, ch->conf.check_failures, why);
+  if (ch->failed_checks < ch->conf.check_failures) {
+    schedule_check(ch);
+    return;
+  }
+
+  slog(LOG_ERR, "%s is not alive, restarting", ch->name);
+  ch->failed_checks = 0;
+  restart_child(ch);
+}
+
+// ### End a check
+// Ends the running check of the given child, if any. Its connection is
+// closed, while the process checking the child is killed along with
+// anything it started and is reaped later on.
+void end_check(child_t *ch) {
+  if (!ch->checking) {
+    return;
+  }
+  ch->checking = false;
+  cancel_timeout(&ch->check_to);
+
+  if (ch->check_pid > 0) {
+    if (epoll_fd >= 0) {
+      kill(-ch->check_pid, SIGKILL);
+    }
+  } else if (ch->check_ev.fd >= 0) {
+    remove_event(&ch->check_ev);
+    close(ch->check_ev.fd);
+    ch->check_ev.fd = -1;
+  }
+}
+
+// ### Stop checking a child
+// Ends the running check of the given child and stops checking it, since
+// its process is gone or has been handed over. The next process starts
+// with a clean slate.
+void stop_check(child_t *ch) {
+  end_check(ch);
+  cancel_timeout(&ch->check_to);
+  ch->failed_checks = 0;
+}
+
+// ### Close a check
+// Stops checking the given child before it's freed. A child is only
+// freed with a process still checking it when we're exiting, in which
+// case the killed process is left for `init` to reap, as waiting for it
+// could take forever.
+void close_check(child_t *ch) {
+  stop_check(ch);
+
+  if (ch->check_pid > 0) {
+    forget_check_process(ch);
+  }
+}
+
+// ### Forget a check process
+// Forgets the process checking the given child, which has been reaped.
+// Its process id is dropped from our index and its process file
+// descriptor is closed and removed from our event loop.
+void forget_check_process(child_t *ch) {
+  unindex_pid(ch->check_pid);
+  ch->check_pid = 0;
+
+  if (ch->check_ev.fd >= 0) {
+    remove_event(&ch->check_ev);
+    close(ch->check_ev.fd);
+    ch->check_ev.fd = -1;
+  }
+}
+
+
+// Hash indexes
+// ------------
+
+// ### Slot of an index
+// Returns the slot with the given number in the given index.
+void *index_at(const index_t *ix, size_t i) {
+  return (char *) ix->slots + i * ix->entry_size;
+}
+
+// ### Add to an index
+// Adds a copy of the given entry to the given index. The index is grown
+// to twice its size whenever it would get more than half full so that
+// our linear probing sequences stay short.
+void index_add(index_t *ix, const void *entry) {
+  if ((ix->count + 1) * 2 > ix->size) {
+    size_t old_size = ix->size;
+    char *old_slots = ix->slots;
+
+    ix->size = old_size ? old_size * 2 : ix->min_size;
+    ix->slots = safe_alloc(ix->size * ix->entry_size);
+
+    // Every entry of the old index is rehashed into the new and larger
+    // index before the old one is freed.
+    for (size_t i = 0; i < old_size; i++) {
+      if (ix->used(old_slots + i * ix->entry_size)) {
+        index_place(ix, old_slots + i * ix->entry_size);
       }
-      break;
+    }
+    free(old_slots);
+  }
+
+  index_place(ix, entry);
+  ix->count++;
+}
+
+// ### Place an entry in an index
+// Copies the given entry into the given index, probing linearly from its
+// preferred slot until we find an empty one.
+void index_place(index_t *ix, const void *entry) {
+  size_t i = ix->slot(entry, ix->size);
+
+  while (ix->used(index_at(ix, i))) {
+    i = (i + 1) & (ix->size - 1);
+  }
+  memcpy(index_at(ix, i), entry, ix->entry_size);
+}
+
+// ### Find in an index
+// Returns the number of the slot in the given index holding the entry
+// which matches the given key according to the given function, probing
+// linearly from the given preferred slot of the key. Returns the size of
+// the index if we reach an empty slot first.
+size_t index_find(const index_t *ix, size_t i,
+                  bool (*matches)(const void *entry, const void *key),
+                  const void *key) {
+  if (ix->slots == NULL) {
+    return ix->size;
+  }
+
+  for (; ix->used(index_at(ix, i)); i = (i + 1) & (ix->size - 1)) {
+    if (matches(index_at(ix, i), key)) {
+      return i;
+    }
+  }
+  return ix->size;
+}
+
+// ### Remove from an index
+// Empties the slot with the given number in the given index. In stead of
+// leaving a tombstone we shift later entries of the same probe sequence
+// back into the hole so that lookups can keep stopping at the first empty
+// slot. An entry can fill the hole if its preferred slot is not
+// cyclically between the hole and its current slot.
+void index_remove(index_t *ix, size_t i) {
+  size_t mask = ix->size - 1, j = i;
 
-    // When the `SIGCHLD` signal is delivered one (or possible several) of
-    // our child processes has terminated.
-    case SIGCHLD:
-      // In response to the termination of children we respawn them. The
-      // `respawn_terminated_children()` function returns `false` if one
-      // or more of the children which it tried to respawn was quarantined.
-      if (!respawn_terminated_children()) {
-        // If we've quarantined one or more children we have to wake up
-        // after `QUARANTINE_PERIOD` the next loop iteration and try to
-        // spawn them then.
-        timeout = &QUARANTINE_PERIOD;
+  while (true) {
+    memset(index_at(ix, i), 0, ix->entry_size);
+
+    while (true) {
+      j = (j + 1) & mask;
+      if (!ix->used(index_at(ix, j))) {
+        ix->count--;
+        return;
       }
-      break;
+      size_t k = ix->slot(index_at(ix, j), ix->size);
+      if ((i <= j) ? (i >= k || k > j) : (i >= k && k > j)) {
+        break;
+      }
+    }
+    memcpy(index_at(ix, i), index_at(ix, j), ix->entry_size);
+    i = j;
+  }
+}
 
-    // A `SIGHUP` signal indicates that we've been requested to reload
-    // our configuration of child processes to supervise.
-    case SIGHUP:
-      parse_confdir(confdir);
-      // If we've received new children to supervise those are spawned for
-      // their first time.
-      spawn_ready_children();
-      break;
+// ### Free an index
+// Free the memory consumed by the given index.
+void cleanup_index(index_t *ix) {
+  free(ix->slots);
+  ix->slots = NULL;
+  ix->size = ix->count = 0;
+}
 
-    // We've received a terminating signal that we can handle. We should
-    // clean up our main and child processes before exiting.
-    default:
-      kill_children();
-      cleanup_children();
-      exit(EXIT_SUCCESS);
+
+// Process id index
+// ----------------
+
+// ### Hash a process id
+// Returns the preferred slot for the given process id in an index with the
+// given size. Process ids are handed out sequentially by the kernel so we
+// scramble them with Knuth's multiplicative hash before masking off the
+// low bits.
+size_t pid_slot(pid_t pid, size_t size) {
+  return ((uint32_t) pid * 2654435761u) & (size - 1);
+}
+
+// ### Process id entries
+// The functions our process id index is given to hash, tell apart, and
+// match its entries by process id.
+size_t pid_entry_slot(const void *entry, size_t size) {
+  return pid_slot(((const pid_entry_t *) entry)->pid, size);
+}
+
+bool pid_entry_used(const void *entry) {
+  return ((const pid_entry_t *) entry)->pid > 0;
+}
+
+bool pid_entry_matches(const void *entry, const void *pid) {
+  return ((const pid_entry_t *) entry)->pid == *(const pid_t *) pid;
+}
+
+// ### Index a child
+// Adds the given process id of the given child to our index, which is
+// that of its process or of the process checking it.
+void index_pid(child_t *ch, pid_t pid) {
+  pid_entry_t entry = { pid, ch };
+
+  index_add(&pid_index, &entry);
+}
+
+// ### Remove a process id from the index
+// Removes the given process id from our index if present.
+void unindex_pid(pid_t pid) {
+  size_t i = index_find(&pid_index, pid_slot(pid, pid_index.size),
+                        pid_entry_matches, &pid);
+
+  if (i < pid_index.size) {
+    index_remove(&pid_index, i);
   }
 }
 
+// ### Find a child by process id
+// Returns the child currently running with the given process id or null
+// if no such child exists.
+child_t *find_child_by_pid(pid_t pid) {
+  size_t i = index_find(&pid_index, pid_slot(pid, pid_index.size),
+                        pid_entry_matches, &pid);
 
-// Children handling
-// -----------------
+  return i < pid_index.size ? ((pid_entry_t *) index_at(&pid_index, i))->ch
+                            : NULL;
+}
+
+
+// Name index
+// ----------
 
-// ### Tail child
-// Returns a pointer to the tail child of the global linked list
-// of children. Returns null if the head child is null.
-child_t *get_tail_child(void) {
-  child_t *tail_ch = head_ch;
+// ### Hash a name
+// Returns the preferred slot for the given child name in an index with the
+// given size using the 32 bit FNV-1a hash.
+size_t name_slot(const char *name, size_t size) {
+  uint32_t hash = 2166136261u;
 
-  while (tail_ch != NULL && tail_ch->next != NULL) {
-    tail_ch = tail_ch->next;
+  for (const unsigned char *c = (const unsigned char *) name; *c; c++) {
+    hash = (hash ^ *c) * 16777619u;
   }
+  return hash & (size - 1);
+}
 
-  return tail_ch;
+// ### Name entries
+// The functions our name index is given to hash and tell apart its
+// entries, which point to children, and to match them by name or by the
+// child they point to.
+size_t name_entry_slot(const void *entry, size_t size) {
+  return name_slot((*(child_t * const *) entry)->name, size);
 }
 
-// ### Existence of child
-// Check whether our liked list of children contains the given child
-// identified by name.
-bool has_child(char *name) {
-  for (child_t *ch = head_ch; ch != NULL; ch = ch->next) {
-    if (strncmp(ch->name, name, CHILD_NAME_SIZE) == 0) {
-      return true;
+bool name_entry_used(const void *entry) {
+  return *(child_t * const *) entry != NULL;
+}
+
+bool name_entry_matches(const void *entry, const void *name) {
+  return strcmp((*(child_t * const *) entry)->name, name) == 0;
+}
+
+bool name_entry_is(const void *entry, const void *ch) {
+  return *(child_t * const *) entry == ch;
+}
+
+// ### Index a child by name
+// Adds the given child to our name index.
+void index_name(child_t *ch) {
+  index_add(&name_index, &ch);
+}
+
+// ### Remove a child from the name index
+// Removes the given child from our name index if present.
+void unindex_name(child_t *ch) {
+  size_t i = index_find(&name_index, name_slot(ch->name, name_index.size),
+                        name_entry_is, ch);
+
+  if (i < name_index.size) {
+    index_remove(&name_index, i);
+  }
+}
+
+// ### Find a child by name
+// Returns the child identified by the given configuration file name or
+// null if we have no such child.
+child_t *find_child(const char *name) {
+  size_t i = index_find(&name_index, name_slot(name, name_index.size),
+                        name_entry_matches, name);
+
+  return i < name_index.size ? *(child_t **) index_at(&name_index, i)
+                             : NULL;
+}
+
+
+// Logging
+// -------
+
+// ### System logger
+// Queues a log message for the system log which takes a priority level, a
+// log message format, and a variable number of arguments to the message
+// format. The message is sent from our main loop, so logging never blocks
+// and is safe from anywhere in our process.
+void slog(int priority, char *message, ...)
+{
+  char buf[LOG_MESSAGE_SIZE], subject[INSTANCE_NAME_SIZE+1];
+  log_repeat_t *r;
+  va_list ap;
+
+  // The C library gives us the `%m` conversion of `syslog(3)` for
+  // `vsnprintf(3)` as well.
+  va_start(ap, message);
+  log_subject(message, ap, subject, sizeof(subject));
+  va_end(ap);
+  va_start(ap, message);
+  vsnprintf(buf, sizeof(buf), message, ap);
+  va_end(ap);
+
+  // A repeat of a message we remember is only counted, and the last of
+  // them is what we log along with the count.
+  if ((r = find_log_repeat(priority, message, subject, buf)) != NULL) {
+    r->repeats++;
+    safe_strcpy(r->message, buf, sizeof(r->message));
+    return;
+  }
+
+  queue_log(priority, buf);
+  remember_log(priority, message, subject, buf);
+}
+
+// ### Subject of a log message
+// Stores the child the log message with the given format and arguments is
+// about in the given subject. It's named by one of the strings the
+// message starts its arguments with, and the subject is empty if none of
+// them is the name of one of our children. Only conversions which don't
+// take an argument can come in between.
+void log_subject(const char *format, va_list ap, char *subject,
+                 size_t size) {
+  const char *p = format;
+
+  subject[0] = '\0';
+  while ((p = strchr(p, '%')) != NULL) {
+    if (p[1] == 's') {
+      const char *arg = va_arg(ap, const char *);
+
+      if (find_child(arg) != NULL) {
+        safe_strcpy(subject, arg, size);
+        return;
+      }
+    } else if (p[1] != '%' && p[1] != 'm') {
+      return;
     }
+    p += 2;
   }
-  return false;
 }
 
-// ### Existence of config
-// Check whether a given child identified by name still is present in a
-// directory listing of our configuration directory.
-bool child_active(char *name, struct dirent **dlist, int dn) {
-  for (int i = dn - 1; i >= 0; i--) {
-    if (strncmp(name, dlist[i]->d_name, CHILD_NAME_SIZE) == 0) {
-      return true;
+// ### Find a log repeat
+// Returns the remembered log message with the given priority, format and
+// subject, or null if there is none. A message about none of our children
+// is only repeated by the very same message.
+log_repeat_t *find_log_repeat(int priority, const char *format,
+                              const char *subject, const char *message) {
+  for (int i = 0; i < LOG_REPEATS_MAX; i++) {
+    log_repeat_t *r = &log_repeats[i];
+
+    if (r->format == format && r->priority == priority
+        && strcmp(r->subject, subject) == 0
+        && (subject[0] != '\0' || strcmp(r->message, message) == 0)) {
+      return r;
     }
   }
-  return false;
+  return NULL;
 }
 
-// ### Child spawned recently
-// Check whether a child was last spawned less than the given number
-// of seconds ago.
-bool child_recently_spawned(child_t *ch, int seconds_ago) {
-  time_t now = time(NULL);
+// ### Remember a log message
+// Remembers the given log message for the repeat period so that its
+// repeats are counted. When we remember as many messages as we can the
+// one remembered the longest is forgotten first, with its repeats
+// accounted for.
+void remember_log(int priority, const char *format, const char *subject,
+                  const char *message) {
+  log_repeat_t *r = NULL;
 
-  // We have to check that:
-  //
-  //  * the child has been spawned before (indicated by a positive `up_at`
-  //    timestamp since its set to zero when a child is initialized),
-  //  * and that the difference between the current time and the time
-  //    the child was spawned is less than the given number of seconds.
-  return ch->up_at > 0 && now >= ch->up_at && now - ch->up_at < seconds_ago;
+  for (int i = 0; i < LOG_REPEATS_MAX; i++) {
+    log_repeat_t *other = &log_repeats[i];
+
+    if (other->format == NULL) {
+      r = other;
+      break;
+    }
+    if (r == NULL || timespec_before(&other->at, &r->at)) {
+      r = other;
+    }
+  }
+  queue_log_repeats(r);
+
+  r->priority = priority;
+  r->format = format;
+  safe_strcpy(r->subject, subject, sizeof(r->subject));
+  safe_strcpy(r->message, message, sizeof(r->message));
+  r->repeats = 0;
+  monotonic_now(&r->at);
+  r->to.handler = handle_log_repeats;
+  r->to.data = r;
+  schedule_timeout(&r->to, &LOG_REPEAT_PERIOD);
 }
 
-// ### Kill children
-// Send all children a termination signal.
-void kill_children(void) {
-  for (child_t *ch = head_ch; ch != NULL; ch = ch->next) {
-    kill_child(ch);
+// ### Queue a log message
+// Appends the given message to our ring buffer of log messages waiting to
+// be sent. If the ring buffer is full the message is dropped and counted.
+void queue_log(int priority, const char *message) {
+  // The number of messages dropped is logged ahead of the next message
+  // that fits.
+  queue_log_drops();
+
+  if (log_count >= LOG_RING_SIZE) {
+    log_dropped++;
+    return;
   }
+
+  log_entry_t *entry = &log_ring[(log_head + log_count++) % LOG_RING_SIZE];
+  entry->priority = priority;
+  entry->at = time(NULL);
+  safe_strcpy(entry->message, message, sizeof(entry->message));
 }
 
-// ### Terminate child
-// Terminate a given child by sending it the `SIGTERM` signal.
-void kill_child(child_t *ch) {
-  kill(ch->pid, SIGTERM);
+// ### Queue the number of dropped log messages
+// Logs how many messages were dropped since the ring buffer filled up, if
+// any, as soon as there is room for it.
+void queue_log_drops(void) {
+  if (log_dropped == 0 || log_count >= LOG_RING_SIZE) {
+    return;
+  }
+
+  log_entry_t *entry = &log_ring[(log_head + log_count++) % LOG_RING_SIZE];
+  entry->priority = LOG_WARNING;
+  entry->at = time(NULL);
+  snprintf(entry->message, sizeof(entry->message),
+           "Dropped %lu log messages", log_dropped);
+  log_dropped = 0;
 }
 
-// ### Remove all children
-// Free the memory consumed by our linked list of children.
-void cleanup_children(void) {
-  child_t *tmp_ch;
+// ### Queue repeats of a log message
+// Logs how many times the given remembered message was repeated since it
+// was first logged, if at all, and forgets it.
+void queue_log_repeats(log_repeat_t *r) {
+  char buf[LOG_MESSAGE_SIZE];
 
-  // Iterate until the head pointer of our linked list is null.
-  while (head_ch != NULL) {
-    // Store a temporary pointer to the next child after the current head
-    // of the linked list.
-    tmp_ch = head_ch->next;
-    // Free the memory the current head of the linked list points to.
-    cleanup_child(head_ch);
-    // Set the temporary pointer as the current head of the linked list.
-    head_ch = tmp_ch;
+  cancel_timeout(&r->to);
+  r->format = NULL;
+  if (r->repeats == 0) {
+    return;
   }
+
+  // The last message is cut short if need be so that the count is never
+  // the part lost to truncation.
+  snprintf(buf, sizeof(buf), "%.*s (repeated %lu times in %lds)",
+           LOG_MESSAGE_SIZE - 48, r->message, r->repeats,
+           seconds_since(&r->at));
+  queue_log(r->priority, buf);
+  r->repeats = 0;
 }
 
-// ### Free memory for a child
-// Free the memory consumed by the given child.
-void cleanup_child(child_t *ch) {
-  free(ch);
+// ### Forget a log message
+// Called when a message has been remembered for the whole repeat period.
+// Its next repeat is logged again.
+void handle_log_repeats(timeout_t *to) {
+  queue_log_repeats(to->data);
+}
+
+// ### Flush log messages
+// Sends as many queued log messages to the system logger as it accepts
+// without blocking. If it can't keep up we ask our main loop to tell us
+// when its socket is writable again. If it went away, which happens when
+// it is restarted, we reconnect. If we can't, the messages stay queued
+// until we try again a little later.
+void flush_log(void) {
+  char datagram[LOG_HEADER_SIZE + LOG_MESSAGE_SIZE];
+  char stamp[16];
+  struct tm tm;
+  bool reconnected = false;
+  pid_t pid = getpid();
+
+  if (log_count > 0 && log_ev.fd < 0 && !timeout_pending(&log_reconnect_to)) {
+    open_log();
+  }
+
+  while (log_count > 0 && log_ev.fd >= 0) {
+    log_entry_t *entry = &log_ring[log_head];
+
+    // Messages are formatted like `syslog(3)` does it, prefixed with our
+    // ident and process id and logged to the daemon log, typically found
+    // in `/var/log/daemon.log`.
+    localtime_r(&entry->at, &tm);
+    strftime(stamp, sizeof(stamp), "%b %e %H:%M:%S", &tm);
+    int len = snprintf(datagram, sizeof(datagram), "<%d>%s %s[%d]: %s",
+                       LOG_DAEMON | entry->priority, stamp, IDENT, pid,
+                       entry->message);
+    if (len >= (int)sizeof(datagram)) {
+      len = sizeof(datagram) - 1;
+    }
+
+    if (send(log_ev.fd, datagram, len, MSG_NOSIGNAL) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        // Inside a freshly forked child our event loop is off limits.
+        if (!log_watched && epoll_fd >= 0) {
+          log_watched = add_event(&log_ev, EPOLLOUT);
+        }
+        return;
+      }
+      disconnect_log();
+      if (!reconnected) {
+        reconnected = true;
+        open_log();
+      }
+      continue;
+    }
+
+    log_head = (log_head + 1) % LOG_RING_SIZE;
+    log_count--;
+
+    // With room in the ring buffer again we can tell how many messages
+    // did not fit.
+    queue_log_drops();
+  }
+
+  if (log_count > 0) {
+    if (!timeout_pending(&log_reconnect_to)) {
+      schedule_timeout(&log_reconnect_to, &LOG_RECONNECT_PERIOD);
+    }
+  } else if (log_watched) {
+    remove_event(&log_ev);
+    log_watched = false;
+  }
+}
+
+// ### Handle a writable system logger
+// Called from our main loop when the system logger can accept more of
+// our queued log messages.
+void handle_log(event_t *ev, uint32_t events) {
+  (void)ev;
+  (void)events;
+
+  flush_log();
+}
+
+// ### Reconnect to the system logger
+// Called when it is time to try sending queued log messages to a system
+// logger we could not reach.
+void handle_log_reconnect(timeout_t *to) {
+  (void)to;
+
+  flush_log();
+}
+
+// ### Connect to the system logger
+// Opens a non-blocking datagram socket connected to the system logger.
+// We have nowhere to report failure, so our socket is simply left closed.
+void open_log(void) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX,
+                              .sun_path = LOG_SOCKET_PATH };
+
+  // Our time stamps are in local time.
+  tzset();
+
+  if ((log_ev.fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                          0)) < 0) {
+    return;
+  }
+
+  if (connect(log_ev.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(log_ev.fd);
+    log_ev.fd = -1;
+  }
+}
+
+// ### Disconnect from the system logger
+// Closes our socket to the system logger.
+void disconnect_log(void) {
+  if (log_watched) {
+    remove_event(&log_ev);
+    log_watched = false;
+  }
+
+  if (log_ev.fd >= 0) {
+    close(log_ev.fd);
+    log_ev.fd = -1;
+  }
+}
+
+// ### Close the system log
+// Sends what we have left to log, including repeats not yet accounted
+// for, and disconnects from the system logger. Called at normal process
+// termination, when nothing is left to wait for but the system logger. We
+// wait for it to accept our messages for as long as it makes progress,
+// but there's no point in waiting for a system logger we can't reach.
+void close_log(void) {
+  struct timeval tv = { LOG_RECONNECT_PERIOD.tv_sec, 0 };
+  int retries = 0;
+
+  for (int i = 0; i < LOG_REPEATS_MAX; i++) {
+    queue_log_repeats(&log_repeats[i]);
+  }
+
+  while (log_count > 0 && retries < LOG_CLOSE_RETRIES) {
+    size_t count = log_count;
+
+    if (log_ev.fd < 0) {
+      open_log();
+    }
+    if (log_ev.fd < 0) {
+      break;
+    }
+
+    // Sending blocks for at most a reconnect period, which we count as a
+    // retry when no message got through.
+    fcntl(log_ev.fd, F_SETFL, fcntl(log_ev.fd, F_GETFL) & ~O_NONBLOCK);
+    setsockopt(log_ev.fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    flush_log();
+
+    retries = log_count < count ? 0 : retries + 1;
+  }
+  disconnect_log();
 }
 
 
@@ -815,39 +7372,37 @@ void *safe_alloc(size_t size)
   return mp;
 }
 
+// ### Remove a stale socket
+// Removes the Unix socket of the given type at the given path if nobody
+// is listening on it any more, which we find out by connecting to it.
+// Returns false and sets `errno` if the socket is still in use, or if we
+// can't tell. Anything but a socket at the path is left for `bind(2)` to
+// fail on.
+bool remove_stale_socket(const char *path, int type) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  struct stat st;
+  int fd, err;
+
+  if (lstat(path, &st) < 0 || !S_ISSOCK(st.st_mode)) {
+    return true;
+  }
+  if (!safe_strcpy(addr.sun_path, path, sizeof(addr.sun_path))
+      || (fd = socket(AF_UNIX, type | SOCK_CLOEXEC, 0)) < 0) {
+    return false;
+  }
+
+  err = connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ? errno : 0;
+  close(fd);
+  if (err != ECONNREFUSED) {
+    errno = err == 0 ? EADDRINUSE : err;
+    return false;
+  }
+  return unlink(path) == 0 || errno == ENOENT;
+}
+
 // ### Default directory file selector
 // A filter function used with `scandir(3)` which returns true for
 // all files in a directory excluding `.` and `..`.
 int only_files_selector(const struct dirent *d) {
   return strcmp(d->d_name, ".") != 0 && strcmp(d->d_name, "..") != 0;
 }
-
-// ### System logger
-// A `syslog(3)` convenience wrapper which takes a priority level, a
-// log message format, and a variable number of arguments to the message
-// format.
-void slog(int priority, char *message, ...)
-{
-  va_list ap;
-  sigset_t all_mask, orig_mask;
-
-  // We initialize a signal mask to contain all signals and block
-  // them while we're logging to ensure a signal does not interrupt us. The
-  // original signal mask is stored so we can reset it after logging.
-  sigfillset(&all_mask);
-  sigprocmask(SIG_BLOCK, &all_mask, &orig_mask);
-
-  // We log to the daemon log, typically found in `/var/log/daemon.log` with
-  // our ident and process id as prefixes.
-  openlog(IDENT, LOG_PID, LOG_DAEMON);
-
-  // We use the `vsyslog(3)` function which takes a `va_list` in stead
-  // of iterating over the list ourselves.
-  va_start(ap, message);
-  vsyslog(priority, message, ap);
-  va_end(ap);
-  closelog();
-
-  // We reset our signal mask to the one in use before we blocked all signals.
-  sigprocmask(SIG_SETMASK, &orig_mask, NULL);
-}
@@ -3,7 +3,7 @@
 // Constants
 // ---------
 
-// `syslog(3)` needs an identity.
+// Our messages to the system log are prefixed with an identity.
 #define IDENT "going"
 
 // A semantic version.
@@ -12,17 +12,39 @@
 // The command line flag used to change the default configuration directory.
 #define CMD_FLAG_CONFDIR "-d"
 
+// The command line flag used to have metrics written to a file.
+#define CMD_FLAG_METRICS "-m"
+
+// The command line flag used to limit how many children are starting at
+// once.
+#define CMD_FLAG_STARTS "-j"
+
+// The command line flag used to give us a control group directory of our
+// own to place children in.
+#define CMD_FLAG_CGROUP "-c"
+
 // Short usage instructions if you fail at typing.
 #define USAGE \
   "going " VERSION " (c) 2012 Eivind Uggedal\n" \
-  "usage: going [" CMD_FLAG_CONFDIR " conf.d]\n"
+  "usage: going [" CMD_FLAG_CONFDIR " conf.d] [" CMD_FLAG_CONTROL " socket] " \
+  "[" CMD_FLAG_METRICS " file] [" CMD_FLAG_STARTS " starts]\n" \
+  "             [" CMD_FLAG_CGROUP " cgroup]\n"
 
 // The sizes of our childrens' members. By using constant sizes we only
-// have to `malloc(3)` our entire child structure once per child.
-#define CHILD_NAME_SIZE 32
+// have to `malloc(3)` our entire child structure once per child. The size
+// of their names is shared with `goingctl` in the control protocol header.
 #define CHILD_CMD_SIZE 256
 #define CHILD_CWD_SIZE 256
 #define CHILD_ARGV_LEN CHILD_CMD_SIZE/2
+#define CHILD_PATH_SIZE PATH_MAX
+
+// A configuration file can run up to `INSTANCES_MAX` instances of its
+// child. Each instance is a child of its own named after the file with
+// `INSTANCE_SEPARATOR` and its index added. The index is told to every
+// process of an instance through `INSTANCE_ENV` in its environment.
+#define INSTANCES_MAX 4096
+#define INSTANCE_SEPARATOR '@'
+#define INSTANCE_ENV "GOING_INSTANCE"
 
 // Configuration file specifics like the default place to look for
 // configurations, the size of the buffer we use to read configuration
@@ -31,11 +53,324 @@
 #define CONFIG_LINE_BUFFER_SIZE CHILD_CMD_SIZE+32
 #define CONFIG_CMD_KEY "cmd"
 #define CONFIG_CWD_KEY "cwd"
+#define CONFIG_QUARANTINE_KEY "quarantine"
+#define CONFIG_QUARANTINE_MAX_KEY "quarantine_max"
+#define CONFIG_QUARANTINE_JITTER_KEY "quarantine_jitter"
+#define CONFIG_QUARANTINE_RESET_KEY "quarantine_reset"
+#define CONFIG_LOG_KEY "log"
+#define CONFIG_LOG_SIZE_KEY "log_size"
+#define CONFIG_LOG_FILES_KEY "log_files"
+#define CONFIG_RESTART_KEY "restart"
+#define CONFIG_STOP_TIMEOUT_KEY "stop_timeout"
+#define CONFIG_NOTIFY_KEY "notify"
+#define CONFIG_ROLLING_KEY "rolling"
+#define CONFIG_READY_TIMEOUT_KEY "ready_timeout"
+#define CONFIG_LISTEN_KEY "listen"
+#define CONFIG_INSTANCES_KEY "instances"
+#define CONFIG_PIN_KEY "pin"
+#define CONFIG_AFTER_KEY "after"
+#define CONFIG_MEMORY_MAX_KEY "memory_max"
+#define CONFIG_CPU_MAX_KEY "cpu_max"
+#define CONFIG_IO_WEIGHT_KEY "io_weight"
+#define CONFIG_CPUS_KEY "cpus"
+#define CONFIG_NICE_KEY "nice"
+#define CONFIG_IOPRIO_KEY "ioprio"
+#define CONFIG_LIMIT_NOFILE_KEY "limit_nofile"
+#define CONFIG_LIMIT_MEMLOCK_KEY "limit_memlock"
+#define CONFIG_LIMIT_CORE_KEY "limit_core"
+#define CONFIG_LIMIT_AS_KEY "limit_as"
+#define CONFIG_OOM_SCORE_ADJ_KEY "oom_score_adj"
+#define CONFIG_RESTART_RSS_KEY "restart_rss"
+#define CONFIG_RESTART_CPU_KEY "restart_cpu"
+#define CONFIG_RESTART_FDS_KEY "restart_fds"
+#define CONFIG_CHECK_KEY "check"
+#define CONFIG_CHECK_INTERVAL_KEY "check_interval"
+#define CONFIG_CHECK_TIMEOUT_KEY "check_timeout"
+#define CONFIG_CHECK_FAILURES_KEY "check_failures"
+#define CONFIG_PIDFILE_KEY "pidfile"
+
+// A child is respawned when it terminates according to its restart
+// policy: always, only when it failed by not exiting with a zero exit
+// status, or never.
+#define RESTART_ALWAYS 0
+#define RESTART_ON_FAILURE 1
+#define RESTART_NEVER 2
+
+// The instances of a child are either left to run on any processor, each
+// pinned to a processor of its own, or each pinned to the processors of a
+// NUMA node of its own. The processors of the nodes are listed below
+// `NODE_DIR`, which has up to `NODE_MAX` nodes.
+#define PIN_NONE 0
+#define PIN_CPU 1
+#define PIN_NODE 2
+#define NODE_DIR "/sys/devices/system/node"
+#define NODE_MAX 1024
+
+// A child's niceness, IO priority, resource limits, and OOM score
+// adjustment are inherited from us unless they're configured, which is
+// told by `INHERIT`. A resource limit of `LIMIT_UNLIMITED` means no limit.
+// Niceness goes from `NICE_MIN` to `NICE_MAX` and OOM score adjustments
+// from `OOM_SCORE_ADJ_MIN` to `OOM_SCORE_ADJ_MAX`.
+#define INHERIT LONG_MIN
+#define LIMIT_UNLIMITED -1
+#define NICE_MIN -20
+#define NICE_MAX 19
+#define OOM_SCORE_ADJ_MIN -1000
+#define OOM_SCORE_ADJ_MAX 1000
+#define OOM_SCORE_ADJ_PATH "/proc/self/oom_score_adj"
+
+// An IO priority is a class shifted by `IOPRIO_CLASS_SHIFT` with a level
+// below `IOPRIO_LEVELS` in the lower bits, where lower levels go first.
+// The C library has no `ioprio_set(2)` wrapper nor constants for it, so we
+// bring our own.
+#define IOPRIO_CLASS_RT 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_LEVELS 8
+#define IOPRIO_LEVEL_DEFAULT 4
+#define IOPRIO_WHO_PROCESS 1
+
+// The directories we look for binaries in if `$PATH` is not set, which is
+// the same default as the C library uses.
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+// Changes to configuration files are handled once the configuration
+// directory has been left alone for this long after the first change. We
+// keep track of at most `PENDING_CONFIGS_MAX` changed files at once and
+// read `inotify(7)` events into a buffer of `INOTIFY_BUFFER_SIZE` bytes.
+static struct timespec CONFIG_DEBOUNCE_PERIOD = {0, 250000000};
+#define PENDING_CONFIGS_MAX 256
+#define INOTIFY_BUFFER_SIZE 4096
+
+// We raise our limit on open file descriptors as far as we're allowed to
+// at startup, which children inherit unless they're given a limit of
+// their own. Besides the sockets it listens on we hold up to `CHILD_FDS`
+// file descriptors for each child, and up to `GOING_FDS` of our own.
+#define CHILD_FDS 10
+#define GOING_FDS (CONTROL_CONNECTIONS_MAX + 16)
 
 // Bad children which terminates before the limit we set here should be
-// quarantined accordingly.
+// quarantined accordingly. By default the first quarantine lasts
+// `QUARANTINE_PERIOD` seconds and every consecutive quarantine twice as
+// long up to `QUARANTINE_MAX` seconds, with up to `QUARANTINE_JITTER`
+// percent added at random. A child which stays up for `QUARANTINE_RESET`
+// seconds starts over. Configured quarantines can't exceed
+// `QUARANTINE_LIMIT` seconds.
 #define	QUARANTINE_TRIGGER 5
-static struct timespec QUARANTINE_PERIOD = {30, 0};
+#define QUARANTINE_PERIOD 30
+#define QUARANTINE_MAX 600
+#define QUARANTINE_JITTER 10
+#define QUARANTINE_RESET 60
+#define QUARANTINE_LIMIT 86400
+
+// A child we terminate is killed if it hasn't terminated within
+// `STOP_TIMEOUT` seconds of being asked to. Configured timeouts can't
+// exceed `STOP_TIMEOUT_LIMIT` seconds.
+#define STOP_TIMEOUT 10
+#define STOP_TIMEOUT_LIMIT 3600
+
+// A child restarted by starting its replacement before its previous
+// process is terminated waits for its replacement to tell us it's ready
+// for at most `READY_TIMEOUT` seconds. Configured timeouts can't exceed
+// `READY_TIMEOUT_LIMIT` seconds.
+#define READY_TIMEOUT 10
+#define READY_TIMEOUT_LIMIT 3600
+
+// A child can be started after up to `CHILD_AFTER_MAX` other children. A
+// child is starting until it tells us that it's ready, or for
+// `START_SETTLE_PERIOD` if it doesn't tell us, and those started after it
+// wait for as long. While the dependencies between children are resolved
+// every child is marked as unvisited, being visited, or visited.
+#define CHILD_AFTER_MAX 8
+static struct timespec START_SETTLE_PERIOD = {1, 0};
+#define DEPS_UNVISITED 0
+#define DEPS_VISITING 1
+#define DEPS_VISITED 2
+
+// When we're given a control group directory every child gets a control
+// group of its own below it, named after the child. The directory must be
+// a `cgroup2` directory delegated to us which we don't run in ourselves,
+// and we enable the `CGROUP_CONTROLLERS` below it which the limits of
+// children need. A limit is written as up to `CGROUP_VALUE_SIZE`
+// characters, and IO weights go up to `IO_WEIGHT_MAX`. As `posix_spawn(3)`
+// can't place a child in a control group, `WRAPPER_SHELL` runs
+// `CGROUP_WRAPPER` to move itself into the control group of the child
+// before it executes the command line of the child, or
+// `CGROUP_LISTEN_WRAPPER` to set `$LISTEN_PID` as well.
+#define CGROUP_CONTROLLERS { "memory", "cpu", "io" }
+#define CGROUP_WRAPPER "echo 0 > \"$0/cgroup.procs\"; exec \"$@\""
+#define CGROUP_LISTEN_WRAPPER "export LISTEN_PID=$$; " CGROUP_WRAPPER
+#define CGROUP_VALUE_SIZE 32
+#define IO_WEIGHT_MAX 10000
+
+// A child can be restarted when its process uses too much memory,
+// processor time, or files. Every watched child is sampled every
+// `WATCHDOG_PERIOD` by reading the files of its process below `/proc`,
+// which are kept open, into a buffer of `PROC_BUFFER_SIZE` bytes.
+// Configured processor times can't exceed `RESTART_CPU_LIMIT` seconds and
+// numbers of files can't exceed `RESTART_FDS_LIMIT`.
+static struct timespec WATCHDOG_PERIOD = {5, 0};
+#define PROC_PATH_FORMAT "/proc/%d/%s"
+#define PROC_BUFFER_SIZE 512
+#define RESTART_CPU_LIMIT 31536000
+#define RESTART_FDS_LIMIT 1048576
+
+// A child can be checked for being alive by executing a command with
+// `WRAPPER_SHELL`, by connecting to a socket on its behalf at `CHECK_HOST`
+// unless told otherwise, or by looking at when a heartbeat file was last
+// modified. A check is run every
+// `CHECK_INTERVAL_DEFAULT` seconds and fails if it doesn't pass within
+// `CHECK_TIMEOUT_DEFAULT` seconds, unless configured otherwise up to
+// `CHECK_PERIOD_MAX` seconds. The process of a child is restarted after
+// `CHECK_FAILURES_DEFAULT` failed checks in a row, or up to
+// `CHECK_FAILURES_MAX` if configured so.
+#define CHECK_NONE 0
+#define CHECK_EXEC 1
+#define CHECK_CONNECT 2
+#define CHECK_FILE 3
+#define CHECK_HOST "127.0.0.1"
+#define CHECK_INTERVAL_DEFAULT 10
+#define CHECK_TIMEOUT_DEFAULT 5
+#define CHECK_PERIOD_MAX 3600
+#define CHECK_FAILURES_DEFAULT 3
+#define CHECK_FAILURES_MAX 100
+
+// Processes orphaned by our children are reparented to us, and are traced
+// back to the child they came from by their session. Processes left in a
+// session are signalled in each of the process groups they're in, of
+// which we tell at most `SESSION_GROUPS_MAX` apart. A child which
+// daemonizes is followed through its pidfile, which is read into a buffer
+// of `PIDFILE_BUFFER_SIZE` bytes every `PIDFILE_RETRY_PERIOD` until the
+// daemon has written it or the ready timeout of the child has passed.
+#define PIDFILE_BUFFER_SIZE 32
+#define SESSION_GROUPS_MAX 64
+static struct timespec PIDFILE_RETRY_PERIOD = {0, 100000000};
+
+// Children tell us that they're ready by sending a datagram like
+// `READY=1` to the socket named in `$NOTIFY_SOCKET`, just like they would
+// tell `systemd(1)`. Our socket is in the abstract namespace and named
+// after our process id. Datagrams are read into a buffer of
+// `NOTIFY_BUFFER_SIZE` bytes, and file descriptors sent along with them
+// are closed.
+#define NOTIFY_ENV "NOTIFY_SOCKET"
+#define NOTIFY_PATH_FORMAT "@going/%d/notify"
+#define NOTIFY_PATH_SIZE 64
+#define NOTIFY_BUFFER_SIZE 4096
+#define NOTIFY_FDS_MAX 16
+
+// A child can have up to `CHILD_LISTEN_MAX` sockets listening on its
+// behalf, each given by an address of up to `CHILD_LISTEN_SIZE`
+// characters. They are passed to every process of the child from file
+// descriptor `LISTEN_FDS_START` on, as `systemd(1)` would, so we keep our
+// own listening sockets at `LISTEN_FD_MIN` or above where they can't get
+// in the way. As `posix_spawn(3)` can't tell a child its own process id
+// up front, `WRAPPER_SHELL` runs `LISTEN_WRAPPER` to set `$LISTEN_PID`
+// before it executes the command line of the child.
+#define CHILD_LISTEN_MAX 8
+#define CHILD_LISTEN_SIZE 128
+#define LISTEN_FDS_START 3
+#define LISTEN_FD_MIN (LISTEN_FDS_START + CHILD_LISTEN_MAX)
+#define LISTEN_BACKLOG SOMAXCONN
+#define WRAPPER_SHELL "/bin/sh"
+#define LISTEN_WRAPPER "export LISTEN_PID=$$; exec \"$0\" \"$@\""
+
+// A child gets our environment with at most `CHILD_ENV_MAX` variables of
+// its own added, which take up at most `CHILD_ENV_SIZE` bytes.
+#define CHILD_ENV_MAX 8
+#define CHILD_ENV_SIZE 1024
+
+// The output of a child is written to a log file of its own, by default
+// named after the child in `OUTPUT_LOG_DIR`. A log file is rotated when
+// it reaches `OUTPUT_LOG_SIZE` bytes and `OUTPUT_LOG_FILES` rotated log
+// files are kept. Configured log sizes can't exceed `OUTPUT_LOG_SIZE_LIMIT`
+// bytes.
+#define OUTPUT_LOG_DIR "/var/log/going"
+#define OUTPUT_LOG_SIZE 1048576
+#define OUTPUT_LOG_SIZE_LIMIT 1073741824
+#define OUTPUT_LOG_FILES 5
+#define OUTPUT_LOG_FILES_LIMIT 99
+
+// A log file which can't be opened or written to is tried again after
+// `OUTPUT_LOG_RETRY` seconds the next time there's output for it.
+#define OUTPUT_LOG_RETRY 10
+
+// The last `OUTPUT_TAIL_SIZE` bytes of output of every child are kept in
+// memory. Output is moved in chunks of at most `OUTPUT_CHUNK_SIZE` bytes,
+// and at most `OUTPUT_BATCH_SIZE` chunks from one child before other
+// events get their turn.
+#define OUTPUT_TAIL_SIZE 4096
+#define OUTPUT_CHUNK_SIZE 65536
+#define OUTPUT_BATCH_SIZE 4
+
+// We serve at most `CONTROL_CONNECTIONS_MAX` connections to our control
+// socket at once, and each of them has room for `CONTROL_BUFFER_SIZE`
+// bytes of replies not yet sent.
+#define CONTROL_CONNECTIONS_MAX 16
+#define CONTROL_BUFFER_SIZE 4096
+
+// Metrics of our children are written every `METRICS_PERIOD` when we're
+// asked to. Exits are counted per exit code or signal for up to
+// `METRICS_EXITS_MAX` different ones per child, and the rest together.
+static struct timespec METRICS_PERIOD = {15, 0};
+#define METRICS_EXITS_MAX 8
+
+// Histograms have buckets with upper bounds of 1, 2, ..., 8, 10, 12, 14,
+// 16, 20, 24, 28, 32, 40, and so on, so that a value is never off by more
+// than a quarter of itself. Larger values than the bounds of our buckets
+// go in the last one.
+#define HISTOGRAM_BUCKETS 128
+
+// The last `EXIT_HISTORY_SIZE` terminations of a child are remembered,
+// and are described in log messages with up to `EXIT_DESCRIPTION_SIZE`
+// characters.
+#define EXIT_HISTORY_SIZE 8
+#define EXIT_DESCRIPTION_SIZE 128
+
+// The index from process ids to children is an open addressed hash table
+// which starts out with this many slots and doubles whenever it gets half
+// full. The size must be a power of two so that we can mask in stead of
+// dividing when probing.
+#define PID_INDEX_MIN_SIZE 64
+
+// The index from configuration file names to children works the same way.
+#define NAME_INDEX_MIN_SIZE 64
+
+// The number of ready events we accept from `epoll_wait(2)` and the number
+// of pending signals we read from our `signalfd(2)` in one go.
+#define EVENT_BATCH_SIZE 64
+#define SIGNAL_BATCH_SIZE 16
+
+// The id type of `waitid(2)` for waiting on a process file descriptor.
+#define WAIT_P_PIDFD 3
+
+// Our heap of timeouts starts out with room for this many timeouts and
+// doubles whenever it gets full.
+#define TIMEOUTS_MIN_SIZE 64
+
+// The number of nanoseconds in a second.
+#define NSEC_PER_SEC 1000000000L
+
+// Log messages are sent as datagrams to the local system logger listening
+// on this socket.
+#define LOG_SOCKET_PATH "/dev/log"
+
+// Log messages wait in a ring buffer of this many entries until the system
+// logger accepts them. A message is truncated to fit an entry and is sent
+// with a header of at most `LOG_HEADER_SIZE` bytes prepended.
+#define LOG_RING_SIZE 256
+#define LOG_MESSAGE_SIZE 480
+#define LOG_HEADER_SIZE 64
+
+// Repeats of a message logged within this period of the first one are
+// counted in stead of logged, for up to `LOG_REPEATS_MAX` different
+// messages at a time. If the system logger can't be reached we try again
+// after the reconnect period. When we exit we keep trying to send what's
+// left for `LOG_CLOSE_RETRIES` reconnect periods without getting anywhere.
+static struct timespec LOG_REPEAT_PERIOD = {10, 0};
+static struct timespec LOG_RECONNECT_PERIOD = {1, 0};
+#define LOG_REPEATS_MAX 16
+#define LOG_CLOSE_RETRIES 5
 
 // If our system fails at giving us resources for `malloc(3)` or `fork(3)`
 // we'll have to wait a little.
@@ -45,22 +380,341 @@ static struct timespec QUARANTINE_PERIOD = {30, 0};
 // Types
 // -----
 
+// The `event_t` type is an event source for our main loop. It holds a file
+// descriptor to watch with `epoll(7)`, a handler which is called with the
+// event source and the ready events when the file descriptor is ready,
+// and a pointer to data of the handler's choosing.
+typedef struct going_event event_t;
+typedef void (*event_handler_t)(event_t *ev, uint32_t events);
+struct going_event {
+  int fd;
+  event_handler_t handler;
+  void *data;
+};
+
+// The `timeout_t` type is something we have to do at a later point in
+// time. It holds the deadline on the monotonic clock, a handler which is
+// called with the timeout when the deadline has passed, a pointer to data
+// of the handler's choosing, and the position of the timeout in our heap
+// of timeouts which is zero when it isn't scheduled.
+typedef struct going_timeout timeout_t;
+typedef void (*timeout_handler_t)(timeout_t *to);
+struct going_timeout {
+  struct timespec at;
+  timeout_handler_t handler;
+  void *data;
+  size_t heap_index;
+};
+
+// The `conf_t` type holds the configuration of a child as parsed from its
+// configuration file.
+//
+// The command line including arguments is split into words once when it
+// is parsed, and the path to its binary is resolved. Words are referred
+// to by their offsets into the `args` buffer in stead of by pointers so
+// that a configuration can be copied as a whole. The child runs in its
+// working directory.
+//
+// The quarantine and restart policies tell what happens when the child
+// terminates, and the stop timeout how long it gets to terminate. A child
+// might tell us when it's ready, and be restarted by starting its
+// replacement first.
+//
+// Output is logged to a file rotated at a given size, which each instance
+// has named after itself. The child listens on its addresses, runs as a
+// number of instances pinned where told, and is started after the
+// children it names.
+//
+// The limits of its control group are zero or an empty string for no
+// limit. The child runs on its processors, where none means any, and is
+// scheduled and limited by its niceness, IO priority, resource limits,
+// and OOM score adjustment.
+//
+// The process is restarted when it uses more memory, processor time, or
+// files than it may, where zero means no limit, or fails too many checks
+// of whether it's alive. A child which daemonizes names the pidfile of its
+// daemon.
+typedef struct going_conf {
+  char cmd[CHILD_CMD_SIZE+1];
+  char cwd[CHILD_CWD_SIZE+1];
+  char args[CHILD_CMD_SIZE+1];
+  uint16_t argv_off[CHILD_ARGV_LEN];
+  int argc;
+  char path[CHILD_PATH_SIZE+1];
+  long quarantine;
+  long quarantine_max;
+  long quarantine_jitter;
+  long quarantine_reset;
+  char log[CHILD_PATH_SIZE+1];
+  long log_size;
+  long log_files;
+  int restart;
+  long stop_timeout;
+  bool notify;
+  bool rolling;
+  long ready_timeout;
+  char listen[CHILD_LISTEN_MAX][CHILD_LISTEN_SIZE+1];
+  int listen_count;
+  long instances;
+  int pin;
+  char after[CHILD_AFTER_MAX][CHILD_NAME_SIZE+1];
+  int after_count;
+  char memory_max[CGROUP_VALUE_SIZE+1];
+  char cpu_max[CGROUP_VALUE_SIZE+1];
+  long io_weight;
+  cpu_set_t cpus;
+  long nice;
+  long ioprio;
+  long limit_nofile;
+  long limit_memlock;
+  long limit_core;
+  long limit_as;
+  long oom_score_adj;
+  long restart_rss;
+  long restart_cpu;
+  long restart_fds;
+  int check;
+  char check_spec[CHILD_CMD_SIZE+1];
+  long check_interval;
+  long check_timeout;
+  long check_failures;
+  char pidfile[CHILD_PATH_SIZE+1];
+} conf_t;
+
+// The `histogram_t` type counts values in buckets of increasing size,
+// along with the number of values and their sum.
+typedef struct going_histogram {
+  unsigned long buckets[HISTOGRAM_BUCKETS];
+  unsigned long count;
+  uint64_t sum;
+} histogram_t;
+
+// The `exit_count_t` type counts the exits of a child with a given exit
+// code, or from a given signal.
+typedef struct going_exit_count {
+  bool signaled;
+  int status;
+  unsigned long count;
+} exit_count_t;
+
+// The `metrics_t` type holds counters of the starts, exits, and
+// quarantines of a child, the wall clock time of its last exit, and
+// histograms of how long it took to start its processes in microseconds
+// and how long they stayed up in seconds.
+typedef struct going_metrics {
+  unsigned long starts;
+  unsigned long quarantines;
+  exit_count_t exits[METRICS_EXITS_MAX];
+  unsigned long other_exits;
+  time_t last_exit_at;
+  histogram_t spawn_latency;
+  histogram_t uptime;
+} metrics_t;
+
+// The `exit_record_t` type describes a terminated process of a child: the
+// monotonic time it was reaped at, how long it was up in seconds, its
+// status as returned by `waitpid(3)`, its maximum resident set size in
+// kilobytes, and the processor time it spent in user and system mode.
+typedef struct going_exit_record {
+  struct timespec at;
+  long uptime;
+  int status;
+  long maxrss;
+  struct timeval utime;
+  struct timeval stime;
+} exit_record_t;
+
+// The `sample_t` type is what the process of a child was using when we
+// sampled it: its resident set size in kilobytes, the processor time it
+// spent in user and system mode in seconds, and its number of open files.
+typedef struct going_sample {
+  long rss;
+  double cpu;
+  long fds;
+} sample_t;
+
 // The `child_t` type holds information for a child under supervision. We
 // identify it based on the name of its configuration file, parse its
-// command line including arguments, track its process id, the last time
-// it was started, and if it has been quarantined for terminating too fast.
-// By having a pointer to the next child we get a nice lightweight linked
-// list of children.
+// configuration, and note the inode number, modification time, and size
+// of the configuration file we parsed.
+//
+// We track its process id, and the last time it was started on the
+// monotonic clock. When the kernel supports it we also hold a process
+// file descriptor for the running process as an event source with the
+// child as its data.
+//
+// A child terminating too fast is quarantined, and a timeout ends its
+// quarantine. We count its consecutive quarantines and remember the
+// length of the current one. Another timeout kills its process if it
+// doesn't terminate when asked to.
+//
+// A process might have to get ready, within a timeout when it's a
+// replacement. While a child is being replaced its previous process and
+// its replacement point to each other. A child might still be starting,
+// or have started, and a timeout ends its start. It's marked while
+// dependencies are resolved.
+//
+// We note if we're restarting it, if it was stopped on request or by its
+// restart policy, if it was removed or replaced while its process
+// terminates, and the generation of the last configuration directory scan
+// which found its configuration file.
+//
+// The output of the child is read from a pipe which is another event
+// source, and written to its log file of which we know the size. A log
+// file we don't have is tried again at a given time. The last of its
+// output is kept in a ring buffer. Sockets listening on its behalf are
+// kept in the order of its addresses.
+//
+// Its control group is held as a directory along with its name. Its
+// `cgroup.events` file is an event source telling us when the control
+// group is no longer populated while we're draining it of processes left
+// behind by the process of the child.
+//
+// The `statm`, `stat`, and `fd` files of its process are kept open while
+// the child is watched.
+//
+// Checks of the child are run by a timeout which is also the deadline of
+// a running check. A running check is an event source for the socket
+// being connected, or for the process file descriptor of the process
+// checking the child, whose process id is kept until it's reaped. We count
+// the checks which failed in a row.
+//
+// The session of its process is kept while processes are left in it, and
+// a timeout has us read the pidfile of its daemon again.
+//
+// We also keep metrics of the child and a ring of records of its last
+// terminations. By having pointers to the previous and next child we get
+// a nice lightweight linked list of children from which we can remove a
+// child without walking it.
 typedef struct going_child {
-  char name[CHILD_NAME_SIZE+1];
-  char cmd[CHILD_CMD_SIZE+1];
-  char cwd[CHILD_CWD_SIZE+1];
+  char name[INSTANCE_NAME_SIZE+1];
+  char file[CHILD_NAME_SIZE+1];
+  int instance;
+  conf_t conf;
+  ino_t conf_ino;
+  struct timespec conf_mtime;
+  off_t conf_size;
   pid_t pid;
-  time_t up_at;
+  event_t pidfd_ev;
+  struct timespec up_at;
   bool quarantined;
+  timeout_t quarantine_to;
+  int quarantines;
+  struct timespec quarantine_period;
+  timeout_t kill_to;
+  bool ready;
+  timeout_t ready_to;
+  struct going_child *rolling;
+  bool starting;
+  bool started;
+  timeout_t start_to;
+  int deps_mark;
+  bool restarting;
+  bool stopped;
+  bool removed;
+  bool replaced;
+  unsigned long generation;
+  event_t output_ev;
+  int output_wfd;
+  int log_fd;
+  off_t log_written;
+  struct timespec log_retry_at;
+  char tail[OUTPUT_TAIL_SIZE];
+  size_t tail_start;
+  size_t tail_len;
+  int listen_fds[CHILD_LISTEN_MAX];
+  int cgroup_fd;
+  char cgroup_name[INSTANCE_NAME_SIZE+1];
+  event_t cgroup_ev;
+  bool draining;
+  int statm_fd;
+  int stat_fd;
+  int fds_fd;
+  timeout_t check_to;
+  event_t check_ev;
+  pid_t check_pid;
+  bool checking;
+  long failed_checks;
+  pid_t session;
+  timeout_t pidfile_to;
+  metrics_t metrics;
+  exit_record_t history[EXIT_HISTORY_SIZE];
+  size_t history_start;
+  size_t history_len;
+  struct going_child *prev;
   struct going_child *next;
 } child_t;
 
+// The `pid_entry_t` type is a slot in our index from process ids to
+// children. A slot with a process id of zero is empty.
+typedef struct going_pid_entry {
+  pid_t pid;
+  child_t *ch;
+} pid_entry_t;
+
+// The `index_t` type is an open addressed hash table with linear probing,
+// which both our process id index and our name index are. It holds its
+// slots of `entry_size` bytes each, how many slots it has and how many of
+// them are in use, and how many slots it starts out with. It's given a
+// function hashing an entry to its preferred slot and one telling whether
+// a slot is in use. An empty slot is all zeroes.
+typedef struct going_index {
+  void *slots;
+  size_t entry_size;
+  size_t size;
+  size_t count;
+  size_t min_size;
+  size_t (*slot)(const void *entry, size_t size);
+  bool (*used)(const void *entry);
+} index_t;
+
+// The `log_entry_t` type is a log message waiting to be sent to the
+// system logger. It holds the priority of the message, the wall clock
+// time it was logged at, and the formatted message itself.
+typedef struct going_log_entry {
+  int priority;
+  time_t at;
+  char message[LOG_MESSAGE_SIZE];
+} log_entry_t;
+
+// The `log_repeat_t` type is a log message remembered so that its
+// repeats are counted in stead of logged. Messages are repeats of each
+// other when they have the same priority, the same format, and are about
+// the same child, which is named by a string in them. The numbers in
+// them, like an uptime, are free to vary. Messages about none of our
+// children have to be identical.
+//
+// It holds the last of the repeated messages, how many repeats there
+// were, when the first message was logged, and the timeout for forgetting
+// it. A free entry has no format.
+typedef struct going_log_repeat {
+  int priority;
+  const char *format;
+  char subject[INSTANCE_NAME_SIZE+1];
+  char message[LOG_MESSAGE_SIZE];
+  unsigned long repeats;
+  struct timespec at;
+  timeout_t to;
+} log_repeat_t;
+
+// The `control_conn_t` type is a connection to our control socket. It
+// holds the connection as an event source, the bytes of requests read so
+// far, and the bytes of replies not yet sent. A reply with the status of
+// all children is built as it is sent, from the child it has come to. We
+// watch for the connection to be writable in stead of readable while we
+// have a reply to send.
+typedef struct going_control_conn {
+  event_t ev;
+  char in[CONTROL_FRAME_SIZE];
+  size_t in_len;
+  char out[CONTROL_BUFFER_SIZE];
+  size_t out_len;
+  size_t out_sent;
+  child_t *cursor;
+  bool streaming;
+  bool writing;
+} control_conn_t;
+
 
 // Prototypes
 // ----------
@@ -69,37 +723,341 @@ typedef struct going_child {
 // in a literate style possible.
 
 // Argument parsing
-char *parse_args(int argc, char **argv);
+void parse_args(int argc, char **argv);
+
+// File descriptor limit
+void setup_fd_limit(void);
+void check_fd_limit(void);
 
 // Configuration
 void parse_confdir(const char *dir);
+void reload_confdir(void);
 void add_new_children(const char *dir, struct dirent **dlist, int dn);
-void remove_old_children(struct dirent **dlist, int dn);
-bool parse_config(child_t *ch, FILE *fp, char *name);
+void remove_old_children(void);
+child_t *load_config(const char *dir, const char *name);
+void reload_config(const char *dir, const char *name);
+void refresh_child(child_t *ch, const char *dir, struct stat *st);
+void note_config_file(child_t *ch, struct stat *st);
+bool config_file_changed(child_t *ch, struct stat *st);
+bool config_differs(conf_t *a, conf_t *b);
+bool parse_config(child_t *ch, FILE *fp, const char *name);
+bool parse_number(const char *name, const char *key, const char *value,
+                  long min, long max, long *number);
+bool parse_restart(const char *name, const char *key, const char *value,
+                   int *restart);
+bool parse_flag(const char *name, const char *key, const char *value,
+                bool *flag);
+bool add_listen(conf_t *conf, const char *name, const char *value);
+bool parse_instances(const char *name, const char *key, const char *value,
+                     long *instances);
+bool parse_pin(const char *name, const char *key, const char *value,
+               int *pin);
+bool add_after(conf_t *conf, const char *name, const char *value);
+bool parse_memory_max(const char *name, const char *key, const char *value,
+                      char *memory_max);
+bool parse_cpu_max(const char *name, const char *key, const char *value,
+                   char *cpu_max);
+bool parse_cpus(const char *name, const char *key, const char *value,
+                cpu_set_t *cpus);
+bool parse_ioprio(const char *name, const char *key, const char *value,
+                  long *ioprio);
+bool parse_limit(const char *name, const char *key, const char *value,
+                 long *limit);
+bool parse_size(const char *name, const char *key, const char *value,
+                long *size);
+bool parse_check(const char *name, const char *key, const char *value,
+                 conf_t *conf);
+bool parse_cmd(conf_t *conf, const char *name);
+bool resolve_cmd(conf_t *conf);
+
+// Instances
+child_t *find_config_child(const char *file);
+child_t *find_instance(const char *file, int instance, long instances);
+void instance_name(char *buf, size_t size, const char *file, int instance,
+                   long instances);
+void add_instances(child_t *tmpl);
+child_t *new_instance(child_t *tmpl, int instance);
+void instance_conf(conf_t *conf, int instance);
+void refresh_instance(child_t *ch, conf_t *conf);
+void rename_instance(child_t *ch, long instances);
+void stamp_instances(child_t *first);
+void note_instances(child_t *first, struct stat *st);
+void remove_instances(child_t *first);
 
 // Execution of children
 void spawn_ready_children(void);
-bool respawn_terminated_children(void);
+void respawn_terminated_children(void);
+void handle_pidfd(event_t *ev, uint32_t events);
+void reap_child(child_t *ch, int status, const struct rusage *usage);
+void settle_child(child_t *ch);
+void quarantine_child(child_t *ch);
+void handle_quarantine_timeout(timeout_t *to);
 void spawn_child(child_t *ch);
-void exec_child(const char *cmd);
+int start_process(child_t *ch, pid_t *pid);
+int fork_process(child_t *ch, pid_t *pid);
+void build_argv(conf_t *conf, char **argv);
+char **build_envp(child_t *ch, pid_t pid, char *buf, size_t size);
+size_t child_env(child_t *ch, pid_t pid, char *buf, size_t size);
+void put_env(char *buf, size_t size, size_t *len, const char *fmt, ...);
+void exec_child(conf_t *conf, char **envp);
+bool child_affinity(child_t *ch, cpu_set_t *set);
+bool node_cpus(int instance, cpu_set_t *set);
+bool parse_cpu_list(const char *list, cpu_set_t *set);
+bool child_tuned(child_t *ch);
+void tune_process(child_t *ch);
+void set_limit(child_t *ch, int resource, long limit, const char *key);
+void set_oom_score_adj(child_t *ch);
+
+// Startup ordering
+void resolve_dependencies(void);
+void visit_dependencies(child_t *ch);
+void drop_dependency(child_t *first, int i);
+bool dependencies_started(child_t *ch);
+void begin_start(child_t *ch);
+void finish_start(child_t *ch, bool started);
+void handle_start_timeout(timeout_t *to);
+void schedule_starts(void);
+void handle_starts(timeout_t *to);
 
 // Signal handling
 void block_signals(sigset_t *block_mask);
-void wait_forever(sigset_t *block_mask, const char *confdir);
+void handle_signals(event_t *ev, uint32_t events);
+
+// Event loop
+void setup_event_loop(sigset_t *block_mask);
+bool add_event(event_t *ev, uint32_t events);
+bool modify_event(event_t *ev, uint32_t events);
+void remove_event(event_t *ev);
+void forget_ready_events(event_t *ev);
+void wait_forever(void);
+
+// Timers
+void schedule_timeout(timeout_t *to, const struct timespec *after);
+void cancel_timeout(timeout_t *to);
+bool timeout_pending(timeout_t *to);
+void sift_timeout_up(size_t i);
+void sift_timeout_down(size_t i);
+void arm_timer(void);
+void handle_timer(event_t *ev, uint32_t events);
+void monotonic_now(struct timespec *ts);
+void timespec_add(struct timespec *ts, const struct timespec *d);
+bool timespec_before(const struct timespec *a, const struct timespec *b);
+double timespec_seconds(const struct timespec *ts);
+long seconds_since(const struct timespec *ts);
+
+// Configuration directory watching
+void watch_confdir(const char *dir);
+void handle_inotify(event_t *ev, uint32_t events);
+void add_pending_config(const char *name);
+void handle_debounce(timeout_t *to);
+
+// Output capture
+void setup_output(void);
+bool open_output(child_t *ch);
+void close_output(child_t *ch);
+void handle_output(event_t *ev, uint32_t events);
+void capture_output(child_t *ch);
+void keep_output_tail(child_t *ch, size_t n);
+void discard_output_tee(void);
+void write_output_log(child_t *ch, size_t n);
+bool open_output_log(child_t *ch, int flags);
+void retry_output_log(child_t *ch);
+void rotate_output_log(child_t *ch);
+void close_output_log(child_t *ch);
+size_t output_tail(child_t *ch, char *buf, size_t size);
+
+// Listening sockets
+bool parse_listen(const char *spec, int *family, int *type, char *host,
+                  size_t size, const char **port);
+bool open_listeners(child_t *ch);
+int open_listener(const char *spec, bool shared);
+int bind_unix_listener(const char *path, int type);
+int bind_inet_listener(const char *host, const char *port, int type,
+                       bool shared);
+void keep_listeners(child_t *ch, conf_t *conf);
+void close_listeners(child_t *ch);
+void close_listener(const char *spec, int fd);
+
+// Control groups
+void setup_cgroups(void);
+bool open_cgroup(child_t *ch);
+void set_cgroup_limits(child_t *ch);
+bool write_cgroup_file(child_t *ch, const char *file, const char *value);
+bool join_cgroup(child_t *ch);
+bool cgroup_populated(child_t *ch);
+bool kill_cgroup(child_t *ch);
+bool drain_cgroup(child_t *ch);
+void handle_cgroup_events(event_t *ev, uint32_t events);
+void close_cgroup(child_t *ch);
+
+// Control socket
+void setup_control(const char *path);
+void close_control(void);
+void handle_control(event_t *ev, uint32_t events);
+void handle_control_conn(event_t *ev, uint32_t events);
+void read_control(control_conn_t *conn);
+void serve_control(control_conn_t *conn);
+void handle_control_request(control_conn_t *conn, const char *req,
+                            size_t len);
+void fill_control_status(control_conn_t *conn);
+bool queue_control_frame(control_conn_t *conn, const char *body, size_t len);
+bool queue_control_child(control_conn_t *conn, child_t *ch);
+bool queue_control_history(control_conn_t *conn, child_t *ch);
+bool queue_control_output(control_conn_t *conn, child_t *ch);
+bool queue_control_reply(control_conn_t *conn, int kind, const char *text);
+void put_control_number(char *p, uint32_t n);
+int control_state(child_t *ch);
+void write_control(control_conn_t *conn);
+void close_control_conn(control_conn_t *conn);
+void forget_control_child(child_t *ch);
+
+// Readiness notification
+void setup_notify(void);
+void handle_notify(event_t *ev, uint32_t events);
+void child_ready(child_t *ch);
+void handle_ready_timeout(timeout_t *to);
 
 // Children handling
-child_t *get_tail_child(void);
-bool has_child(char *name);
-bool child_active(char *name, struct dirent **dlist, int dn);
+void append_child(child_t *ch);
+void remove_child(child_t *ch);
+void drop_removed_child(child_t *ch);
 bool child_recently_spawned(child_t *ch, int seconds_ago);
-void kill_children(void);
+void restart_child(child_t *ch);
+void roll_child(child_t *ch);
+void finish_rolling(child_t *ch);
+child_t *retire_child_process(child_t *ch);
+void adopt_child_process(child_t *ch);
+void add_removed_child(child_t *ch);
+void start_child(child_t *ch);
+void stop_child(child_t *ch);
+bool restart_allowed(child_t *ch, int status);
+exit_record_t *remember_exit(child_t *ch, int status, long uptime,
+                             const struct rusage *usage);
+void describe_exit(const exit_record_t *rec, char *buf, size_t size);
+void shutdown_children(void);
+void finish_shutdown(void);
+size_t running_children(void);
 void kill_child(child_t *ch);
+void handle_kill_timeout(timeout_t *to);
+void signal_child(child_t *ch, int sig);
 void cleanup_children(void);
 void cleanup_child(child_t *ch);
 
+// Child process tracking
+bool track_child_process(child_t *ch);
+void release_child_process(child_t *ch);
+bool pidfd_supported(void);
+int open_pidfd(pid_t pid);
+int signal_pidfd(int fd, int sig);
+int wait_pidfd(int fd, siginfo_t *info, struct rusage *usage);
+int wait_status(const siginfo_t *info);
+
+// Orphans
+void setup_subreaper(void);
+void reap_orphan(pid_t session);
+bool read_process_stat(pid_t pid, pid_t *ppid, pid_t *pgid,
+                       pid_t *session);
+void drain_child(child_t *ch);
+bool drain_session(child_t *ch);
+size_t signal_session(pid_t session, int sig);
+void kill_session(child_t *ch);
+void settle_session(child_t *ch);
+void release_session(child_t *ch);
+bool follow_pidfile(child_t *ch, int status);
+void handle_pidfile_timeout(timeout_t *to);
+bool adopt_pidfile(child_t *ch);
+
+// Metrics
+void setup_metrics(void);
+void handle_metrics_timeout(timeout_t *to);
+void write_metrics(void);
+void write_metric_header(FILE *fp, const char *name, const char *type,
+                         const char *help);
+void write_histogram(FILE *fp, const char *name, const char *label,
+                     histogram_t *h, double unit);
+void record_spawn(child_t *ch, const struct timespec *started_at);
+void record_exit(child_t *ch, int status, long uptime);
+void record_histogram(histogram_t *h, uint64_t value);
+size_t histogram_bucket(uint64_t value);
+uint64_t histogram_bound(size_t i);
+const char *label_value(const char *value, char *buf, size_t size);
+
+// Resource watchdog
+void watch_child(child_t *ch);
+bool child_watched(child_t *ch);
+void handle_watchdog(timeout_t *to);
+bool sample_process(child_t *ch, sample_t *sample);
+bool open_proc_files(child_t *ch);
+long count_fds(int fd);
+void close_proc_files(child_t *ch);
+
+// Health checks
+void schedule_check(child_t *ch);
+void handle_check_timeout(timeout_t *to);
+void start_check(child_t *ch);
+bool check_file(child_t *ch, char *why, size_t size);
+int connect_check(child_t *ch);
+int spawn_check(child_t *ch);
+void handle_check_connect(event_t *ev, uint32_t events);
+void handle_check_pidfd(event_t *ev, uint32_t events);
+void reap_check(child_t *ch, int status);
+void check_result(child_t *ch, bool passed, const char *why);
+void end_check(child_t *ch);
+void stop_check(child_t *ch);
+void close_check(child_t *ch);
+void forget_check_process(child_t *ch);
+
+// Hash indexes
+void *index_at(const index_t *ix, size_t i);
+void index_add(index_t *ix, const void *entry);
+void index_place(index_t *ix, const void *entry);
+size_t index_find(const index_t *ix, size_t i,
+                  bool (*matches)(const void *entry, const void *key),
+                  const void *key);
+void index_remove(index_t *ix, size_t i);
+void cleanup_index(index_t *ix);
+
+// Process id index
+size_t pid_slot(pid_t pid, size_t size);
+size_t pid_entry_slot(const void *entry, size_t size);
+bool pid_entry_used(const void *entry);
+bool pid_entry_matches(const void *entry, const void *pid);
+void index_pid(child_t *ch, pid_t pid);
+void unindex_pid(pid_t pid);
+child_t *find_child_by_pid(pid_t pid);
+
+// Name index
+size_t name_slot(const char *name, size_t size);
+size_t name_entry_slot(const void *entry, size_t size);
+bool name_entry_used(const void *entry);
+bool name_entry_matches(const void *entry, const void *name);
+bool name_entry_is(const void *entry, const void *ch);
+void index_name(child_t *ch);
+void unindex_name(child_t *ch);
+child_t *find_child(const char *name);
+
+// Logging
+void slog(int priority, char *message, ...);
+void log_subject(const char *format, va_list ap, char *subject,
+                 size_t size);
+log_repeat_t *find_log_repeat(int priority, const char *format,
+                              const char *subject, const char *message);
+void remember_log(int priority, const char *format, const char *subject,
+                  const char *message);
+void queue_log(int priority, const char *message);
+void queue_log_drops(void);
+void queue_log_repeats(log_repeat_t *r);
+void handle_log_repeats(timeout_t *to);
+void flush_log(void);
+void handle_log(event_t *ev, uint32_t events);
+void handle_log_reconnect(timeout_t *to);
+void open_log(void);
+void disconnect_log(void);
+void close_log(void);
+
 // Utility functions
 bool str_not_empty(char *str);
 bool safe_strcpy(char *dst, const char *src, size_t size);
 void *safe_alloc(size_t size);
+bool remove_stale_socket(const char *path, int type);
 int only_files_selector(const struct dirent *d);
-void slog(int priority, char *message, ...);
@@ -0,0 +1,420 @@
+// Ask `going` about its children and tell it what to do with them.
+//
+// Design
+// ------
+//
+// `goingctl` connects to the control socket of a running `going` process,
+// sends it a single request, and prints its reply. Requests and replies
+// are frames with a length prefix as defined in
+// [`control.h`](control.h.html). A reply can be read with a buffer of a
+// single frame, no matter how many children `going` supervises.
+//
+// Usage
+// -----
+//
+// See [`goingctl(8)`](goingctl.8.html).
+
+// Dependencies
+// ------------
+
+// Include `exit(3)` and `EXIT_SUCCESS`.
+#include <stdlib.h>
+
+// Include `read(2)`, `write(2)`, and `close(2)`.
+#include <unistd.h>
+
+// Include the `bool` type and its `true` and `false` values.
+#include <stdbool.h>
+
+// Include fixed width integer types like `uint32_t`.
+#include <stdint.h>
+
+// Include string functions like `strcmp(3)` and `strlen(3)`.
+#include <string.h>
+
+// Include `printf(3)` and `fprintf(3)`.
+#include <stdio.h>
+
+// Include `errno` and constants like `EINTR`.
+#include <errno.h>
+
+// Include pre-defined values to be used with `exit(3)` like `EX_USAGE`
+// and `EX_UNAVAILABLE`.
+#include <sysexits.h>
+
+// Include the `WIFEXITED()` family of macros to describe the status of
+// terminated processes.
+#include <sys/wait.h>
+
+// Include `socket(2)` and `connect(2)`, and `struct sockaddr_un` for the
+// address of the control socket.
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Include `htonl(3)` and `ntohl(3)` for numbers in our control protocol.
+#include <arpa/inet.h>
+
+// Include the constants of our control protocol from the
+// [`control.h` header file](control.h.html).
+#include "control.h"
+
+// Include constants and function prototypes from the
+// [`goingctl.h` header file](goingctl.h.html).
+#include "goingctl.h"
+
+
+// Entrypoint
+// ----------
+
+int main(int argc, char **argv) {
+  const char *path = CONTROL_PATH;
+  char req[CONTROL_FRAME_SIZE];
+  size_t len;
+  int fd;
+
+  // A non-standard control socket can be given before the request.
+  if (argc > 2 && strcmp(CMD_FLAG_CONTROL, argv[1]) == 0) {
+    path = argv[2];
+    argc -= 2;
+    argv += 2;
+  }
+
+  if (parse_request(argc, argv, req, &len) != 0) {
+    fprintf(stderr, CTL_USAGE);
+    exit(EX_USAGE);
+  }
+
+  if ((fd = connect_control(path)) < 0) {
+    fprintf(stderr, "goingctl: can't connect to %s: %s\n", path,
+            strerror(errno));
+    exit(EX_UNAVAILABLE);
+  }
+
+  if (!send_request(fd, req, len)) {
+    fprintf(stderr, "goingctl: can't send request: %s\n", strerror(errno));
+    exit(EX_IOERR);
+  }
+
+  int status = receive_reply(fd);
+  close(fd);
+  return status;
+}
+
+
+// Requests
+// --------
+
+// ### Parse request
+// Builds the body of a request frame from the given command line
+// arguments following any flag, and stores its length in the given
+// pointer. Returns non-zero if they don't make up a request.
+int parse_request(int argc, char **argv, char *req, size_t *len) {
+  static const struct { const char *name; int req; bool named; } cmds[] = {
+    { "status", CONTROL_STATUS, false },
+    { "start", CONTROL_START, true },
+    { "stop", CONTROL_STOP, true },
+    { "restart", CONTROL_RESTART, true },
+    { "reload", CONTROL_RELOAD, false }
+  };
+
+  if (argc < 2 || argc > 3) {
+    return -1;
+  }
+
+  for (size_t i = 0; i < sizeof(cmds) / sizeof(*cmds); i++) {
+    if (strcmp(cmds[i].name, argv[1]) != 0) {
+      continue;
+    }
+
+    // Only a status request can do both with and without a name.
+    if ((argc == 3) != cmds[i].named && cmds[i].req != CONTROL_STATUS) {
+      return -1;
+    }
+
+    req[0] = cmds[i].req;
+    *len = 1;
+
+    if (argc == 3) {
+      size_t name_len = strlen(argv[2]);
+
+      if (name_len == 0
+          || 1 + name_len > CONTROL_FRAME_SIZE - CONTROL_LENGTH_SIZE) {
+        return -1;
+      }
+      memcpy(req + 1, argv[2], name_len);
+      *len += name_len;
+    }
+    return 0;
+  }
+  return -1;
+}
+
+// ### Connect to control socket
+// Returns a socket connected to the control socket at the given path, or
+// -1 if we could not connect.
+int connect_control(const char *path) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  int fd;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+    return -1;
+  }
+
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  return fd;
+}
+
+// ### Send request
+// Sends the given request body of the given length as a single frame.
+// Returns false if it could not be sent.
+bool send_request(int fd, const char *req, size_t len) {
+  char frame[CONTROL_FRAME_SIZE];
+  uint32_t n = htonl(len);
+
+  memcpy(frame, &n, CONTROL_LENGTH_SIZE);
+  memcpy(frame + CONTROL_LENGTH_SIZE, req, len);
+
+  size_t sent = 0, total = CONTROL_LENGTH_SIZE + len;
+
+  while (sent < total) {
+    ssize_t m = send(fd, frame + sent, total - sent, MSG_NOSIGNAL);
+
+    if (m < 0 && errno == EINTR) {
+      continue;
+    }
+    if (m < 0) {
+      return false;
+    }
+    sent += m;
+  }
+  return true;
+}
+
+
+// Replies
+// -------
+
+// ### Receive reply
+// Reads and prints reply frames until the reply is done. Returns the exit
+// status of `goingctl`: success when the reply is done, and failure when
+// `going` replied with an error or the reply was cut short.
+int receive_reply(int fd) {
+  char body[CONTROL_FRAME_SIZE];
+  size_t len;
+  bool header = false, exit_header = false;
+
+  while (read_frame(fd, body, &len)) {
+    switch (body[0]) {
+      case CONTROL_REPLY_CHILD:
+        // Children are listed under a header line.
+        if (!header) {
+          printf("%-*s %-11s %7s %9s %11s\n", CTL_NAME_WIDTH, "NAME",
+                 "STATE", "PID", "TIME", "QUARANTINES");
+          header = true;
+        }
+        print_child(body, len);
+        break;
+
+      case CONTROL_REPLY_EXIT:
+        // The last terminations of a child are listed under a header line
+        // of their own.
+        if (!exit_header) {
+          printf("\n%-12s %9s %-20s %10s %9s %9s\n", "EXITED", "UPTIME",
+                 "STATUS", "MAXRSS", "USER", "SYS");
+          exit_header = true;
+        }
+        print_exit(body, len);
+        break;
+
+      case CONTROL_REPLY_OUTPUT:
+        print_output(body, len);
+        break;
+
+      case CONTROL_REPLY_DONE:
+        return EXIT_SUCCESS;
+
+      case CONTROL_REPLY_ERROR:
+        fprintf(stderr, "goingctl: %.*s\n", (int)len - 1, body + 1);
+        return EXIT_FAILURE;
+    }
+  }
+
+  fprintf(stderr, "goingctl: incomplete reply\n");
+  return EX_PROTOCOL;
+}
+
+// ### Read frame
+// Reads a single frame into the given buffer, which must have room for a
+// whole frame, and stores the length of its body in the given pointer.
+// Returns false if no valid frame could be read.
+bool read_frame(int fd, char *body, size_t *len) {
+  char prefix[CONTROL_LENGTH_SIZE];
+
+  if (!read_fully(fd, prefix, CONTROL_LENGTH_SIZE)) {
+    return false;
+  }
+
+  *len = get_number(prefix);
+  if (*len == 0 || *len > CONTROL_FRAME_SIZE - CONTROL_LENGTH_SIZE) {
+    return false;
+  }
+
+  return read_fully(fd, body, *len);
+}
+
+// ### Read fully
+// Reads exactly the given number of bytes into the given buffer. Returns
+// false if the connection was closed or broken before that.
+bool read_fully(int fd, char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = read(fd, buf, len);
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    buf += n;
+    len -= n;
+  }
+  return true;
+}
+
+// ### Print child
+// Prints the status of a child from the given child frame body of the
+// given length as a line under our header line. The time is the uptime of
+// a child with a process and what is left of the quarantine of a
+// quarantined child.
+void print_child(const char *body, size_t len) {
+  char pid[16] = "-", seconds[16] = "-";
+
+  if (len < CONTROL_CHILD_NAME) {
+    return;
+  }
+
+  int state = (unsigned char)body[CONTROL_CHILD_STATE];
+  uint32_t ch_pid = get_number(body + CONTROL_CHILD_PID);
+
+  if (ch_pid > 0) {
+    snprintf(pid, sizeof(pid), "%u", ch_pid);
+  }
+  if (ch_pid > 0 || state == CONTROL_STATE_QUARANTINED) {
+    format_seconds(seconds, sizeof(seconds),
+                   get_number(body + CONTROL_CHILD_SECONDS));
+  }
+
+  printf("%-*.*s %-11s %7s %9s %11u\n", CTL_NAME_WIDTH,
+         (int)(len - CONTROL_CHILD_NAME), body + CONTROL_CHILD_NAME,
+         state_name(state), pid, seconds,
+         get_number(body + CONTROL_CHILD_QUARANTINES));
+}
+
+// ### Print exit
+// Prints a terminated process of a child from the given exit frame body of
+// the given length as a line under our header line of terminations.
+void print_exit(const char *body, size_t len) {
+  char ago[20], uptime[16], status[32];
+
+  if (len < CONTROL_EXIT_SIZE) {
+    return;
+  }
+
+  format_seconds(ago, sizeof(ago), get_number(body + CONTROL_EXIT_AGO));
+  strcat(ago, " ago");
+  format_seconds(uptime, sizeof(uptime),
+                 get_number(body + CONTROL_EXIT_UPTIME));
+  format_status(status, sizeof(status),
+                get_number(body + CONTROL_EXIT_STATUS));
+
+  uint32_t user = get_number(body + CONTROL_EXIT_USER);
+  uint32_t sys = get_number(body + CONTROL_EXIT_SYS);
+
+  printf("%-12s %9s %-20s %8ukB %5u.%02us %5u.%02us\n", ago, uptime, status,
+         get_number(body + CONTROL_EXIT_MAXRSS), user / 1000,
+         user % 1000 / 10, sys / 1000, sys % 1000 / 10);
+}
+
+// ### Print output
+// Prints the last output of a child from the given output frame body of
+// the given length, if it had any.
+void print_output(const char *body, size_t len) {
+  if (len < 2) {
+    return;
+  }
+
+  printf("\n");
+  fwrite(body + 1, 1, len - 1, stdout);
+  if (body[len - 1] != '\n') {
+    printf("\n");
+  }
+}
+
+
+// Utility functions
+// -----------------
+
+// ### Get a number from a frame
+// Returns the 32 bit number in network byte order at the given place in a
+// frame.
+uint32_t get_number(const char *p) {
+  uint32_t n;
+
+  memcpy(&n, p, sizeof(n));
+  return ntohl(n);
+}
+
+// ### State name
+// Returns the name of the given state of a child.
+const char *state_name(int state) {
+  switch (state) {
+    case CONTROL_STATE_RUNNING:     return "running";
+    case CONTROL_STATE_QUARANTINED: return "quarantined";
+    case CONTROL_STATE_STOPPED:     return "stopped";
+    case CONTROL_STATE_RESTARTING:  return "restarting";
+    case CONTROL_STATE_STOPPING:    return "stopping";
+    case CONTROL_STATE_WAITING:     return "waiting";
+    default:                        return "unknown";
+  }
+}
+
+// ### Format status
+// Formats the given status of a terminated process as returned by
+// `waitpid(3)` into the given buffer of the given size, like `exit 1` or
+// `signal 11 (core)`.
+void format_status(char *buf, size_t size, int status) {
+  if (WIFEXITED(status)) {
+    snprintf(buf, size, "exit %d", WEXITSTATUS(status));
+  } else if (WIFSIGNALED(status)) {
+    snprintf(buf, size, "signal %d%s", WTERMSIG(status),
+             WCOREDUMP(status) ? " (core)" : "");
+  } else {
+    snprintf(buf, size, "status %#x", status);
+  }
+}
+
+// ### Format seconds
+// Formats the given number of seconds into the given buffer of the given
+// size with its two most significant units, like `3d4h` or `5m6s`.
+void format_seconds(char *buf, size_t size, uint32_t seconds) {
+  if (seconds >= 86400) {
+    snprintf(buf, size, "%ud%uh", seconds / 86400, seconds % 86400 / 3600);
+  } else if (seconds >= 3600) {
+    snprintf(buf, size, "%uh%um", seconds / 3600, seconds % 3600 / 60);
+  } else if (seconds >= 60) {
+    snprintf(buf, size, "%um%us", seconds / 60, seconds % 60);
+  } else {
+    snprintf(buf, size, "%us", seconds);
+  }
+}
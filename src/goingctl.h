@@ -0,0 +1,32 @@
+// Header file for the [`goingctl.c` source file](goingctl.c.html).
+
+// Constants
+// ---------
+
+// Short usage instructions if you fail at typing.
+#define CTL_USAGE \
+  "usage: goingctl [" CMD_FLAG_CONTROL " socket] status [name]\n" \
+  "       goingctl [" CMD_FLAG_CONTROL " socket] start|stop|restart name\n" \
+  "       goingctl [" CMD_FLAG_CONTROL " socket] reload\n"
+
+// The width of the name column when listing the status of children, which
+// fits the longest name of an instance of a child.
+#define CTL_NAME_WIDTH INSTANCE_NAME_SIZE
+
+
+// Prototypes
+// ----------
+
+int parse_request(int argc, char **argv, char *req, size_t *len);
+int connect_control(const char *path);
+bool send_request(int fd, const char *req, size_t len);
+int receive_reply(int fd);
+bool read_frame(int fd, char *body, size_t *len);
+bool read_fully(int fd, char *buf, size_t len);
+void print_child(const char *body, size_t len);
+void print_exit(const char *body, size_t len);
+void print_output(const char *body, size_t len);
+uint32_t get_number(const char *p);
+const char *state_name(int state);
+void format_status(char *buf, size_t size, int status);
+void format_seconds(char *buf, size_t size, uint32_t seconds);